@@ -0,0 +1,92 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <stdio.h>
+#include <vector>
+
+class TObject;
+
+// Abort attribution. When enabled, a sample of aborts is recorded into
+// per-thread ring buffers: the reason passed to mark_abort_because, the
+// owner and key of the offending item, and the phase the abort happened
+// in. Each ring has one writer (its thread) and is read without locks;
+// queries aggregate whatever the rings currently hold.
+class AbortTelemetry {
+public:
+    enum phase_type {
+        ph_in_progress = 0, ph_opacity, ph_commit_lock, ph_commit_check,
+        ph_nphases,
+        ph_auto = ph_nphases // mark_abort_because: infer from state
+    };
+
+    struct record {
+        const TObject* owner;   // nullptr if no item was blamed
+        uintptr_t key;          // the item's key word
+        const char* reason;     // string literal; nullptr if unspecified
+        uint32_t phase;
+        uint32_t threadid;
+    };
+
+    static constexpr unsigned ring_size = 1024;
+    struct ring {
+        record r[ring_size];
+        // number of records ever written; r[i % ring_size] is record i
+        volatile uint64_t head;
+    };
+
+    struct thread_state {
+        ring* ring_;            // allocated on first record
+        unsigned countdown;
+        thread_state()
+            : ring_(nullptr), countdown(0) {
+        }
+    };
+
+    static bool enabled;
+    // record one of every sample_period aborts
+    static unsigned sample_period;
+
+    static void on_abort(thread_state& ts, int threadid, const TObject* owner,
+                         uintptr_t key, const char* reason, phase_type phase) {
+        if (!enabled)
+            return;
+        if (ts.countdown) {
+            --ts.countdown;
+            return;
+        }
+        ts.countdown = sample_period - 1;
+        append(ts, threadid, owner, key, reason, phase);
+    }
+
+    struct hot_key {
+        const TObject* owner;
+        uintptr_t key;
+        uint64_t count;
+    };
+    struct hot_owner {
+        const TObject* owner;
+        uint64_t count;
+    };
+    struct hot_reason {
+        const char* reason;
+        uint32_t phase;
+        uint64_t count;
+    };
+
+    // Copy out every record the rings currently hold.
+    static std::vector<record> snapshot();
+    // The n most frequent (owner, key) pairs, owners and (reason, phase)
+    // pairs among the recorded aborts, most frequent first.
+    static std::vector<hot_key> top_keys(unsigned n);
+    static std::vector<hot_owner> top_owners(unsigned n);
+    static std::vector<hot_reason> top_reasons(unsigned n);
+    static void print(FILE* f, unsigned n);
+    // Forget all records. Only call while no transactions are aborting.
+    static void clear();
+
+    static const char* phase_name(unsigned phase);
+
+private:
+    static void append(thread_state& ts, int threadid, const TObject* owner,
+                       uintptr_t key, const char* reason, phase_type phase);
+};
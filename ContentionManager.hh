@@ -0,0 +1,135 @@
+#pragma once
+#include "compiler.hh"
+#include <algorithm>
+#include <stdint.h>
+
+// Runtime contention management: how long to spin on a locked version
+// before giving up, and how long to back off before retrying an aborted
+// transaction. The policy can be changed at any time; each thread keeps
+// its own abort history in threadinfo_t.
+class ContentionManager {
+public:
+    enum policy_type {
+        // fixed spin, no retry backoff (the STO_SPIN_EXPBACKOFF=0 default)
+        p_spin = 0,
+        // exponential lock and retry backoff
+        p_exponential,
+        // like p_exponential, but each delay is uniformly random below the
+        // exponential bound
+        p_randomized,
+        // exponential backoff whose lock spin bound and retry delay grow
+        // with the thread's recent abort rate
+        p_adaptive,
+        p_npolicies
+    };
+
+    struct thread_state {
+        unsigned consecutive_aborts;
+        // decaying fraction of recent transactions that aborted;
+        // rate_one means all of them
+        unsigned abort_rate;
+        uint32_t rng;
+        thread_state()
+            : consecutive_aborts(0), abort_rate(0), rng(seed(this)) {
+        }
+        uint32_t random() {
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            return rng;
+        }
+    };
+
+    static constexpr unsigned rate_shift = 16;
+    static constexpr unsigned rate_one = 1U << rate_shift;
+    static constexpr unsigned rate_decay_shift = 4;
+
+    static policy_type policy;
+    // lock attempts before a committing writer gives up
+    static unsigned spin_write_attempts;     // p_spin
+    static unsigned backoff_write_attempts;  // other policies
+    // attempts before a reader waiting for an unlocked version gives up
+    static unsigned spin_wait_attempts;
+    static unsigned backoff_wait_attempts;
+    // retry backoff never spins more than 1 << max_backoff_shift times
+    static unsigned max_backoff_shift;
+
+    static const char* policy_name(policy_type p);
+    static bool parse_policy(const char* name, policy_type& p);
+
+    // Called after the `n`th failed attempt (n >= 1) to lock a version.
+    // Delays and returns true to try again, or returns false to give up.
+    static bool lock_spin(thread_state& ts, unsigned n, bool has_read) {
+        if (has_read)
+            return false;
+        if (policy == p_spin) {
+            if (n >= spin_write_attempts)
+                return false;
+        } else {
+            unsigned bound = backoff_write_attempts;
+            if (policy == p_adaptive)
+                bound = 2 + ((uint64_t) ts.abort_rate * 2 * bound >> rate_shift);
+            if (n >= bound)
+                return false;
+            delay(ts, n);
+        }
+        relax_fence();
+        return true;
+    }
+
+    // Called after the `n`th time (n >= 1) a reader found a version locked.
+    static bool wait_spin(thread_state& ts, unsigned n) {
+        if (policy == p_spin)
+            return n <= spin_wait_attempts;
+        if (n > backoff_wait_attempts)
+            return false;
+        delay(ts, n);
+        return true;
+    }
+
+    static void on_commit(thread_state& ts) {
+        ts.consecutive_aborts = 0;
+        ts.abort_rate -= ts.abort_rate >> rate_decay_shift;
+    }
+    static void on_abort(thread_state& ts) {
+        ++ts.consecutive_aborts;
+        ts.abort_rate += (rate_one - ts.abort_rate) >> rate_decay_shift;
+    }
+
+    // Called before retrying an aborted transaction. Returns the number of
+    // relax_fence() iterations spent waiting.
+    static unsigned retry_backoff(thread_state& ts) {
+        if (policy == p_spin || !ts.consecutive_aborts)
+            return 0;
+        unsigned shift = std::min(ts.consecutive_aborts + 3, max_backoff_shift);
+        unsigned x = 1U << shift;
+        if (policy == p_randomized)
+            x = ts.random() & (x - 1);
+        else if (policy == p_adaptive)
+            x = (uint64_t) x * ts.abort_rate >> rate_shift;
+        for (unsigned i = x; i; --i)
+            relax_fence();
+        return x;
+    }
+
+private:
+    // each thread's state lives in its own tinfo slot, so hashing its
+    // address gives every slot its own backoff sequence
+    static uint32_t seed(const void* p) {
+        uint64_t x = reinterpret_cast<uintptr_t>(p);
+        x = (x ^ (x >> 33)) * 0xFF51AFD7ED558CCDULL;
+        x = (x ^ (x >> 33)) * 0xC4CEB9FE1A85EC53ULL;
+        uint32_t s = x ^ (x >> 33);
+        return s ? s : 0x9E3779B9;  // xorshift state must be nonzero
+    }
+
+    static void delay(thread_state& ts, unsigned n) {
+        if (n <= 3)
+            return;
+        unsigned x = 1U << std::min(15U, n - 2);
+        if (policy == p_randomized)
+            x = ts.random() & (x - 1);
+        for (; x; --x)
+            relax_fence();
+    }
+};
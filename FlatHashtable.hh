@@ -0,0 +1,578 @@
+#pragma once
+#include "config.h"
+#include "compiler.hh"
+#include <stdlib.h>
+#if __SSE2__
+#include <emmintrin.h>
+#endif
+#include "Interface.hh"
+#include "Transaction.hh"
+#include "TWrapped.hh"
+#include "print_value.hh"
+
+// Open-addressing transactional hash map in the style of Swiss tables,
+// with the same transactional API as Hashtable. Slots are stored inline
+// in groups of one or more cache lines. Each group starts with one
+// control byte per slot (empty, deleted, or 7 bits of the key's hash)
+// and a group version, so a lookup matches its tag against a whole group
+// at once and a hit in the home group touches one cache line.
+//
+// Every slot has its own version. A group's version changes whenever
+// one of its slots is claimed or released; a failed lookup observes the
+// versions of the groups it probed, which is where a later insert of the
+// key would go. Slots are claimed and released under the lock of the
+// key's home group, so a key is in at most one slot.
+//
+// Keys and values must be trivially copyable. The capacity is fixed at
+// construction, and deleted slots are reused but never compacted.
+template <typename K, typename V, bool Opacity = true,
+          typename Hash = std::hash<K>, typename Pred = std::equal_to<K>>
+class FlatHashtable : public TBatchObject<FlatHashtable<K, V, Opacity, Hash, Pred> > {
+public:
+    typedef K key_type;
+    typedef V value_type;
+    typedef typename std::conditional<Opacity, TVersion, TNonopaqueVersion>::type Version_type;
+    typedef typename std::conditional<Opacity, TWrapped<V>, TNonopaqueWrapped<V>>::type wrapped_type;
+
+    static constexpr typename Version_type::type invalid_bit = TransactionTid::user_bit;
+
+    static_assert(mass::is_trivially_copyable<K>::value
+                  && mass::is_trivially_copyable<V>::value,
+                  "FlatHashtable keys and values are read without locks");
+
+private:
+    struct slot_type {
+        Version_type version;
+        K key;
+        wrapped_type value;
+    };
+
+    static constexpr uint8_t ctrl_empty = 0x80;
+    static constexpr uint8_t ctrl_deleted = 0xFE;
+    static constexpr unsigned max_width = 8;
+    static constexpr size_t group_header = 16;
+    static constexpr size_t group_bytes = (group_header + sizeof(slot_type) + 63) & ~size_t(63);
+    static constexpr unsigned width = std::min(size_t(max_width), (group_bytes - group_header) / sizeof(slot_type));
+    static constexpr unsigned width_mask = (1U << width) - 1;
+
+    struct group_type {
+        uint8_t ctrl[max_width];
+        Version_type version;
+        slot_type slots[width];
+
+        group_type()
+            : version(0) {
+            memset(ctrl, ctrl_empty, sizeof(ctrl));
+        }
+    } __attribute__((aligned(64)));
+    static_assert(sizeof(group_type) == group_bytes, "group layout");
+
+    group_type* groups_;
+    size_t mask_;
+    unsigned shift_;
+    Hash hasher_;
+    Pred pred_;
+
+    // keys of group TransItems (for phantom checks) have this bit set;
+    // slot keys are at least 8-byte aligned
+    static constexpr uintptr_t group_bit = 1;
+
+    static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
+    static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
+
+public:
+    // Sized for `capacity` keys at a maximum load factor of 7/8.
+    FlatHashtable(size_t capacity = 1024, Hash h = Hash(), Pred p = Pred())
+        : hasher_(h), pred_(p) {
+        size_t want = (capacity * 8 / 7 + width - 1) / width;
+        size_t n = 1;
+        shift_ = 64;
+        while (n < want) {
+            n <<= 1;
+            --shift_;
+        }
+        mask_ = n - 1;
+        void* mem;
+        always_assert(posix_memalign(&mem, 64, n * sizeof(group_type)) == 0);
+        groups_ = static_cast<group_type*>(mem);
+        for (size_t i = 0; i != n; ++i)
+            new(&groups_[i]) group_type;
+    }
+    ~FlatHashtable() {
+        free(groups_);
+    }
+    FlatHashtable(const FlatHashtable&) = delete;
+    FlatHashtable& operator=(const FlatHashtable&) = delete;
+
+    size_t ngroups() const {
+        return mask_ + 1;
+    }
+    size_t capacity() const {
+        return ngroups() * width;
+    }
+
+    // returns true if found false if not
+    bool transGet(const K& k, V& retval) {
+        while (1) {
+            Version_type sv;
+            slot_type* s = find(k, sv);
+            if (!s)
+                return false;
+            auto item = Sto::read_item(this, s);
+            if (!validity_check(item, sv)) {
+                Sto::abort();
+                return false;
+            }
+            if (has_delete(item))
+                return false;
+            if (item.has_write()) {
+                retval = item.template write_value<V>();
+                return true;
+            }
+            V v = s->value.access();
+            fence();
+            if (s->version == sv) {
+                item.observe(sv);
+                retval = v;
+                return true;
+            }
+            // the slot changed since the lookup; it might hold another key
+            relax_fence();
+        }
+    }
+
+    // returns true if successful
+    bool transDelete(const K& k) {
+        Version_type sv;
+        slot_type* s = find(k, sv);
+        if (!s)
+            return false;
+        auto item = Sto::item(this, s);
+        if (has_insert(item)) {
+            // deleting our own insert: release the slot now, then make
+            // sure no one else inserts the key before we commit
+            release_slot(s);
+            item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
+            find(k, sv);
+            return true;
+        }
+        if (sv.value() & invalid_bit) {
+            Sto::abort();
+            return false;
+        }
+        if (has_delete(item))
+            return false;
+        item.observe(sv);
+        item.add_write().add_flags(delete_bit);
+        return true;
+    }
+
+    template <typename VT>
+    bool transPut(const K& k, const VT& v) {
+        return trans_write</*insert*/true, /*set*/true>(k, v);
+    }
+
+    // returns true if successful
+    template <typename VT>
+    bool transInsert(const K& k, const VT& v) {
+        return !trans_write</*insert*/true, /*set*/false>(k, v);
+    }
+
+    template <typename VT>
+    bool transUpdate(const K& k, const VT& v) {
+        return trans_write</*insert*/false, /*set*/true>(k, v);
+    }
+
+    // returns true if inserted
+    bool nontrans_insert(const K& k, const V& v) {
+        size_t h = hash(k);
+        group_type& home = groups_[group_index(h)];
+        home.version.lock();
+        Version_type sv;
+        if (find_locked(k, h, sv)) {
+            home.version.unlock();
+            return false;
+        }
+        while (!claim_slot(home, h, k, v, true)) {
+            home.version.unlock();
+            relax_fence();
+            home.version.lock();
+        }
+        home.version.unlock();
+        return true;
+    }
+
+    bool nontrans_find(const K& k, V& v) {
+        size_t h = hash(k);
+        Version_type sv;
+        slot_type* s = find_locked(k, h, sv);
+        if (s && !(sv.value() & invalid_bit)) {
+            v = s->value.access();
+            return true;
+        }
+        return false;
+    }
+
+    // Prefetch step for interleaved execution (see Interleave.hh).
+    void prefetch(const K& k) {
+        ::prefetch(&groups_[group_index(hash(k))]);
+    }
+
+    bool check(TransItem& item, Transaction&) override {
+        return version_of(item).check_version(item.template read_value<Version_type>());
+    }
+    volatile TransactionTid::type* validation_word(TransItem& item) {
+        return &version_of(item).value();
+    }
+
+    bool lock(TransItem& item, Transaction& txn) override {
+        assert(!is_group(item));
+        return txn.try_lock(item, item.key<slot_type*>()->version);
+    }
+
+    void install(TransItem& item, Transaction& t) override {
+        assert(!is_group(item));
+        slot_type* s = item.key<slot_type*>();
+        if (has_delete(item)) {
+            s->version.set_version_locked(s->version.value() | invalid_bit);
+            return;
+        }
+        if (!has_insert(item))
+            s->value.write(item.template write_value<V>());
+        s->version.set_version(t.commit_tid());
+        // convert the nonopaque group version left by the insert to a
+        // commit tid, as Hashtable does for buckets
+        if (Opacity && has_insert(item)) {
+            group_type& g = group_of(s);
+            g.version.lock();
+            if ((g.version.value() & TransactionTid::nonopaque_bit)
+                && g.version.unlocked() < t.commit_tid())
+                g.version.set_version(t.commit_tid());
+            g.version.unlock();
+        }
+    }
+
+    void unlock(TransItem& item) override {
+        assert(!is_group(item));
+        item.key<slot_type*>()->version.unlock();
+    }
+
+    void cleanup(TransItem& item, bool committed) override {
+        if (committed ? has_delete(item) : has_insert(item))
+            release_slot(item.key<slot_type*>());
+    }
+
+    void print(std::ostream& w, const TransItem& item) const override {
+        w << "{FlatHashtable<" << typeid(K).name() << "," << typeid(V).name() << "> " << (void*) this;
+        if (is_group(item))
+            w << ".g[" << (group_key(item) - groups_) << "]";
+        else {
+            slot_type* s = item.key<slot_type*>();
+            w << "[" << mass::print_value(s->key) << "]";
+            if (item.has_write())
+                w << " =" << mass::print_value(item.template write_value<V>());
+        }
+        if (item.has_read())
+            w << " R" << item.template read_value<Version_type>();
+        w << "}";
+    }
+
+private:
+    size_t hash(const K& k) const {
+        return hasher_(k) * 0x9E3779B97F4A7C15ULL;
+    }
+    size_t group_index(size_t h) const {
+        return shift_ == 64 ? 0 : h >> shift_;
+    }
+    static uint8_t tag(size_t h) {
+        return h & 0x7F;
+    }
+
+    // bit i is set if slot i's control byte equals c
+    static unsigned match(const group_type& g, uint8_t c) {
+#if __SSE2__
+        __m128i ctrl = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(g.ctrl));
+        return _mm_movemask_epi8(_mm_cmpeq_epi8(ctrl, _mm_set1_epi8(c))) & width_mask;
+#else
+        unsigned m = 0;
+        for (unsigned i = 0; i != width; ++i)
+            if (g.ctrl[i] == c)
+                m |= 1U << i;
+        return m;
+#endif
+    }
+    // empty and deleted slots have the high bit set
+    static unsigned match_free(const group_type& g) {
+#if __SSE2__
+        __m128i ctrl = _mm_loadl_epi64(reinterpret_cast<const __m128i*>(g.ctrl));
+        return _mm_movemask_epi8(ctrl) & width_mask;
+#else
+        unsigned m = 0;
+        for (unsigned i = 0; i != width; ++i)
+            if (g.ctrl[i] & 0x80)
+                m |= 1U << i;
+        return m;
+#endif
+    }
+
+    // Scans one group for k. Returns false if the group changed during
+    // the scan. Otherwise sets `s` and `sv` to k's slot and its version
+    // (s is null if k is absent), and `more` if the probe must go on.
+    bool scan(group_type& g, const K& k, uint8_t t, Version_type& gv,
+              slot_type*& s, Version_type& sv, bool& more) {
+        gv = g.version;
+        if (gv.is_locked() && !gv.is_locked_here())
+            return false;
+        fence();
+        s = nullptr;
+        for (unsigned m = match(g, t); m; m &= m - 1) {
+            slot_type& x = g.slots[ctz(m)];
+            if (pred_(x.key, k)) {
+                s = &x;
+                sv = x.version;
+                break;
+            }
+        }
+        more = !s && !match(g, ctrl_empty);
+        fence();
+        return g.version == gv;
+    }
+
+    // Looks up k without locking. On a miss, observes the version of
+    // each probed group.
+    slot_type* find(const K& k, Version_type& sv) {
+        size_t h = hash(k);
+        uint8_t t = tag(h);
+        group_type* probed[max_width];
+        Version_type probed_version[max_width];
+        unsigned nprobed = 0;
+        size_t i = group_index(h), n = 0;
+        while (1) {
+            group_type& g = groups_[i];
+            Version_type gv;
+            slot_type* s;
+            bool more;
+            if (!scan(g, k, t, gv, s, sv, more)) {
+                relax_fence();
+                continue;
+            }
+            if (s)
+                return s;
+            if (nprobed == max_width) {
+                observe_group(*probed[0], probed_version[0]);
+                --nprobed;
+                memmove(probed, probed + 1, nprobed * sizeof(probed[0]));
+                memmove(probed_version, probed_version + 1, nprobed * sizeof(probed_version[0]));
+            }
+            probed[nprobed] = &g;
+            probed_version[nprobed] = gv;
+            ++nprobed;
+            if (!more || n == mask_)
+                break;
+            i = (i + 1) & mask_;
+            ++n;
+        }
+        for (unsigned j = 0; j != nprobed; ++j)
+            observe_group(*probed[j], probed_version[j]);
+        return nullptr;
+    }
+
+    // Looks up k, which cannot be inserted or removed meanwhile (the
+    // caller holds its home group's lock, or no one else is writing).
+    slot_type* find_locked(const K& k, size_t h, Version_type& sv) {
+        uint8_t t = tag(h);
+        for (size_t i = group_index(h), n = 0; n <= mask_; i = (i + 1) & mask_, ++n) {
+            group_type& g = groups_[i];
+            for (unsigned m = match(g, t); m; m &= m - 1) {
+                slot_type& x = g.slots[ctz(m)];
+                if (pred_(x.key, k)) {
+                    sv = x.version;
+                    return &x;
+                }
+            }
+            if (match(g, ctrl_empty))
+                break;
+        }
+        return nullptr;
+    }
+
+    void observe_group(group_type& g, Version_type gv) {
+        Sto::item(this, pack_group(g)).observe(Version_type(gv.unlocked()));
+    }
+
+    // Locks g, which follows `home` on a probe sequence. A group before
+    // home in index order (the probe wrapped) is only try-locked, to keep
+    // the lock order acyclic.
+    bool lock_after(group_type& home, group_type& g) {
+        if (&g == &home)
+            return true;
+        if (&g > &home) {
+            g.version.lock();
+            return true;
+        }
+        return g.version.try_lock();
+    }
+    void unlock_after(group_type& home, group_type& g) {
+        if (&g != &home)
+            g.version.unlock();
+    }
+
+    // Claims a free slot for k, holding the lock of k's home group. A
+    // slot is claimed in the first group on k's probe sequence that has
+    // one, so lookups that stop at a group with an empty slot still see
+    // it. Returns null if the probe wrapped into a locked group; the
+    // caller should release home and retry. Sets `gp`, `prev` and `next`
+    // to the slot's group and its versions before and after the claim.
+    slot_type* claim_slot(group_type& home, size_t h, const K& k, const V& v, bool valid,
+                          group_type** gp = nullptr, Version_type* prev = nullptr,
+                          Version_type* next = nullptr) {
+        for (size_t i = group_index(h), n = 0; ; i = (i + 1) & mask_, ++n) {
+            always_assert(n <= mask_ && "FlatHashtable is full");
+            group_type& g = groups_[i];
+            if (!lock_after(home, g))
+                return nullptr;
+            while (unsigned m = match_free(g)) {
+                for (; m; m &= m - 1) {
+                    unsigned j = ctz(m);
+                    slot_type& s = g.slots[j];
+                    // a stale transaction may hold a released slot's lock
+                    // until its validation fails
+                    if (!s.version.try_lock())
+                        continue;
+                    if (prev)
+                        *prev = Version_type(g.version.unlocked());
+                    s.key = k;
+                    s.value.access() = v;
+                    // keep slot versions increasing across reuse
+                    auto sv = (s.version.unlocked() & ~invalid_bit) + TransactionTid::increment_value;
+                    if (valid)
+                        sv = std::max(sv, Sto::initialized_tid());
+                    s.version.set_version_unlock(Version_type(sv | (valid ? 0 : invalid_bit)));
+                    fence();
+                    g.ctrl[j] = tag(h);
+                    g.version.inc_nonopaque_version();
+                    if (gp) {
+                        *gp = &g;
+                        *next = Version_type(g.version.unlocked());
+                    }
+                    unlock_after(home, g);
+                    return &s;
+                }
+                relax_fence();
+            }
+            unlock_after(home, g);
+        }
+    }
+
+    // Releases s, which holds an invalid (deleted or aborted) entry.
+    void release_slot(slot_type* s) {
+        size_t h = hash(s->key);
+        group_type& home = groups_[group_index(h)];
+        group_type& g = group_of(s);
+        while (1) {
+            home.version.lock();
+            if (lock_after(home, g))
+                break;
+            home.version.unlock();
+            relax_fence();
+        }
+        // a group with an empty slot never ended a probe that reached
+        // past it, so the slot can become empty rather than deleted
+        unsigned j = s - g.slots;
+        g.ctrl[j] = match(g, ctrl_empty) ? ctrl_empty : ctrl_deleted;
+        g.version.inc_nonopaque_version();
+        unlock_after(home, g);
+        home.version.unlock();
+    }
+
+    // returns true if item already existed, false if it did not
+    template <bool INSERT, bool SET>
+    bool trans_write(const K& k, const V& v) {
+        // an aborted non-throwing transaction must not claim slots
+        // (nothing would release them)
+        if (unlikely(Sto::aborted()))
+            return false;
+        size_t h = hash(k);
+        group_type& home = groups_[group_index(h)];
+        Version_type sv;
+        slot_type* s;
+        if (INSERT) {
+            home.version.lock();
+            s = find_locked(k, h, sv);
+            if (s)
+                home.version.unlock();
+        } else
+            s = find(k, sv);
+        if (s) {
+            auto item = Sto::item(this, s);
+            if (!validity_check(item, sv)) {
+                Sto::abort();
+                return false;
+            }
+            if (has_delete(item)) {
+                // delete-then-insert == update; delete-then-update == not found
+                if (INSERT)
+                    item.clear_flags(delete_bit).clear_write().template add_write<V>(v);
+                return false;
+            }
+            // make sure the item doesn't get deleted before us
+            item.observe(sv);
+            if (SET) {
+                item.template add_write<V>(v);
+                if (has_insert(item))
+                    s->value.write(v);
+            }
+            return true;
+        }
+        if (!INSERT)
+            return false;
+
+        group_type* g;
+        Version_type prev, next;
+        while (!(s = claim_slot(home, h, k, v, false, &g, &prev, &next))) {
+            home.version.unlock();
+            relax_fence();
+            home.version.lock();
+        }
+        home.version.unlock();
+        // our own insert must not invalidate our observation of the group
+        if (auto group_item = Sto::check_item(this, pack_group(*g)))
+            group_item->update_read(Version_type(prev), next);
+        // s may be a slot this transaction released when it deleted its
+        // own insert, leaving an item behind
+        auto item = Sto::item(this, s);
+        item.template add_write<V>(v);
+        item.add_flags(insert_bit);
+        return false;
+    }
+
+    group_type& group_of(slot_type* s) const {
+        return groups_[(reinterpret_cast<char*>(s) - reinterpret_cast<char*>(groups_)) / sizeof(group_type)];
+    }
+    Version_type& version_of(TransItem& item) {
+        if (is_group(item))
+            return group_key(item)->version;
+        return item.key<slot_type*>()->version;
+    }
+
+    bool has_delete(const TransItem& item) const {
+        return item.flags() & delete_bit;
+    }
+    bool has_insert(const TransItem& item) const {
+        return item.flags() & insert_bit;
+    }
+    bool validity_check(const TransItem& item, Version_type sv) const {
+        return has_insert(item) || !(sv.value() & invalid_bit);
+    }
+
+    static bool is_group(const TransItem& item) {
+        return reinterpret_cast<uintptr_t>(item.key<void*>()) & group_bit;
+    }
+    static group_type* group_key(const TransItem& item) {
+        assert(is_group(item));
+        return reinterpret_cast<group_type*>(reinterpret_cast<uintptr_t>(item.key<void*>()) & ~group_bit);
+    }
+    static void* pack_group(group_type& g) {
+        return reinterpret_cast<void*>(reinterpret_cast<uintptr_t>(&g) | group_bit);
+    }
+};
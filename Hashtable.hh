@@ -3,8 +3,12 @@
 #include "compiler.hh"
 // XXX: honestly hashtable should probably use local_vector too
 #include <vector>
+#include <thread>
+#include <iterator>
+#include <stdlib.h>
 #include "Interface.hh"
 #include "Transaction.hh"
+#include "Interleave.hh"
 #include "TWrapped.hh"
 #include "simple_str.hh"
 #include "print_value.hh"
@@ -19,7 +23,7 @@ template <typename K, typename V, bool Opacity = true, unsigned Init_size = 129,
 #ifdef STO_NO_STM
 class Hashtable {
 #else
-class Hashtable : public Shared {
+class Hashtable : public TBatchObject<Hashtable<K, V, Opacity, Init_size, W, Hash, Pred> > {
 #endif
 public:
     typedef K Key;
@@ -35,7 +39,13 @@ public:
     static constexpr typename Version_type::type invalid_bit = TransactionTid::user_bit;
 private:
   // our hashtable is an array of linked lists. 
-  // an internal_elem is the node type for these linked lists
+  // an internal_elem is the node type for these linked lists.
+  // An invalid element stands for an absent key: a failed lookup adds
+  // one (a placeholder) and observes its version, and a transactional
+  // insert fills one in, so a negative read conflicts only with inserts
+  // of the same key. Deleted elements are unlinked after commit, and
+  // stale placeholders are dropped when their bucket is migrated; both
+  // change the element's version first.
   struct internal_elem {
     // nate: I wonder if this would perform better if these had their own
     // cache line.
@@ -52,6 +62,9 @@ private:
 #else
     internal_elem(Key k, Value val, bool)
         : key(k), next(NULL), version(Sto::initialized_tid()), value(val) {}
+    bool valid() const {
+        return true;
+    }
 #endif
   };
 
@@ -59,30 +72,88 @@ private:
     // nate: we could inline the first element of a bucket. Would probably
     // make resize harder though.
     internal_elem *head;
-    // this is the bucket version number, which is incremented on insert
-    // we use it to make sure that an unsuccessful key lookup will still be
-    // unsuccessful at commit time (because this will always be true if no
-    // new inserts have occurred in this bucket)
+    // locks the chain; also marks the bucket as migrated
     Version_type version;
     bucket_entry() : head(NULL), version(0) {}
   };
 
-  typedef std::vector<bucket_entry> MapType;
-  // this is the hashtable itself, an array of bucket_entry's
-  MapType map_;
+  // this is the hashtable itself, an array of bucket_entry's.
+  // Resizing is incremental: while it runs, `next` is the table being
+  // filled, and writers migrate a few buckets at a time. A migrated
+  // bucket is empty and has migrated_bit set in its version, so lookups
+  // move on to `next`, and reads observed in the bucket fail validation.
+  // Replaced tables are freed through RCU, so a bucket TransItem can
+  // always check its bucket_entry. Non-transactional operations hold an
+  // epoch (Transaction::epoch_guard) while they use the table, and
+  // retired tables and elements are tagged with the current epoch.
+  struct table_type {
+    size_t size;
+    table_type* next;
+    bucket_entry* buckets;
+    size_t migrate_pos;
+    size_t nmigrated;
+  };
+  table_type* table_;
   Hash hasher_;
   Pred pred_;
-
-  // used to mark whether a key is a bucket (for bucket version checks)
-  // or a pointer (which will always have the lower 3 bits as 0)
-  static constexpr uintptr_t bucket_bit = 1U<<0;
+  size_t min_size_;
+  bool resize_check_;
+
+  // element count, striped by thread id to keep inserts from sharing a
+  // cache line. Each stripe asks for a load factor check every
+  // count_check_interval changes. nabsent counts placeholders added
+  // since the last resize (some may have been filled in since).
+  struct count_stripe {
+    long n;
+    long nabsent;
+    char pad[64 - 2 * sizeof(long)];
+  };
+  static constexpr unsigned count_stripes = 16;
+  static constexpr long count_check_interval = 64;
+  count_stripe count_[count_stripes];
+
+  // grow above max_load elements per bucket, shrink below
+  // 1/shrink_divisor (never below the initial size). If placeholders
+  // make up most of the elements, rehash at the same size instead,
+  // which drops them.
+  static constexpr size_t max_load = 1;
+  static constexpr size_t shrink_divisor = 8;
+  // buckets migrated per write while a resize is in progress
+  static constexpr size_t migrate_batch = 4;
+  // keys looked up together by transMultiGet
+  static constexpr unsigned multiget_group = 16;
+
+  static constexpr typename Version_type::type migrated_bit = TransactionTid::user_bit;
+  // set on elements removed from their chain
+  static constexpr typename Version_type::type unlinked_bit = TransactionTid::user_bit << 1;
 
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
 
 public:
-  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred()) : map_(), hasher_(h), pred_(p) {
-    map_.resize(size);
+  Hashtable(unsigned size = Init_size, Hash h = Hash(), Pred p = Pred())
+    : table_(new_table(std::max(size, 1U))), hasher_(h), pred_(p),
+      min_size_(table_->size), resize_check_(false), count_() {
+  }
+  Hashtable(Hashtable&& x)
+    : table_(x.table_), hasher_(x.hasher_), pred_(x.pred_),
+      min_size_(x.min_size_), resize_check_(false), count_() {
+    for (unsigned i = 0; i != count_stripes; ++i)
+      count_[i] = x.count_[i];
+    x.table_ = new_table(x.min_size_);
+    memset(x.count_, 0, sizeof(x.count_));
+  }
+  ~Hashtable() {
+    for_each_bucket([](bucket_entry& buck) {
+      for (internal_elem* e = buck.head; e; ) {
+        internal_elem* next = e->next;
+        e->~internal_elem();
+        Transaction::pool_free(e, sizeof(internal_elem));
+        e = next;
+      }
+    });
+    free(table_->next);
+    free(table_);
   }
 
   inline size_t hash(const Key& k) {
@@ -90,104 +161,127 @@ public:
   }
 
   inline size_t nbuckets() {
-    return map_.size();
+    return table_->size;
+  }
+
+  // approximate number of elements, counting placeholders
+  size_t size() const {
+    long n = 0;
+    for (unsigned i = 0; i != count_stripes; ++i)
+      n += count_[i].n;
+    return std::max(n, 0L);
   }
 
   inline size_t bucket(const Key& k) {
     return hash(k) % nbuckets();
   }
 
+  // Prefetch steps for interleaved execution (see Interleave.hh): a task
+  // that yields after prefetch(k) and again after prefetch_chain(k)
+  // finds k's bucket and the head of its chain in cache.
+  void prefetch(const Key& k) {
+    ::prefetch(&table_->buckets[bucket(k)]);
+  }
+  void prefetch_chain(const Key& k) {
+    if (internal_elem* e = buck_entry(k).head)
+      ::prefetch(e);
+  }
+
 #ifndef STO_NO_STM
   // returns true if found false if not
   template <typename KT, typename VT>
   bool transGet(const KT& k, VT& retval) {
-    bucket_entry& buck = buck_entry(k);
-    Version_type buck_version = buck.version;
-    fence();
-    internal_elem *e = find(buck, k);
-    if (e) {
-      auto item = t_read_only_item(e);
-      if (!validity_check(item, e)) {
-        Sto::abort();
-        return false;
-      }
+    Version_type elemvers;
+    internal_elem *e = find_or_placeholder(k, elemvers);
+    auto item = t_read_only_item(e);
 #if READ_MY_WRITES
-      // deleted
-      if (has_delete(item)) {
-        return false;
-      }
-      if (item.has_write()) {
-        retval = item.template write_value<write_value_type>();
-        return true;
-      }
-#endif
-      //Version_type elem_vers;
-      // "atomic" read of both the current value and the version #
-      //atomicRead(e, elem_vers, retval);
-      // check both node changes and node deletes
-      //item.add_read(elem_vers);
-      //if (Opacity)
-      //  check_opacity(e->version);
-      retval = e->value.read(item, e->version);
+    // deleted
+    if (has_delete(item)) {
+      return false;
+    }
+    // inserted or updated
+    if (item.has_write()) {
+      retval = item.template write_value<write_value_type>();
       return true;
-    } else {
-      Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
-      //if (Opacity)
-      //  check_opacity(buck.version);
+    }
+#endif
+    if (!valid(elemvers)) {
+      item.observe(elemvers);
       return false;
     }
+    retval = e->value.read(item, e->version);
+    // deleted since elemvers was read
+    Version_type read_version = item.template read_value<Version_type>();
+    if (read_version.value() & unlinked_bit)
+      Sto::abort();
+    return valid(read_version);
+  }
+
+#if STO_COROUTINES
+  // transGet for interleaved execution (see Interleave.hh): yields after
+  // prefetching k's bucket and again before each element of its chain,
+  // up to k's element, so transGet then walks the chain in cache.
+  template <typename VT>
+  Coroutine<bool> co_transGet(Key k, VT& retval) {
+    co_await interleave_yield(&table_->buckets[bucket(k)]);
+    for (internal_elem* e = buck_entry(k).head; e; e = e->next) {
+      co_await interleave_yield(e);
+      if (pred_(e->key, k))
+        break;
+    }
+    co_return transGet(k, retval);
+  }
+#endif
+
+  // transGet for n keys, in stages per group of keys: prefetches every
+  // key's bucket, then every chain head, then looks the keys up with
+  // transGet, so the cache misses overlap. Chain elements past the head
+  // are not prefetched. Same semantics as n transGet calls. found[i]
+  // says whether keys[i] was found; returns the number found. Arrays are
+  // passed as pointer and count: the tree builds with the compiler's
+  // default standard, gnu++17 for current g++, which has no std::span.
+  template <typename VT>
+  unsigned transMultiGet(const Key* keys, unsigned n, VT* values, bool* found) {
+    unsigned nfound = 0;
+    for (unsigned i = 0; i < n; i += multiget_group) {
+      unsigned end = std::min(i + multiget_group, n);
+      for (unsigned j = i; j != end; ++j)
+        prefetch(keys[j]);
+      for (unsigned j = i; j != end; ++j)
+        prefetch_chain(keys[j]);
+      for (unsigned j = i; j != end; ++j)
+        nfound += found[j] = transGet(keys[j], values[j]);
+    }
+    return nfound;
   }
 
 #if HASHTABLE_DELETE
   // returns true if successful
   bool transDelete(const Key& k) {
-    bucket_entry& buck = buck_entry(k);
-    Version_type buck_version = buck.version;
-    fence();
-    internal_elem *e = find(buck, k);
-    if (e) {
-      Version_type elemvers = e->version;
-      fence();
-      auto item = t_item(e);
-      bool valid = e->valid();
+    Version_type elemvers;
+    internal_elem *e = find_or_placeholder(k, elemvers);
+    auto item = t_item(e);
 #if READ_MY_WRITES
-      if (!valid && has_insert(item)) {
-        // we're deleting our own insert. special case this to just remove element and just check for no insert at commit
-        _remove(e);
-        // no way to remove an item (would be pretty inefficient)
-        // so we just unmark all attributes so the item is ignored
-        item.remove_read().remove_write().clear_flags(insert_bit | delete_bit);
-        // insert-then-delete still can only succeed if no one else inserts this node so we add a check for that
-        Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
-        return true;
-      } else
-#endif
-      if (!valid) {
-        Sto::abort();
-        return false;
-      }
-      assert(valid);
-#if READ_MY_WRITES
-      // we already deleted!
-      if (has_delete(item)) {
-        return false;
-      }
-#endif
-      // we need to make sure this bucket didn't change (e.g. what was once there got removed)
-      item.observe(elemvers);
-      //if (Opacity)
-      //  check_opacity(e->version);
-      // we use delete_bit to detect deletes so we don't need any other data
-      // for deletes, just to mark it as a write
-      item.add_write().add_flags(delete_bit);
+    if (has_insert(item)) {
+      // we're deleting our own insert: the element goes back to being a
+      // placeholder, whose read still catches other inserts of k
+      item.remove_write().clear_flags(insert_bit);
       return true;
-    } else {
-      // add a read that yes this element doesn't exist
-      Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_version.unlocked()));
-      //if (Opacity)
-      //  check_opacity(buck.version);
+    }
+    // we already deleted!
+    if (has_delete(item)) {
+      return false;
+    }
+#endif
+    // make sure the element isn't inserted or deleted by someone else
+    item.observe(elemvers);
+    if (!valid(elemvers)) {
       return false;
     }
+    // we use delete_bit to detect deletes so we don't need any other data
+    // for deletes, just to mark it as a write
+    item.add_write().add_flags(delete_bit);
+    return true;
   }
 #endif
 
@@ -195,86 +289,46 @@ private:
   // returns true if item already existed, false if it did not
   template <bool INSERT, bool SET, typename KT, typename VT>
   bool trans_write(const KT& k, const VT& v) {
-    // TODO: technically puts don't need to look into the table at all until lock time
-    bucket_entry& buck = buck_entry(k);
-    // TODO: update doesn't need to lock the table
-    // also we should lock the head pointer instead so we don't
-    // mess with tids
-    lock(buck.version);
-    internal_elem *e = find(buck, k);
-    if (e) {
-      unlock(buck.version);
-      Version_type elemvers = e->version;
-      fence();
-      auto item = t_item(e);
-      if (!validity_check(item, e)) {
-        Sto::abort();
-        // unreachable (t.abort() raises an exception)
-        return false;
-      }
+    // an aborted non-throwing transaction must not add writes
+    if (unlikely(Sto::aborted()))
+      return false;
+    Version_type elemvers;
+    internal_elem *e = find_or_placeholder(k, elemvers);
+    auto item = t_item(e);
 #if READ_MY_WRITES
-      if (has_delete(item)) {
-        // delete-then-insert == update (technically v# would get set to 0, but this doesn't matter
-        // if user can't read v#)
-        if (INSERT) {
-          item.clear_flags(delete_bit).clear_write().template add_write<write_value_type>(v);
-        } else {
-          // delete-then-update == not found
-          // delete will check for other deletes so we don't need to re-log that check
-        }
-        return false;
-      }
-#endif
-
-#if HASHTABLE_DELETE
-      // make sure the item doesn't get deleted before us
-      item.observe(elemvers);
-      //if (Opacity)
-      //  check_opacity(e->version);
-#endif
+    if (has_insert(item)) {
       if (SET) {
         item.template add_write<write_value_type>(v);
-#if READ_MY_WRITES
-        if (has_insert(item)) {
-          // Updating the value here, as we won't update it during install
-          e->value.write(v);
-        }
-#endif
       }
       return true;
-    } else {
-      if (!INSERT) {
-        auto buck_vers = buck.version.unlocked();
-        fence();
-        unlock(buck.version);
-        Sto::item(this, pack_bucket(bucket(k))).observe(Version_type(buck_vers));
-        //if (Opacity)
-        //    check_opacity(buck.version);
-        return false;
+    }
+    if (has_delete(item)) {
+      // delete-then-insert == update (technically v# would get set to 0, but this doesn't matter
+      // if user can't read v#)
+      if (INSERT) {
+        item.clear_flags(delete_bit).clear_write().template add_write<write_value_type>(v);
+      } else {
+        // delete-then-update == not found
+        // delete will check for other deletes so we don't need to re-log that check
       }
-
-      auto prev_version = buck.version.unlocked();
-      // not there so need to insert
-      insert_locked<false>(buck, k, v); // marked as invalid
-      auto new_head = buck.head;
-      auto new_version = buck.version.unlocked();
-      fence();
-      unlock(buck.version);
-      // see if this item was previously read
-      auto bucket_item = Sto::check_item(this, pack_bucket(bucket(k)));
-      if (bucket_item) {
-        bucket_item->update_read(Version_type(prev_version), Version_type(new_version));
-        //} else { could abort transaction now
+      return false;
+    }
+#endif
+    // make sure the element isn't inserted or deleted by someone else
+    item.observe(elemvers);
+    if (!valid(elemvers)) {
+      if (INSERT) {
+        // fill in the placeholder at install; the first inserter of k to
+        // commit changes its version, so any others fail validation
+        item.template add_write<write_value_type>(v);
+        item.add_flags(insert_bit);
       }
-      // use new_item because we know there are no collisions
-      auto item = Sto::new_item(this, new_head);
-      // don't actually need to Store anything for the write, just mark as valid on install
-      // (for now insert and set will just do the same thing on install, set a value and then mark valid)
-      item.template add_write<write_value_type>(v);
-      // need to remove this item if we abort
-      item.add_flags(insert_bit);
       return false;
     }
+    if (SET) {
+      item.template add_write<write_value_type>(v);
+    }
+    return true;
   }
 
 public:
@@ -296,74 +350,47 @@ public:
 
 
   bool check(TransItem& item, Transaction&) override {
-    if (is_bucket(item)) {
-      bucket_entry& buck = map_[bucket_key(item)];
-      return buck.version.check_version(item.template read_value<Version_type>());
-    }
     auto el = item.key<internal_elem*>();
     auto read_version = item.template read_value<Version_type>();
-    // if item has insert_bit then its an insert so no validity check needed.
-    // otherwise we check that it is both valid and not locked
-    // XXX bool validity_check = has_insert(item) || (el->valid() && (!is_locked(el->version) || item.has_lock(t)));
-    // XXX Why isn't it enough to just do the versionCheck?
     return el->version.check_version(read_version);
   }
+  volatile TransactionTid::type* validation_word(TransItem& item) {
+    return &item.key<internal_elem*>()->version.value();
+  }
 
   bool lock(TransItem& item, Transaction& txn) override {
-    assert(!is_bucket(item));
     auto el = item.key<internal_elem*>();
     return txn.try_lock(item, el->version);
   }
 
   void install(TransItem& item, Transaction& t) override {
-    assert(!is_bucket(item));
     auto el = item.key<internal_elem*>();
     assert(is_locked(el));
     // delete
     if (item.flags() & delete_bit) {
-      // XXX: think we need an extra bit in here for opacity, or we should remove this now 
-      // rather than in cleanup
       el->version.set_version_locked(el->version.value() | invalid_bit);
-      // we wait to remove the node til cleanup() (unclear that this is actually necessary)
+      // the element is unlinked in cleanup()
       return;
     }
     // else must be insert/update
-    if (!(item.flags() & insert_bit)) {
-      // Update
-      Value& new_v = item.template write_value<write_value_type>();
-      el->value.write(new_v);
-    }
+    Value& new_v = item.template write_value<write_value_type>();
+    el->value.write(new_v);
     //if (!__has_trivial_copy(Value)) {
       //Transaction::rcu_delete(new_v);
     //}
 
     el->version.set_version(t.commit_tid()); // automatically sets valid to true
-    // nate: this has no visible perf change on vacation (maybe slightly slower).
-#if 1
-    // convert nonopaque bucket version to a commit tid
-    if (Opacity && has_insert(item)) {
-      bucket_entry& buck = buck_entry(el->key);
-      lock(buck.version);
-      // only update if it's still nonopaque. Otherwise someone with a higher tid
-      // could've already updated it.
-      if (buck.version.value() & TransactionTid::nonopaque_bit)
-	buck.version.set_version(t.commit_tid());
-      unlock(buck.version);
-    }
-#endif
   }
 
   void unlock(TransItem& item) override {
-    assert(!is_bucket(item));
     auto el = item.key<internal_elem*>();
     unlock(el->version);
   }
 
   void cleanup(TransItem& item, bool committed) override {
-    if (committed ? has_delete(item) : has_insert(item)) {
-      auto el = item.key<internal_elem*>();
-      assert(!el->valid());
-      _remove(el);
+    // an aborted insert leaves its placeholder behind
+    if (committed && has_delete(item)) {
+      _remove(item.key<internal_elem*>());
     }
   }
 
@@ -392,12 +419,13 @@ public:
     int tot_count = 0;
     int max_chaining = 0;
     int num_empty = 0;
+    int num_buckets = 0;
 
-    for (unsigned i = 0; i < map_.size(); ++i) {
-      bucket_entry& buck = map_[i];
+    for_each_bucket([&](bucket_entry& buck) {
+      num_buckets++;
       if (!buck.head) {
         num_empty++;
-        continue;
+        return;
       }
       int ct = 0;
       internal_elem * list = buck.head;
@@ -408,42 +436,35 @@ public:
       }
 
       if (ct > max_chaining) max_chaining = ct;
-    }
+    });
 
-    printf("Total count: %d, Empty buckets: %d, Avg chaining: %f, Max chaining: %d\n", tot_count, num_empty, ((double)(tot_count))/(map_.size() - num_empty), max_chaining);
+    printf("Total count: %d, Buckets: %d, Empty buckets: %d, Avg chaining: %f, Max chaining: %d\n", tot_count, num_buckets, num_empty, ((double)(tot_count))/(num_buckets - num_empty), max_chaining);
   }
 
     void print(std::ostream& w, const TransItem& item) const override {
         w << "{Hashtable<" << typeid(K).name() << "," << typeid(V).name() << "> " << (void*) this;
-        if (is_bucket(item)) {
-            w << ".b[" << bucket_key(item) << "]";
-            if (item.has_read())
-                w << " R" << item.read_value<Version_type>();
-        } else {
-            auto el = item.key<internal_elem*>();
-            w << "[" << mass::print_value(el->key) << "]";
-            if (item.has_read())
-                w << " R" << item.read_value<Version_type>();
-            if (item.has_write())
-                w << " =" << mass::print_value(item.write_value<write_value_type>());
-        }
+        auto el = item.key<internal_elem*>();
+        w << "[" << mass::print_value(el->key) << "]";
+        if (item.has_read())
+            w << " R" << item.read_value<Version_type>();
+        if (item.has_write())
+            w << " =" << mass::print_value(item.write_value<write_value_type>());
         w << "}";
     }
 
   void print() {
     printf("Hashtable:\n");
-    for (unsigned i = 0; i < map_.size(); ++i) {
-      bucket_entry& buck = map_[i];
+    for_each_bucket([&](bucket_entry& buck) {
       if (!buck.head)
-        continue;
-      printf("bucket %d (version %d): ", i, buck.version);
+        return;
+      printf("bucket %p (version %d): ", &buck, buck.version);
       internal_elem *list = buck.head;
       while (list) {
         printf("key: %d, val: %d, version: %d, valid: %d ; ", list->key, list->value, list->version, list->valid());
         list = list->next;
       }
       printf("\n");
-    }
+    });
   }
 
   // non-transactional const iteration
@@ -455,71 +476,85 @@ public:
     }
 
     const_iterator& operator++() {
-      if (node) {
-        node = node->next;
-      }
-      while (!node && bucket != table->map_.size()) {
-        node = table->map_[bucket].head;
-        bucket++;
-      }
+      do {
+        if (node) {
+          node = node->next;
+        }
+        // migrated buckets' elements are in table->next
+        while (!node && table) {
+          if (++bucket == table->size) {
+            table = table->next;
+            bucket = -1;
+          } else if (!(table->buckets[bucket].version.value() & migrated_bit))
+            node = table->buckets[bucket].head;
+        }
+      } while (node && !node->valid());
       return *this;
     }
     
     bool operator!=(const const_iterator& it) const {
-      return node != it.node || bucket != it.bucket;
+      return node != it.node;
     }
   private:
-    const Hashtable *table;
-    int bucket;
+    const table_type *table;
+    size_t bucket;
     internal_elem *node;
     friend class Hashtable;
   };
 
   const_iterator begin() const {
     const_iterator begin;
-    begin.table = this;
+    begin.table = table_;
     begin.bucket = -1;
     begin.node = NULL;
     return ++begin; //eh
   }
   const_iterator end() const {
     const_iterator end;
-    end.bucket = map_.size();
+    end.table = NULL;
+    end.bucket = -1;
     end.node = NULL;
     return end;
   }
 
-  // remove given the internal element node. used by transaction system
+  // remove a deleted element. used by transaction system. The element
+  // may have been filled in by a later insert, or dropped by a
+  // migration, since the delete committed.
   void _remove(internal_elem *el) {
-    bucket_entry& buck = buck_entry(el->key);
-    lock(buck.version);
+    rehash_step();
+    bucket_entry& buck = lock_bucket(el->key);
     internal_elem *prev = NULL;
     internal_elem *cur = buck.head;
     while (cur != NULL && cur != el) {
       prev = cur;
       cur = cur->next;
     }
-    assert(cur);
+    if (!cur || !retire(cur)) {
+      unlock(buck.version);
+      return;
+    }
     if (prev) {
       prev->next = cur->next;
     } else {
       buck.head = cur->next;
     }
     unlock(buck.version);
-    Transaction::rcu_delete(cur);
+    count_add(-1);
+    Transaction::rcu_pool_delete_current(cur);
   }
 
   // non-txnal remove given a key
   bool remove(const Key& k) {
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    Transaction::epoch_guard guard;
+    rehash_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *prev = NULL;
     internal_elem *cur = buck.head;
     while (cur != NULL && !pred_(cur->key, k)) {
       prev = cur;
       cur = cur->next;
     }
-    if (!cur) {
+    if (!cur || !cur->valid()) {
       unlock(buck.version);
       return false;
     }
@@ -529,13 +564,17 @@ public:
       buck.head = cur->next;
     }
     unlock(buck.version);    
+    count_add(-1);
     // TODO(nate): this would probably work fine as-is
     // Transaction::rcu_free(cur);
     return true;
   }
 
   bool read(const Key& k, Value& retval) {
+    Transaction::epoch_guard guard;
     auto e = find(buck_entry(k), k);
+    if (e && !e->valid())
+      e = NULL;
     if (e) {
       // TODO(nate): this isn't safe for non-trivial types (need an atomic read)
       assign_val(retval, e->value.access());
@@ -551,9 +590,11 @@ public:
     val.assign(val_to_assign.data(), val_to_assign.length());
   }
 
+  // the element stays put only while the caller keeps its epoch
   Value* readPtr(const Key& k) {
+    Transaction::epoch_guard guard;
     auto e = find(buck_entry(k), k);
-    if (e) {
+    if (e && e->valid()) {
       return &e->value.access();
     }
     return NULL;
@@ -562,13 +603,15 @@ public:
   // returns pointer to the value in the hashtable 
   // (no current way to distinguish if insert or set)
   Value* putIfAbsentPtr(const Key& k, const Value& val) {
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    Transaction::epoch_guard guard;
+    rehash_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
     if (!e) {
       insert_locked<true>(buck, k, val);
       e = buck.head;
-    }
+    } else
+      fill(e, val);
     Value *ret = &e->value.access();
     unlock(buck.version);
     return ret;
@@ -577,14 +620,16 @@ public:
   // returns true if inserted. otherwise return false and val is set to current value.
   bool putIfAbsent(const Key& k, Value& val) {
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    Transaction::epoch_guard guard;
+    rehash_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
-    if (e) {
+    if (e && !fill(e, val)) {
       assign_val(val, e->value.access());
       exists = true;
     } else {
-      insert_locked<true>(buck, k, val);
+      if (!e)
+        insert_locked<true>(buck, k, val);
       exists = false;
     }
     unlock(buck.version);
@@ -595,16 +640,17 @@ public:
   template <bool Insert = true, bool Set = true>
   bool put(const Key& k, const Value& val) {
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    Transaction::epoch_guard guard;
+    rehash_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
-    if (e) {
+    if (e && (!Insert || !fill(e, val)) && e->valid()) {
       // XXX: kind of a stupid Set-only (still locks bucket)
       if (Set)
         set(e, val);
       exists = true;
     } else {
-      if (Insert)
+      if (Insert && !e)
         insert_locked<true>(buck, k, val);
       exists = false;
     }
@@ -617,17 +663,18 @@ public:
   template <bool Insert = true, bool Set = true>
   bool put_getold(const Key& k, const Value& val, Value& oldval) {
     bool exists = false;
-    bucket_entry& buck = buck_entry(k);
-    lock(buck.version);
+    Transaction::epoch_guard guard;
+    rehash_step();
+    bucket_entry& buck = lock_bucket(k);
     internal_elem *e = find(buck, k);
-    if (e) {
+    if (e && (!Insert || !fill(e, val)) && e->valid()) {
       assign_val(oldval, e->value.access());
       // XXX: kind of a stupid Set-only (still locks bucket)
       if (Set)
         set(e, val);
       exists = true;
     } else {
-      if (Insert)
+      if (Insert && !e)
         insert_locked<true>(buck, k, val);
       exists = false;
     }
@@ -661,9 +708,242 @@ public:
   // XXX: there's a race between the read and the remove (oldval might be stale) but mehh
   bool nontrans_remove(const Key& k, Value& oldval) { if (read(k,oldval)) return remove(k); else return false; }
 
+  // Non-transactional bulk load of (key, value) pairs in any order, split
+  // into nthreads contiguous chunks that are inserted in parallel. The
+  // table is sized for the result up front, so no resizing happens during
+  // the load. Existing keys are overwritten; for keys repeated in the
+  // input, one of the values wins. Must not run concurrently with any
+  // other use of the table. Worker threads take thread ids with
+  // TThread::register_thread().
+  template <typename It>
+  void bulk_load(It first, It last, unsigned nthreads = 1) {
+    size_t n = std::distance(first, last);
+    reserve(size() + n);
+    nthreads = std::max(std::min<size_t>(nthreads, n / 1024), size_t(1));
+    if (nthreads == 1) {
+      bulk_load_chunk(first, last);
+      return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i != nthreads; ++i) {
+      It chunk_last = std::next(first, n / nthreads + (i < n % nthreads));
+      workers.emplace_back([this, first, chunk_last] {
+        TThread::register_thread();
+        bulk_load_chunk(first, chunk_last);
+        TThread::unregister_thread();
+      });
+      first = chunk_last;
+    }
+    for (auto& w : workers)
+      w.join();
+  }
+
 private:
+  // grows the table, non-concurrently, to hold n elements
+  void reserve(size_t n) {
+    while (table_->next)
+      rehash(table_);
+    size_t new_size = table_->size;
+    while (new_size * max_load < n)
+      new_size *= 2;
+    if (new_size == table_->size)
+      return;
+    table_type* t = table_;
+    t->next = new_table(new_size);
+    while (table_ == t)
+      rehash(t);
+  }
+
+  template <typename It>
+  void bulk_load_chunk(It first, It last) {
+    for (; first != last; ++first) {
+      bucket_entry& buck = lock_bucket(first->first);
+      internal_elem* e = find(buck, first->first);
+      if (!e)
+        insert_locked<true>(buck, first->first, first->second);
+      else if (!fill(e, first->second))
+        set(e, first->second);
+      unlock(buck.version);
+    }
+  }
+
+  static table_type* new_table(size_t size) {
+    // an empty bucket is all zeroes, so calloc can hand out large
+    // tables lazily
+    table_type* t = (table_type*) calloc(1, sizeof(table_type) + size * sizeof(bucket_entry));
+    always_assert(t);
+    t->size = size;
+    t->buckets = reinterpret_cast<bucket_entry*>(t + 1);
+    return t;
+  }
+
+  // returns the bucket that currently holds k's chain
   bucket_entry& buck_entry(const Key& k) {
-    return map_[bucket(k)];
+    size_t h = hash(k);
+    table_type* t = table_;
+    while (1) {
+      bucket_entry& buck = t->buckets[h % t->size];
+      if (!(buck.version.value() & migrated_bit))
+        return buck;
+      t = t->next;
+    }
+  }
+
+  // returns k's element and its version, adding a placeholder if k has
+  // none. An unlocked search can miss elements a migration is moving, so
+  // a miss is repeated under the bucket lock. Elements unlinked in the
+  // meantime are looked up again.
+  internal_elem* find_or_placeholder(const Key& k, Version_type& version) {
+    while (1) {
+      internal_elem* e = elem(k);
+      if (!e) {
+        rehash_step();
+        bucket_entry& buck = lock_bucket(k);
+        e = find(buck, k);
+        if (!e) {
+          insert_locked<false>(buck, k, Value());
+          e = buck.head;
+          fetch_and_add(&count_[TThread::id() % count_stripes].nabsent, 1L);
+        }
+        unlock(buck.version);
+      }
+      version = e->version;
+      fence();
+      if (!(version.value() & unlinked_bit))
+        return e;
+    }
+  }
+
+  // non-transactional insert into a placeholder, with its bucket locked.
+  // Returns false if the element is valid.
+  bool fill(internal_elem* e, const Value& val) {
+    if (e->valid())
+      return false;
+    lock(e->version);
+    bool ok = !e->valid();
+    if (ok) {
+      e->value.access() = val;
+      e->version.inc_nonopaque_version();
+      e->version.set_version_locked(e->version.value() & ~invalid_bit);
+    }
+    unlock(e->version);
+    return ok;
+  }
+
+  // prepares an invalid element for unlinking, with its bucket locked, by
+  // changing its version so reads that saw the key absent there fail.
+  // Returns false if the element is valid or being committed.
+  bool retire(internal_elem* e) {
+    if (e->valid() || !e->version.try_lock())
+      return false;
+    bool ok = !e->valid();
+    if (ok) {
+      e->version.inc_nonopaque_version();
+      e->version.set_version_locked(e->version.value() | unlinked_bit);
+    }
+    unlock(e->version);
+    return ok;
+  }
+
+  // locks and returns the bucket that currently holds k's chain
+  bucket_entry& lock_bucket(const Key& k) {
+    size_t h = hash(k);
+    table_type* t = table_;
+    while (1) {
+      bucket_entry& buck = t->buckets[h % t->size];
+      lock(buck.version);
+      if (!(buck.version.value() & migrated_bit))
+        return buck;
+      unlock(buck.version);
+      t = t->next;
+    }
+  }
+
+  template <typename F>
+  void for_each_bucket(F f) const {
+    for (table_type* t = table_; t; t = t->next)
+      for (size_t i = 0; i != t->size; ++i)
+        if (!(t->buckets[i].version.value() & migrated_bit))
+          f(t->buckets[i]);
+  }
+
+  size_t absent() const {
+    long n = 0;
+    for (unsigned i = 0; i != count_stripes; ++i)
+      n += count_[i].nabsent;
+    return std::max(n, 0L);
+  }
+
+  void count_add(long delta) {
+    long n = fetch_and_add(&count_[TThread::id() % count_stripes].n, delta) + delta;
+    if (n % count_check_interval == 0)
+      resize_check_ = true;
+  }
+
+  // called before each write, holding no locks
+  void rehash_step() {
+    table_type* t = table_;
+    if (unlikely(t->next || resize_check_))
+      rehash(t);
+  }
+
+  void rehash(table_type* t) {
+    if (!t->next) {
+      resize_check_ = false;
+      size_t n = size(), new_size;
+      if (n > t->size * max_load)
+        new_size = absent() > n / 2 ? t->size : t->size * 2;
+      else if (t->size > min_size_ && n < t->size / shrink_divisor)
+        new_size = std::max(t->size / 2, min_size_);
+      else
+        return;
+      table_type* nt = new_table(new_size);
+      if (!bool_cmpxchg(&t->next, (table_type*) NULL, nt)) {
+        free(nt);
+        return;
+      }
+    }
+    size_t pos = fetch_and_add(&t->migrate_pos, migrate_batch);
+    if (pos >= t->size)
+      return;
+    size_t end = std::min(pos + migrate_batch, t->size);
+    for (size_t i = pos; i != end; ++i)
+      migrate(t, t->buckets[i]);
+    if (fetch_and_add(&t->nmigrated, end - pos) + (end - pos) == t->size) {
+      release_fence();
+      table_ = t->next;
+      for (unsigned i = 0; i != count_stripes; ++i)
+        count_[i].nabsent = 0;
+      Transaction::rcu_free_current(t);
+    }
+  }
+
+  // moves a bucket's chain into t->next, dropping placeholders. Moved
+  // elements keep their versions.
+  void migrate(table_type* t, bucket_entry& buck) {
+    table_type* nt = t->next;
+    lock(buck.version);
+    internal_elem* e = buck.head;
+    while (e) {
+      internal_elem* next = e->next;
+      if (retire(e)) {
+        count_add(-1);
+        Transaction::rcu_pool_delete_current(e);
+        e = next;
+        continue;
+      }
+      bucket_entry& nbuck = nt->buckets[hash(e->key) % nt->size];
+      lock(nbuck.version);
+      e->next = nbuck.head;
+      nbuck.head = e;
+      nbuck.version.inc_nonopaque_version();
+      unlock(nbuck.version);
+      e = next;
+    }
+    buck.head = NULL;
+    buck.version.inc_nonopaque_version();
+    buck.version.set_version_locked(buck.version.value() | migrated_bit);
+    unlock(buck.version);
   }
 
   // looks up a key's internal_elem, given its bucket
@@ -688,8 +968,8 @@ private:
       return item.flags() & insert_bit;
   }
 
-  bool validity_check(const TransItem& item, internal_elem *e) {
-    return has_insert(item) || e->valid();
+  static bool valid(Version_type v) {
+    return !(v.value() & invalid_bit);
   }
 
 #if 0
@@ -701,20 +981,6 @@ private:
   }
 #endif
 
-  static bool is_bucket(const TransItem& item) {
-      return is_bucket(item.key<void*>());
-  }
-  static bool is_bucket(void* key) {
-      return (uintptr_t)key & bucket_bit;
-  }
-  static unsigned bucket_key(const TransItem& item) {
-      assert(is_bucket(item));
-      return (uintptr_t) item.key<void*>() >> 1;
-  }
-  void* pack_bucket(unsigned bucket) {
-      return (void*) ((bucket << 1) | bucket_bit);
-  }
-
   static bool is_locked(Version_type &v) {
     return v.is_locked();
   }
@@ -728,10 +994,11 @@ private:
   template <bool markValid>
   void insert_locked(bucket_entry& buck, const Key& k, const Value& val) {
     assert(is_locked(buck.version));
-    auto new_head = new internal_elem(k, val, markValid);
+    auto new_head = Transaction::pool_new<internal_elem>(k, val, markValid);
     internal_elem *cur_head = buck.head;
     new_head->next = cur_head;
     buck.head = new_head;
+    count_add(1);
     // TODO(nate): this means we'll always have to do a hard opacity check on 
     // the bucket version (but I don't think we can get a commit tid yet).
     buck.version.inc_nonopaque_version();
@@ -5,6 +5,13 @@
 
 #include "config.h"
 #include "compiler.hh"
+#if __SSE2__
+#include <immintrin.h>
+#endif
+
+#ifndef MAX_THREADS
+#define MAX_THREADS 256
+#endif
 
 class Transaction;
 class TransItem;
@@ -12,6 +19,16 @@ class TransProxy;
 
 class TThread {
     static __thread int the_id;
+    // the slot register_thread() gave this thread, or -1
+    static __thread int registered_id_;
+    // one more than the largest thread id ever used; bounds scans of
+    // Transaction::tinfo
+    static int id_limit_;
+    // slot states: set_id() slots are never released; a free slot's
+    // leftover garbage is being cleaned while it is draining
+    static constexpr int slot_free = 0, slot_set = 1, slot_registered = 2,
+        slot_draining = 3;
+    static int slot_state_[MAX_THREADS];
 public:
     static __thread Transaction* txn;
 
@@ -19,9 +36,33 @@ public:
         return the_id;
     }
     static void set_id(int id) {
-        assert(id >= 0 && id < 32);
+        assert(id >= 0 && id < MAX_THREADS);
         the_id = id;
-    }
+        if (unlikely(slot_state_[id] != slot_set) && id != registered_id_)
+            claim_slot(id);
+        if (unlikely(id >= id_limit_))
+            raise_id_limit(id);
+    }
+    static int id_limit() {
+        return id_limit_;
+    }
+
+    // Thread registry. register_thread() claims the lowest unused thread
+    // slot and makes it this thread's id; unregister_thread() quiesces the
+    // slot and makes it available for reuse. Aborts if all MAX_THREADS slots
+    // are taken. Slot 0 belongs to the main thread, and set_id() marks its
+    // slot used, so registered threads never share an id with threads that
+    // pick their own; those keep their slots until the process exits.
+    // set_id() on another thread's registered slot aborts. RCU garbage a
+    // thread leaves behind is freed by the epoch advancer while its slot
+    // is free.
+    static int register_thread();
+    static void unregister_thread();
+    static void clean_free_slots(uint64_t max_epoch);
+
+private:
+    static void claim_slot(int id);
+    static void raise_id_limit(int id);
 };
 
 class TransactionTid {
@@ -29,14 +70,16 @@ public:
     typedef uint64_t type;
     typedef int64_t signed_type;
 
-    static constexpr type threadid_mask = type(0x1F);
-    static constexpr type lock_bit = type(0x20);
+    // The low bits of a locked version hold the owning thread's id, so
+    // threadid_mask must cover every id up to MAX_THREADS - 1.
+    static constexpr type threadid_mask = type(0xFF);
+    static constexpr type lock_bit = type(0x100);
     // Used for data structures that don't use opacity. When they increment
     // a version they set the nonopaque_bit, forcing any opacity check to be
     // hard (checking the full read set).
-    static constexpr type nonopaque_bit = type(0x40);
-    static constexpr type user_bit = type(0x80);
-    static constexpr type increment_value = type(0x400);
+    static constexpr type nonopaque_bit = type(0x200);
+    static constexpr type user_bit = type(0x400);
+    static constexpr type increment_value = type(0x2000);
 
     // TODO: probably remove these once RBTree stops referencing them.
     static void lock_read(type& v) {
@@ -197,6 +240,39 @@ public:
         // cur_vers allowed to be locked by us
         return cur_vers == old_vers || cur_vers == (old_vers | lock_bit | here);
     }
+    // Returns the first i < n with !check_version(cur[i], old[i], here),
+    // or n if every pair checks.
+    static unsigned check_versions(const type* cur, const type* old, unsigned n, int here) {
+        unsigned i = 0;
+#if __AVX2__
+        __m256i lockv = _mm256_set1_epi64x(lock_bit | here);
+        for (; i + 4 <= n; i += 4) {
+            __m256i c = _mm256_loadu_si256((const __m256i*) (cur + i));
+            __m256i o = _mm256_loadu_si256((const __m256i*) (old + i));
+            __m256i ok = _mm256_or_si256(_mm256_cmpeq_epi64(c, o),
+                                         _mm256_cmpeq_epi64(c, _mm256_or_si256(o, lockv)));
+            if (_mm256_movemask_epi8(ok) != -1)
+                break;
+        }
+#elif __SSE2__
+        // SSE2 has no 64-bit compare: AND each 32-bit half with its partner
+        __m128i lockv = _mm_set1_epi64x(lock_bit | here);
+        for (; i + 2 <= n; i += 2) {
+            __m128i c = _mm_loadu_si128((const __m128i*) (cur + i));
+            __m128i o = _mm_loadu_si128((const __m128i*) (old + i));
+            __m128i eq = _mm_cmpeq_epi32(c, o);
+            __m128i eql = _mm_cmpeq_epi32(c, _mm_or_si128(o, lockv));
+            eq = _mm_and_si128(eq, _mm_shuffle_epi32(eq, 0xB1));
+            eql = _mm_and_si128(eql, _mm_shuffle_epi32(eql, 0xB1));
+            if (_mm_movemask_epi8(_mm_or_si128(eq, eql)) != 0xFFFF)
+                break;
+        }
+#endif
+        for (; i != n; ++i)
+            if (!check_version(cur[i], old[i], here))
+                return i;
+        return n;
+    }
     static bool try_check_opacity(type start_tid, type v) {
         signed_type delta = start_tid - v;
         return delta > 0 && !(v & (lock_bit | nonopaque_bit));
@@ -216,6 +292,9 @@ public:
     }
 };
 
+static_assert(MAX_THREADS <= TransactionTid::threadid_mask + 1,
+              "MAX_THREADS does not fit in TransactionTid::threadid_mask");
+
 class TVersion {
 public:
     typedef TransactionTid::type type;
@@ -577,6 +656,17 @@ public:
         (void) item, (void) committed;
     }
     virtual void print(std::ostream& w, const TransItem& item) const;
+
+    // Batch commit hooks. try_commit calls these on the owner of `first`
+    // for a contiguous span [first, last) of items whose owners all have
+    // this object's dynamic type. lock_all and install_all act on the
+    // items with writes, check_all on the items with reads. lock_all and
+    // check_all return the first item that failed, or `last`; items
+    // before a failed lock stay locked. The defaults call the per-item
+    // hooks; see TBatchObject.
+    virtual TransItem* lock_all(TransItem* first, TransItem* last, Transaction& txn);
+    virtual TransItem* check_all(TransItem* first, TransItem* last, Transaction& txn);
+    virtual void install_all(TransItem* first, TransItem* last, Transaction& txn);
 };
 
 typedef TObject Shared;
@@ -0,0 +1,338 @@
+#pragma once
+#include "Transaction.hh"
+#include <vector>
+#if __cplusplus >= 202002L && __cpp_impl_coroutine >= 201902L
+#define STO_COROUTINES 1
+#include <coroutine>
+#include <exception>
+#include <functional>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#endif
+
+// Interleaved transaction execution. One thread keeps up to `depth`
+// transactions in flight and switches between them at yield points, so
+// one transaction's cache misses overlap with the others' work. Each
+// slot has its own Transaction, and TThread::txn points at it while the
+// slot runs.
+//
+// A task is a resumable transaction body:
+//     void reset();   // called before each attempt
+//     bool step();    // run to the next yield point; true when done
+// A step usually ends by prefetching what the next step will dereference
+// (see Hashtable::prefetch) and returning false. Aborted attempts are
+// retried from reset(), without backoff.
+//
+// Tasks can be hand-written state machines, using the prefetch steps of
+// Hashtable (prefetch(k), then prefetch_chain(k)) and FlatHashtable
+// (prefetch(k)). When built as C++20 (`make CXX20=1`), STO_COROUTINES is
+// set and a task can instead be a coroutine: see CoroutineTask below.
+// Coroutine lookups exist for Hashtable (co_transGet) and RBTree
+// (co_count). MassTrans lookups have no steps and run to completion.
+//
+// The thread's RCU epoch is held at the oldest in-flight slot's start
+// epoch, so memory that one slot may still see is not freed when
+// another commits.
+template <typename Task>
+class InterleavedExecutor {
+public:
+    explicit InterleavedExecutor(unsigned depth)
+        : slots_(depth) {
+        for (auto& s : slots_)
+            s.txn = new Transaction(false);
+    }
+    ~InterleavedExecutor() {
+        for (auto& s : slots_)
+            delete s.txn;
+    }
+
+    unsigned depth() const {
+        return slots_.size();
+    }
+
+    // Run every task in [first, last) to commit. Returns the number of
+    // aborted attempts.
+    template <typename It>
+    uint64_t run(It first, It last);
+
+private:
+    typedef Transaction::epoch_type epoch_type;
+    typedef Transaction::signed_epoch_type signed_epoch_type;
+    struct slot {
+        Transaction* txn;
+        Task* task;
+        epoch_type epoch;
+        slot()
+            : txn(), task(), epoch() {
+        }
+    };
+    std::vector<slot> slots_;
+
+    void begin(slot& s, threadinfo_t& thr);
+    void publish_epoch(threadinfo_t& thr);
+};
+
+template <typename Task> template <typename It>
+uint64_t InterleavedExecutor<Task>::run(It first, It last) {
+    Transaction* base = TThread::txn;
+    threadinfo_t& thr = Transaction::tinfo[TThread::id()];
+    ++thr.epoch_pins;
+    uint64_t naborts = 0;
+    unsigned nactive = 0;
+    try {
+        do {
+            for (auto& s : slots_) {
+                if (!s.task) {
+                    if (first == last)
+                        continue;
+                    s.task = &*first;
+                    ++first;
+                    ++nactive;
+                    begin(s, thr);
+                }
+                TThread::txn = s.txn;
+                try {
+                    if (!s.task->step())
+                        continue;
+                    if (s.txn->try_commit()) {
+                        s.task = nullptr;
+                        --nactive;
+                        publish_epoch(thr);
+                        continue;
+                    }
+                } catch (Transaction::Abort&) {
+                }
+                ++naborts;
+                begin(s, thr);
+            }
+        } while (nactive || first != last);
+    } catch (...) {
+        for (auto& s : slots_) {
+            s.txn->silent_abort();
+            s.task = nullptr;
+        }
+        --thr.epoch_pins;
+        TThread::txn = base;
+        throw;
+    }
+    --thr.epoch_pins;
+    TThread::txn = base;
+    return naborts;
+}
+
+template <typename Task>
+void InterleavedExecutor<Task>::begin(slot& s, threadinfo_t& thr) {
+    TThread::txn = s.txn;
+    s.epoch = Transaction::global_epochs.global_epoch;
+    publish_epoch(thr);
+    s.txn->start();
+    s.task->reset();
+}
+
+template <typename Task>
+void InterleavedExecutor<Task>::publish_epoch(threadinfo_t& thr) {
+    epoch_type e = 0;
+    for (auto& s : slots_)
+        if (s.task && (!e || signed_epoch_type(s.epoch - e) < 0))
+            e = s.epoch;
+    if (e)
+        thr.epoch = e;
+}
+
+#if STO_COROUTINES
+// Coroutine<T> is a lazily started coroutine returning T. Awaiting one
+// runs it as a nested call. Any coroutine in the chain may
+// `co_await interleave_yield(p)`, which prefetches p and suspends the
+// whole chain; resume() continues it from the innermost frame.
+template <typename T> class Coroutine;
+
+namespace stopriv {
+struct coroutine_promise_base {
+    coroutine_promise_base* root_ = this;
+    std::coroutine_handle<> leaf_;      // innermost frame (root only)
+    std::coroutine_handle<> parent_;
+    std::exception_ptr exception_;
+
+    struct final_awaiter {
+        bool await_ready() const noexcept {
+            return false;
+        }
+        template <typename P>
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+            coroutine_promise_base& p = h.promise();
+            if (!p.parent_)
+                return std::noop_coroutine();
+            p.root_->leaf_ = p.parent_;
+            return p.parent_;
+        }
+        void await_resume() const noexcept {
+        }
+    };
+
+    std::suspend_always initial_suspend() const noexcept {
+        return {};
+    }
+    final_awaiter final_suspend() const noexcept {
+        return {};
+    }
+    void unhandled_exception() {
+        exception_ = std::current_exception();
+    }
+
+    // Every nested lookup allocates a frame, so frames are recycled
+    // through per-thread free lists, one per frame_unit size class.
+    static constexpr size_t frame_unit = 64;
+    static constexpr size_t frame_nclasses = 16;
+    static inline thread_local void* frame_free_[frame_nclasses];
+
+    static void* operator new(size_t sz) {
+        size_t c = (sz - 1) / frame_unit;
+        if (c >= frame_nclasses)
+            return ::operator new(sz);
+        if (void* p = frame_free_[c]) {
+            frame_free_[c] = *static_cast<void**>(p);
+            return p;
+        }
+        return ::operator new((c + 1) * frame_unit);
+    }
+    static void operator delete(void* p, size_t sz) {
+        size_t c = (sz - 1) / frame_unit;
+        if (c >= frame_nclasses)
+            return ::operator delete(p);
+        *static_cast<void**>(p) = frame_free_[c];
+        frame_free_[c] = p;
+    }
+};
+
+template <typename T>
+struct coroutine_promise : public coroutine_promise_base {
+    std::optional<T> value_;
+    Coroutine<T> get_return_object();
+    template <typename U>
+    void return_value(U&& x) {
+        value_.emplace(std::forward<U>(x));
+    }
+};
+
+template <>
+struct coroutine_promise<void> : public coroutine_promise_base {
+    Coroutine<void> get_return_object();
+    void return_void() {
+    }
+};
+}
+
+template <typename T>
+class Coroutine {
+public:
+    typedef stopriv::coroutine_promise<T> promise_type;
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    Coroutine()
+        : h_() {
+    }
+    explicit Coroutine(handle_type h)
+        : h_(h) {
+        h.promise().leaf_ = h;
+    }
+    Coroutine(Coroutine<T>&& x) noexcept
+        : h_(std::exchange(x.h_, nullptr)) {
+    }
+    Coroutine<T>& operator=(Coroutine<T>&& x) noexcept {
+        if (this != &x) {
+            if (h_)
+                h_.destroy();
+            h_ = std::exchange(x.h_, nullptr);
+        }
+        return *this;
+    }
+    ~Coroutine() {
+        if (h_)
+            h_.destroy();
+    }
+
+    // Run a top-level coroutine to its next yield; true once it has
+    // returned. Exceptions, including Transaction::Abort, propagate.
+    bool resume() {
+        promise_type& p = h_.promise();
+        p.leaf_.resume();
+        if (p.exception_)
+            std::rethrow_exception(std::exchange(p.exception_, nullptr));
+        return h_.done();
+    }
+
+    bool await_ready() const noexcept {
+        return false;
+    }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> parent) noexcept {
+        promise_type& p = h_.promise();
+        p.root_ = parent.promise().root_;
+        p.parent_ = parent;
+        p.root_->leaf_ = h_;
+        return h_;
+    }
+    T await_resume() {
+        promise_type& p = h_.promise();
+        if (p.exception_)
+            std::rethrow_exception(p.exception_);
+        if constexpr (!std::is_void_v<T>)
+            return std::move(*p.value_);
+    }
+
+private:
+    handle_type h_;
+};
+
+template <typename T>
+inline Coroutine<T> stopriv::coroutine_promise<T>::get_return_object() {
+    return Coroutine<T>(Coroutine<T>::handle_type::from_promise(*this));
+}
+
+inline Coroutine<void> stopriv::coroutine_promise<void>::get_return_object() {
+    return Coroutine<void>(Coroutine<void>::handle_type::from_promise(*this));
+}
+
+// co_await interleave_yield(p): prefetch p and let the executor run the
+// other slots. A no-op prefetch if p is null.
+struct interleave_yield {
+    const void* p;
+    explicit interleave_yield(const void* x)
+        : p(x) {
+    }
+    bool await_ready() const noexcept {
+        if (p)
+            ::prefetch(p);
+        return false;
+    }
+    void await_suspend(std::coroutine_handle<>) const noexcept {
+    }
+    void await_resume() const noexcept {
+    }
+};
+
+// A task whose body is a coroutine. Each attempt calls body() for a
+// fresh coroutine, discarding the previous attempt's frame. The body's
+// captures live in the task, so don't move tasks while they run.
+class CoroutineTask {
+public:
+    typedef std::function<Coroutine<void>()> body_type;
+
+    CoroutineTask() = default;
+    explicit CoroutineTask(body_type body)
+        : body_(std::move(body)) {
+    }
+
+    void reset() {
+        co_ = body_();
+    }
+    bool step() {
+        return co_.resume();
+    }
+
+private:
+    body_type body_;
+    Coroutine<void> co_;
+};
+#endif
@@ -236,6 +236,10 @@ public:
   }
 
   bool transInsert(const T& elem) {
+    // an aborted non-throwing transaction must not link new nodes: its
+    // cleanup has already run
+    if (unlikely(Sto::aborted()))
+      return false;
     bool inserted;
     auto *node = _insert<true>(elem, &inserted);
     auto item = t_item(node);
@@ -148,6 +148,9 @@ public:
     }
     
     bool transInsert(const T& elem) {
+        // see List::transInsert
+        if (unlikely(Sto::aborted()))
+            return false;
         bool inserted;
         auto *node = _insert<true>(elem, &inserted);
         auto item = t_item(node);
@@ -68,6 +68,8 @@ public:
 
     // transactional non-snapshot read
     operator V() {
+        if (!oid.value())  // aborted non-throwing transaction
+            return V();
         auto item = Sto::item(&list, oid.value());
         if (item.has_write()) {
             return item.template write_value<V>();
@@ -78,12 +80,14 @@ public:
 
     // transactional assignment
     ListProxy& operator=(const V& other) {
-        Sto::item(&list, oid.value()).add_write(other);
+        if (oid.value())
+            Sto::item(&list, oid.value()).add_write(other);
         return *this;
     }
 
     ListProxy& operator=(const ListProxy& other) {
-        Sto::item(&list, oid.value()).add_write((V)other);
+        if (oid.value())
+            Sto::item(&list, oid.value()).add_write((V)other);
         return *this;
     }
 private:
@@ -167,6 +171,9 @@ public:
 
     // "STAMP"-ish insert
     bool trans_insert(const K& key, const V& value) {
+        // see List::transInsert
+        if (unlikely(Sto::aborted()))
+            return false;
         lock(listlock_);
         auto results = _insert(key, V());
         unlock(listlock_);
@@ -328,7 +335,11 @@ public:
 
 private:
     // returns the node the key points to, or abort if observes uncommitted state
+    // (a null oid in an aborted non-throwing transaction)
     oid_type insert_position(const K& key) {
+        // see List::transInsert
+        if (unlikely(Sto::aborted()))
+            return oid_type(uintptr_t(0));
         lock(listlock_);
         auto results = _insert(key, V());
         unlock(listlock_);
@@ -0,0 +1,100 @@
+#pragma once
+#include "compiler.hh"
+#include <stdint.h>
+#include <string.h>
+#include <algorithm>
+
+// Fixed-size log-linear histogram (HDR-style). Values below 2^sub_bits
+// are counted exactly; above that, each power of two is split into
+// 2^sub_bits equal buckets, so a reported value is within
+// 1/2^sub_bits of the true one. Values of 2^max_exponent or more share
+// the last bucket. add() never allocates.
+class log_histogram {
+public:
+    static constexpr unsigned sub_bits = 3;
+    static constexpr unsigned sub_count = 1U << sub_bits;
+    static constexpr unsigned max_exponent = 40;
+    static constexpr unsigned nbuckets = (max_exponent - sub_bits + 1) * sub_count;
+
+    log_histogram() {
+        clear();
+    }
+
+    void add(uint64_t v) {
+        ++b_[bucket(v)];
+        ++n_;
+        sum_ += v;
+        max_ = std::max(max_, v);
+    }
+    void merge(const log_histogram& x) {
+        for (unsigned i = 0; i != nbuckets; ++i)
+            b_[i] += x.b_[i];
+        n_ += x.n_;
+        sum_ += x.sum_;
+        max_ = std::max(max_, x.max_);
+    }
+    // Remove the values of `x`, an earlier state of this histogram. The
+    // maximum becomes the upper bound of the highest remaining bucket.
+    void subtract(const log_histogram& x) {
+        unsigned top = 0;
+        for (unsigned i = 0; i != nbuckets; ++i) {
+            b_[i] -= x.b_[i];
+            if (b_[i])
+                top = i + 1;
+        }
+        n_ -= x.n_;
+        sum_ -= x.sum_;
+        if (!top)
+            max_ = 0;
+        else if (top != nbuckets)
+            max_ = std::min(max_, bucket_low(top) - 1);
+    }
+    void clear() {
+        memset(b_, 0, sizeof(b_));
+        n_ = sum_ = max_ = 0;
+    }
+
+    uint64_t count() const {
+        return n_;
+    }
+    uint64_t max() const {
+        return max_;
+    }
+    double mean() const {
+        return n_ ? (double) sum_ / n_ : 0;
+    }
+    // Smallest bucket upper bound with at least fraction q of the values
+    // at or below it; 0 if empty.
+    uint64_t percentile(double q) const {
+        uint64_t target = std::max(uint64_t(q * n_ + 0.5), uint64_t(1));
+        uint64_t seen = 0;
+        for (unsigned i = 0; i != nbuckets; ++i) {
+            seen += b_[i];
+            if (seen >= target)
+                return i == nbuckets - 1 ? max_ : std::min(bucket_low(i + 1) - 1, max_);
+        }
+        return max_;
+    }
+
+    static unsigned bucket(uint64_t v) {
+        if (v < sub_count)
+            return v;
+        unsigned e = 63 - __builtin_clzll(v);
+        if (e >= max_exponent)
+            return nbuckets - 1;
+        unsigned shift = e - sub_bits;
+        return ((shift + 1) << sub_bits) + ((v >> shift) & (sub_count - 1));
+    }
+    static uint64_t bucket_low(unsigned b) {
+        if (b < 2 * sub_count)
+            return b;
+        unsigned shift = (b >> sub_bits) - 1;
+        return uint64_t(sub_count + (b & (sub_count - 1))) << shift;
+    }
+
+private:
+    uint64_t b_[nbuckets];
+    uint64_t n_;
+    uint64_t sum_;
+    uint64_t max_;
+};
@@ -9,6 +9,8 @@
 #include "masstree_scan.hh"
 #include "string.hh"
 #include "Transaction.hh"
+#include <thread>
+#include <iterator>
 
 #include "StringWrapper.hh"
 #include "versioned_value.hh"
@@ -67,6 +69,13 @@ struct versioned_str_struct : public versioned_str {
   }
 };
 
+// shared by every MassTrans instantiation, so the epoch hook is
+// registered only once
+inline void masstrans_advance_globalepoch(void*, Transaction::epoch_type) {
+  // just advance blindly because of the way Masstree uses epochs
+  globalepoch++;
+}
+
 template <typename V, typename Box = versioned_value_struct<V>, bool Opacity = true>
 class MassTrans : public Shared {
 public:
@@ -110,10 +119,7 @@ public:
   }
 
   static void static_init() {
-    Transaction::epoch_advance_callback = [] (unsigned) {
-      // just advance blindly because of the way Masstree uses epochs
-      globalepoch++;
-    };
+    Transaction::add_epoch_hook(masstrans_advance_globalepoch, nullptr);
   }
 
   static void thread_init() {
@@ -126,52 +132,90 @@ public:
       auto* ti = threadinfo::make(threadinfo::TI_PROCESS, TThread::id());
       mythreadinfo.ti = ti;
     }
-    Transaction::tinfo[TThread::id()].trans_start_callback = [] () {
-      mythreadinfo.ti->rcu_start();
-    };
-    Transaction::tinfo[TThread::id()].trans_end_callback = [] () {
-      mythreadinfo.ti->rcu_stop();
-    };
+    always_assert(Transaction::add_start_hook(rcu_start_hook, mythreadinfo.ti));
+    always_assert(Transaction::add_end_hook(rcu_stop_hook, mythreadinfo.ti));
 #endif
   }
 
+  static void rcu_start_hook(void* ti) {
+    static_cast<threadinfo*>(ti)->rcu_start();
+  }
+  static void rcu_stop_hook(void* ti) {
+    static_cast<threadinfo*>(ti)->rcu_stop();
+  }
+
   template <typename ValType>
   bool transGet(Str key, ValType& retval, threadinfo_type& ti = mythreadinfo) {
     unlocked_cursor_type lp(table_, key);
-    bool found = lp.find_unlocked(*ti.ti);
-    if (found) {
-      versioned_value *e = lp.value();
-      //      __builtin_prefetch(&e->version);
-      auto item = t_read_only_item(e);
-      if (!validityCheck(item, e)) {
-        Sto::abort();
-        return false;
+    if (lp.find_unlocked(*ti.ti))
+      return trans_get_found(lp.value(), retval);
+    ensureNotFound(lp.node(), lp.full_version_value());
+    return false;
+  }
+
+  // transGet for n keys, in two passes per group of keys: the first
+  // descends the tree for each key and prefetches the values found, the
+  // second reads them and adds them to the read set, so the value cache
+  // misses overlap. The descents themselves are not staged: each runs to
+  // its leaf before the next starts, since Masstree's cursor can't be
+  // stopped between levels; only Masstree's own prefetch of each node
+  // overlaps with it. Same semantics as n transGet calls. found[i] says
+  // whether keys[i] was found; returns the number found. Arrays are
+  // passed as pointer and count (see Hashtable::transMultiGet).
+  template <typename ValType>
+  unsigned transMultiGet(const Str* keys, unsigned n, ValType* values, bool* found, threadinfo_type& ti = mythreadinfo) {
+    versioned_value* e[multiget_group];
+    unsigned nfound = 0;
+    for (unsigned i = 0; i < n; i += multiget_group) {
+      unsigned end = std::min(i + multiget_group, n);
+      for (unsigned j = i; j != end; ++j) {
+        unlocked_cursor_type lp(table_, keys[j]);
+        if (lp.find_unlocked(*ti.ti)) {
+          e[j - i] = lp.value();
+          ::prefetch(e[j - i]);
+        } else {
+          e[j - i] = NULL;
+          ensureNotFound(lp.node(), lp.full_version_value());
+        }
       }
-      //      __builtin_prefetch();
-      //__builtin_prefetch(e->value.data() - sizeof(std::string::size_type)*3);
+      for (unsigned j = i; j != end; ++j)
+        nfound += found[j] = e[j - i] && trans_get_found(e[j - i], values[j]);
+    }
+    return nfound;
+  }
+
+private:
+  template <typename ValType>
+  bool trans_get_found(versioned_value* e, ValType& retval) {
+    //      __builtin_prefetch(&e->version);
+    auto item = t_read_only_item(e);
+    if (!validityCheck(item, e)) {
+      Sto::abort();
+      return false;
+    }
+    //      __builtin_prefetch();
+    //__builtin_prefetch(e->value.data() - sizeof(std::string::size_type)*3);
 #if READ_MY_WRITES
-      if (has_delete(item)) {
-        return false;
-      }
-      if (item.has_write()) {
-        // read directly from the element if we're inserting it
-        if (has_insert(item)) {
+    if (has_delete(item)) {
+      return false;
+    }
+    if (item.has_write()) {
+      // read directly from the element if we're inserting it
+      if (has_insert(item)) {
 	  assign_val(retval, e->read_value());
-        } else {
+      } else {
 	    retval = item.template write_value<write_value_type>();
-        }
-        return true;
       }
-#endif
-      Version elem_vers;
-      atomicRead(e, elem_vers, retval);
-      item.observe(tversion_type(elem_vers));
-    } else {
-      ensureNotFound(lp.node(), lp.full_version_value());
+      return true;
     }
-    return found;
+#endif
+    Version elem_vers;
+    atomicRead(e, elem_vers, retval);
+    item.observe(tversion_type(elem_vers));
+    return true;
   }
 
+public:
   template <typename K>
   bool transDelete(const K& key, threadinfo_type& ti = mythreadinfo) {
     unlocked_cursor_type lp(table_, key);
@@ -219,6 +263,10 @@ public:
 private:
   template <bool INSERT, bool SET, typename StringType, typename ValueType>
   bool trans_write(const StringType& key, const ValueType& value, threadinfo_type& ti = mythreadinfo) {
+    // an aborted non-throwing transaction must not insert placeholders or
+    // invalidate values (nothing would clean them up)
+    if (unlikely(Sto::aborted()))
+      return false;
     // optimization to do an unlocked lookup first
     if (SET) {
       unlocked_cursor_type lp(table_, key);
@@ -466,6 +514,54 @@ public:
     return ret;
   }
 
+  // Non-transactional load of (key, value) pairs sorted by key. The range
+  // is split into nthreads contiguous key ranges loaded in parallel, each
+  // in key order, so a thread fills a leaf before moving to the next and
+  // threads rarely share one. Existing keys are overwritten. Must not run
+  // concurrently with any other use of the tree. Worker threads take
+  // thread ids with TThread::register_thread().
+  template <typename It>
+  void bulk_load(It first, It last, unsigned nthreads = 1) {
+    size_t n = std::distance(first, last);
+    nthreads = std::max(std::min<size_t>(nthreads, n / 1024), size_t(1));
+    if (nthreads == 1) {
+      bulk_load_range(first, last, mythreadinfo);
+      return;
+    }
+    std::vector<std::thread> workers;
+    for (unsigned i = 0; i != nthreads; ++i) {
+      It chunk_last = std::next(first, n / nthreads + (i < n % nthreads));
+      workers.emplace_back([this, first, chunk_last] {
+        TThread::register_thread();
+        thread_init();
+        bulk_load_range(first, chunk_last, mythreadinfo);
+        Transaction::remove_start_hook(rcu_start_hook, mythreadinfo.ti);
+        Transaction::remove_end_hook(rcu_stop_hook, mythreadinfo.ti);
+        TThread::unregister_thread();
+      });
+      first = chunk_last;
+    }
+    for (auto& w : workers)
+      w.join();
+  }
+
+private:
+  template <typename It>
+  void bulk_load_range(It first, It last, threadinfo_type& ti) {
+    for (; first != last; ++first) {
+      cursor_type lp(table_, first->first);
+      bool found = lp.find_insert(*ti.ti);
+      versioned_value* old = found ? lp.value() : NULL;
+      Version v = old ? old->version() + TransactionTid::increment_value : Sto::initialized_tid();
+      lp.value() = versioned_value::make(first->second, v);
+      lp.finish(1, *ti.ti);
+      if (old)
+        old->deallocate_rcu(*ti.ti);
+    }
+  }
+
+public:
+
   // implementation of Shared object methods
 
   void lock(versioned_value *e) {
@@ -698,6 +794,9 @@ protected:
 
   static constexpr uintptr_t internode_bit = 1<<0;
 
+  // keys looked up together by transMultiGet
+  static constexpr unsigned multiget_group = 16;
+
   static constexpr TransItem::flags_type insert_bit = TransItem::user0_bit;
   static constexpr TransItem::flags_type delete_bit = TransItem::user0_bit<<1;
 
@@ -752,9 +851,12 @@ protected:
     Version v2;
     do {
       v2 = e->version();
-      if (is_locked(v2))
+      if (is_locked(v2)) {
         Sto::abort();
-	
+        vers = v2;
+        return;
+      }
+
       fence();
       assign_val(val, e->read_value());
       fence();
@@ -1,13 +1,44 @@
 #include "Packer.hh"
+#include <string.h>
+#include <stdlib.h>
+#include <sys/mman.h>
 
-constexpr size_t TransactionBuffer::default_capacity;
+constexpr size_t TransactionBuffer::huge_page_size;
+constexpr size_t TransactionBuffer::initial_index_capacity;
+size_t TransactionBuffer::initial_capacity = 4080;
+bool TransactionBuffer::huge_pages = false;
+
+TransactionBuffer::elt* TransactionBuffer::allocate_chunk(size_t size) {
+    size_t bytes = sizeof(elthdr) + size;
+    void* p = nullptr;
+    if (huge_pages && bytes >= huge_page_size) {
+        bytes = (bytes + huge_page_size - 1) & ~(huge_page_size - 1);
+        if (posix_memalign(&p, huge_page_size, bytes) == 0) {
+#ifdef MADV_HUGEPAGE
+            madvise(p, bytes, MADV_HUGEPAGE);
+#endif
+            size = bytes - sizeof(elthdr);
+        } else
+            p = nullptr;
+    }
+    if (!p)
+        p = malloc(bytes);
+    always_assert(p);
+    elt* e = (elt*) p;
+    e->size = size;
+    return e;
+}
+
+void TransactionBuffer::free_chunk(elt* e) {
+    free(e);
+}
 
 void TransactionBuffer::hard_get_space(size_t needed) {
-    size_t s = std::max(needed, e_ ? e_->size * 2 : default_capacity);
-    elt* ne = (elt*) new char[sizeof(elthdr) + s];
+    size_t s = std::max(needed, e_ ? e_->size * 2 : initial_capacity);
+    elt* ne = allocate_chunk(s);
     ne->next = e_;
     ne->pos = 0;
-    ne->size = s;
+    ne->destroy = false;
     if (e_)
         size_ += e_->pos;
     e_ = ne;
@@ -18,13 +49,92 @@ void TransactionBuffer::hard_clear(bool delete_all) {
         elt* e = e_->next;
         e_->next = e->next;
         e->clear();
-        delete[] (char*) e;
+        free_chunk(e);
     }
     if (e_)
         e_->clear();
     size_ = 0;
     if (e_ && delete_all) {
-        delete[] (char*) e_;
+        free_chunk(e_);
         e_ = 0;
     }
 }
+
+void TransactionBuffer::rollback(const mark_type& m) {
+    if (!m.e) {
+        if (e_)
+            hard_clear(false);
+    } else {
+        while (e_ != m.e) {
+            elt* e = e_;
+            e_ = e->next;
+            e->clear();
+            free_chunk(e);
+        }
+        if (e_->destroy)
+            for (size_t off = m.pos; off < e_->pos; ) {
+                itemhdr* i = (itemhdr*) &e_->buf[off];
+                i->destroyer(i + 1);
+                off += i->size;
+            }
+        e_->pos = m.pos;
+        size_ = m.size;
+    }
+    if (nindexed_)
+        prune_index();
+}
+
+bool TransactionBuffer::contains(const void* object) const {
+    const char* p = reinterpret_cast<const char*>(object);
+    for (elt* e = e_; e; e = e->next)
+        if (p >= e->buf && p < e->buf + e->pos)
+            return true;
+    return false;
+}
+
+void TransactionBuffer::grow_index() {
+    size_t old_capacity = index_ ? index_mask_ + 1 : 0;
+    size_t capacity = old_capacity ? old_capacity * 2 : initial_index_capacity;
+    index_entry* old_index = index_;
+    index_ = new index_entry[capacity];
+    memset(index_, 0, sizeof(index_entry) * capacity);
+    index_mask_ = capacity - 1;
+    for (size_t j = 0; j != old_capacity; ++j)
+        if (old_index[j].object) {
+            size_t i = old_index[j].hash & index_mask_;
+            while (index_[i].object)
+                i = (i + 1) & index_mask_;
+            index_[i] = old_index[j];
+        }
+    delete[] old_index;
+}
+
+void TransactionBuffer::clear_index() {
+    // after a big transaction, start the next one with a small index
+    // rather than clearing the big one every time
+    if (index_mask_ + 1 > initial_index_capacity && nindexed_ * 8 < index_mask_ + 1) {
+        delete[] index_;
+        index_ = nullptr;
+        index_mask_ = 0;
+    } else
+        memset(index_, 0, sizeof(index_entry) * (index_mask_ + 1));
+    nindexed_ = 0;
+}
+
+// Rebuild the index without the objects a rollback destroyed.
+void TransactionBuffer::prune_index() {
+    size_t capacity = index_mask_ + 1;
+    index_entry* old_index = index_;
+    index_ = new index_entry[capacity];
+    memset(index_, 0, sizeof(index_entry) * capacity);
+    nindexed_ = 0;
+    for (size_t j = 0; j != capacity; ++j)
+        if (old_index[j].object && contains(old_index[j].object)) {
+            size_t i = old_index[j].hash & index_mask_;
+            while (index_[i].object)
+                i = (i + 1) & index_mask_;
+            index_[i] = old_index[j];
+            ++nindexed_;
+        }
+    delete[] old_index;
+}
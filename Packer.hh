@@ -1,6 +1,8 @@
 #pragma once
 #include "compiler.hh"
 #include <algorithm>
+#include <functional>
+#include <type_traits>
 
 class TransactionBuffer;
 
@@ -40,17 +42,22 @@ template <typename T> struct UniqueKey {
     }
 };
 
+template <typename T, typename = void> struct is_std_hashable : std::false_type {};
+template <typename T> struct is_std_hashable<T, decltype(void(std::hash<T>()(std::declval<const T&>())))>
+    : std::true_type {};
+
 class TransactionBuffer {
     struct elt;
     struct item;
 
 public:
     TransactionBuffer()
-        : e_() {
+        : e_(), index_(), index_mask_(0), nindexed_(0) {
     }
     ~TransactionBuffer() {
         if (e_)
             hard_clear(true);
+        delete[] index_;
     }
 
     static constexpr size_t aligned_size(size_t x) {
@@ -63,16 +70,49 @@ public:
     template <typename T, typename U = T>
     const T* find(const U& x) const;
 
+    // Return the UniqueKey<T> equal to x, allocating it if necessary.
+    // Hashable key types are found through a hash index in O(1);
+    // others fall back to find().
+    template <typename T>
+    UniqueKey<T>* intern(const T& x) {
+        return intern(x, is_std_hashable<T>());
+    }
+
     size_t size() const {
         return size_ + (e_ ? e_->pos : 0);
     }
     void clear() {
-        if (e_ && e_->pos)
-            hard_clear(false);
+        if (e_ && e_->pos) {
+            if (!e_->next && !e_->destroy)
+                e_->pos = 0;
+            else
+                hard_clear(false);
+        }
+        if (nindexed_)
+            clear_index();
+    }
+
+    // Chunks start at initial_capacity bytes and double as the buffer
+    // grows; clear() keeps only the newest (largest) chunk, which
+    // the next transaction reuses. With huge_pages set, chunks of at
+    // least 2MB are aligned and advised for transparent huge pages.
+    static size_t initial_capacity;
+    static bool huge_pages;
+
+    // A position in the buffer. rollback(m) destroys everything
+    // allocated since mark() returned m and forgets it in the index.
+    struct mark_type {
+        elt* e;
+        size_t pos;
+        size_t size;
+    };
+    mark_type mark() const {
+        return mark_type{e_, e_ ? e_->pos : 0, size_};
     }
+    void rollback(const mark_type& m);
 
 private:
-    static constexpr size_t default_capacity = 4080;
+    static constexpr size_t huge_page_size = 2 << 20;
     struct itemhdr {
         void (*destroyer)(void*);
         size_t size;
@@ -84,22 +124,35 @@ private:
         elt* next;
         size_t pos;
         size_t size;
+        bool destroy;           // holds an item with a nontrivial destructor
     };
     struct elt : public elthdr {
         char buf[0];
         void clear() {
-            size_t off = 0;
-            while (off < pos) {
-                itemhdr* i = (itemhdr*) &buf[off];
-                i->destroyer(i + 1);
-                off += i->size;
+            if (destroy) {
+                size_t off = 0, end = pos;
+                while (off < end) {
+                    itemhdr* i = (itemhdr*) &buf[off];
+                    i->destroyer(i + 1);
+                    off += i->size;
+                }
             }
             pos = 0;
+            destroy = false;
         }
     };
     elt* e_;
     size_t size_;
 
+    struct index_entry {
+        size_t hash;
+        void* object;           // nullptr if empty
+    };
+    static constexpr size_t initial_index_capacity = 16;
+    index_entry* index_;
+    size_t index_mask_;
+    size_t nindexed_;
+
     item* get_space(size_t needed) {
         if (!e_ || e_->pos + needed > e_->size)
             hard_get_space(needed);
@@ -108,14 +161,36 @@ private:
     }
     void hard_get_space(size_t needed);
     void hard_clear(bool delete_all);
+    static elt* allocate_chunk(size_t size);
+    static void free_chunk(elt* e);
+
+    template <typename T>
+    UniqueKey<T>* intern(const T& x, std::false_type) {
+        if (const UniqueKey<T>* p = find<UniqueKey<T> >(x))
+            return const_cast<UniqueKey<T>*>(p);
+        return allocate<UniqueKey<T> >(x);
+    }
+    template <typename T>
+    UniqueKey<T>* intern(const T& x, std::true_type);
+    static void (*destroyer_of(const void* object))(void*) {
+        return (reinterpret_cast<const itemhdr*>(object) - 1)->destroyer;
+    }
+    bool contains(const void* object) const;
+    void grow_index();
+    void clear_index();
+    void prune_index();
 };
 
 template <typename T, typename... Args>
 T* TransactionBuffer::allocate(Args&&... args) {
     size_t isize = aligned_size(sizeof(itemhdr) + sizeof(T));
     item* space = this->get_space(isize);
+    // the destroyer also identifies the type for find(), so it is set
+    // even when clear() will never call it
     space->destroyer = ObjectDestroyer<T>::destroy;
     space->size = isize;
+    if (!std::is_trivially_destructible<T>::value)
+        e_->destroy = true;
     return new (&space->buf[0]) T(std::forward<Args>(args)...);
 }
 
@@ -135,6 +210,26 @@ const T* TransactionBuffer::find(const U& x) const {
     return nullptr;
 }
 
+template <typename T>
+UniqueKey<T>* TransactionBuffer::intern(const T& x, std::true_type) {
+    void (*destroyer)(void*) = ObjectDestroyer<UniqueKey<T> >::destroy;
+    // mix in the type so equal hashes of different key types rarely collide
+    size_t h = std::hash<T>()(x) ^ (reinterpret_cast<uintptr_t>(destroyer) >> 4);
+    if ((nindexed_ + 1) * 2 > index_mask_ + 1)
+        grow_index();
+    size_t i = h & index_mask_;
+    for (; index_[i].object; i = (i + 1) & index_mask_)
+        if (index_[i].hash == h && destroyer_of(index_[i].object) == destroyer) {
+            UniqueKey<T>* k = reinterpret_cast<UniqueKey<T>*>(index_[i].object);
+            if (*k == x)
+                return k;
+        }
+    UniqueKey<T>* k = allocate<UniqueKey<T> >(x);
+    index_[i].hash = h;
+    index_[i].object = k;
+    ++nindexed_;
+    return k;
+}
 
 
 template <typename T> struct Packer<T, true> {
@@ -167,10 +262,7 @@ template <typename T> struct Packer<T, false> {
         return buf.template allocate<T>(std::forward<Args>(args)...);
     }
     static void* pack_unique(TransactionBuffer& buf, const T& x) {
-        if (const void* ptr = buf.template find<UniqueKey<T> >(x))
-            return const_cast<void*>(ptr);
-        else
-            return buf.template allocate<UniqueKey<T> >(x);
+        return buf.template intern<T>(x);
     }
     static void* repack(TransactionBuffer&, void* p, const T& x) {
         unpack(p) = x;
@@ -144,6 +144,10 @@ public:
     }
     
     void push(T v) {
+        // an aborted non-throwing transaction must not add values: its
+        // cleanup has already run
+        if (unlikely(Sto::aborted()))
+            return;
         lock(&poplock_); // TODO: locking this is not required, but performance seems to be better with this
                             // Can also try readers-writers lock
         if (dirtytid_ != -1 && dirtytid_ != TThread::id() && v > dirtyval_) {
@@ -2,6 +2,7 @@
 
 #include <cassert>
 #include <utility>
+#include <algorithm>
 #include "TaggedLow.hh"
 #include "Interface.hh"
 #include "TWrapped.hh"
@@ -9,6 +10,7 @@
 
 #ifndef STO_NO_STM
 #include "Transaction.hh"
+#include "Interleave.hh"
 #endif
 
 #define DEBUG 0
@@ -160,6 +162,11 @@ private:
     version_type hohvers_;
 };
 
+template <typename K, typename T>
+std::ostream& operator<<(std::ostream& s, const rbpair<K, T>& x) {
+    return s << x.key();
+}
+
 template <typename K, typename T, bool GlobalSize> class RBProxy;
 
 template <typename K, typename T, bool GlobalSize>
@@ -204,6 +211,11 @@ public:
     inline size_t size() const;
     // lookup
     inline size_t count(const K& key) const;
+#if STO_COROUTINES
+    // count() for interleaved execution: yields before each level of the
+    // descent, prefetching that level's node (see Interleave.hh)
+    Coroutine<size_t> co_count(K key) const;
+#endif
     // element access
     inline RBProxy<K, T, GlobalSize> operator[](const K& key);
     // modifiers
@@ -217,6 +229,12 @@ public:
     T nontrans_find(const K& key); // returns T() if not found, works for STAMP
     bool nontrans_find(const K& key, T& val);
 
+    // Non-transactional load of an empty tree from (key, value) pairs with
+    // distinct keys. Takes linear time if the pairs are sorted by key.
+    // Must not run concurrently with any other use of the tree.
+    template <typename It>
+    void bulk_load(It first, It last);
+
     bool stamp_insert(const K& key, const T& val);
     T stamp_find(const K& key);
 
@@ -290,6 +308,11 @@ public:
 #endif
     void print(std::ostream& w, const TransItem& item) const override;
 
+    // asserts the tree is well-formed; returns its black height
+    int debug_check() const {
+        return wrapper_tree_.check();
+    }
+
 private:
     size_t debug_size() const {
         return wrapper_tree_.size();
@@ -393,8 +416,15 @@ private:
     // NOTE: this function must be surrounded by a lock in order to ensure we add the correct nodeversions
     inline std::tuple<wrapper_type*, Version, bool, boundaries_type>
     find_or_abort(rbwrapper<rbpair<K, T>>& rbkvp) const {
-        auto results = verified_lookup(rbkvp);
+        return observe_lookup(verified_lookup(rbkvp));
+    }
+
+    // count()'s answer for a find_or_abort() result
+    inline size_t count_result(const std::tuple<wrapper_type*, Version, bool, boundaries_type>& results) const;
 
+    // Adds the reads for a verified_lookup() result; see find_or_abort()
+    inline std::tuple<wrapper_type*, Version, bool, boundaries_type>
+    observe_lookup(std::tuple<wrapper_type*, Version, bool, boundaries_type> results) const {
         // extract information from results
         wrapper_type* x = std::get<0>(results);
         Version val_ver = std::get<1>(results);
@@ -482,9 +512,10 @@ private:
 #if DEBUG
             stats_.absent_insert++;
 #endif
-            // use in-place constructor so that we don't mix up c++'s new and c's free()
+            // construct in place in pool memory; nodes are recycled without
+            // running their destructor
             // XXX(nate): we'd need to an rcu delete if T is a nontrivial type.
-            wrapper_type* n = (wrapper_type*)malloc(sizeof(wrapper_type));
+            wrapper_type* n = (wrapper_type*)Transaction::pool_allocate(sizeof(wrapper_type));
             new (n) wrapper_type(rbpair<K, T>(key, T()));
             // insert new node under parent
             bool side = (found_p.node() == nullptr)? false :
@@ -519,7 +550,11 @@ private:
     // Insert key and empty value if key does not exist 
     // If key exists, then add a read of the item version and return the node
     // return value is a reference to the found or inserted node 
+    // returns nullptr in an aborted non-throwing transaction
     inline wrapper_type* insert(const K& key) {
+        // its cleanup has already run, so nothing would unlink the node
+        if (unlikely(Sto::aborted()))
+            return nullptr;
         rbwrapper<rbpair<K, T>> node( rbpair<K, T>(key, T()) );
         auto results = this->find_or_insert(node);
         wrapper_type* x = std::get<0>(results);
@@ -759,6 +794,8 @@ public:
 
     // get the latest write value
     operator T() {
+        if (!node_)  // aborted non-throwing transaction
+            return T();
         auto item = Sto::item(&tree_, node_);
         if (item.has_write()) {
             return item.template write_value<T>();
@@ -768,13 +805,17 @@ public:
         }
     }
     RBProxy& operator=(const T& value) {
-        auto item = Sto::item(&tree_, node_);
-        item.add_write(value);
+        if (node_) {
+            auto item = Sto::item(&tree_, node_);
+            item.add_write(value);
+        }
         return *this;
     };
     RBProxy& operator=(RBProxy& other) {
-        auto item = Sto::item(&tree_, node_);
-        item.add_write((T)other);
+        if (node_) {
+            auto item = Sto::item(&tree_, node_);
+            item.add_write((T)other);
+        }
         return *this;
     };
 private:
@@ -799,8 +840,42 @@ inline size_t RBTree<K, T, GlobalSize>::count(const K& key) const {
     rbwrapper<rbpair<K, T>> idx_pair(rbpair<K, T>(key, T()));
 
     // find_or_abort() tracks boundary nodes if key is absent
-    auto results = find_or_abort(idx_pair);
+    return count_result(find_or_abort(idx_pair));
+}
 
+#if STO_COROUTINES
+template <typename K, typename T, bool GlobalSize>
+Coroutine<size_t> RBTree<K, T, GlobalSize>::co_count(K key) const {
+    rbwrapper<rbpair<K, T>> idx_pair(rbpair<K, T>(key, T()));
+    auto comp = rbpriv::make_compare<wrapper_type, wrapper_type>(wrapper_tree_.r_.get_compare());
+    typename internal_tree_type::find_cursor c;
+
+    // verified_lookup(), restarting as soon as the tree changes
+    while (1) {
+        auto initial = treelock_;
+        fence();
+        if (TransactionTid::is_locked(initial)) {
+            co_await interleave_yield(nullptr);
+            continue;
+        }
+        wrapper_tree_.find_start(c);
+        while (c.n.node()) {
+            co_await interleave_yield(c.n.node());
+            if (initial != treelock_
+                || !wrapper_tree_.find_step(c, idx_pair, comp))
+                break;
+        }
+        fence();
+        if (initial == treelock_)
+            break;
+        relax_fence();
+    }
+    co_return count_result(observe_lookup(wrapper_tree_.find_result(c)));
+}
+#endif
+
+template <typename K, typename T, bool GlobalSize>
+inline size_t RBTree<K, T, GlobalSize>::count_result(const std::tuple<wrapper_type*, Version, bool, boundaries_type>& results) const {
     wrapper_type* node = std::get<0>(results);
     bool found = std::get<2>(results);
 #if DEBUG
@@ -1006,7 +1081,7 @@ void RBTree<K, T, GlobalSize>::install(TransItem& item, Transaction& t) {
 
             e->version().set_version(t.commit_tid());
             e->install_nv(t);
-            Transaction::rcu_free(e);
+            Transaction::rcu_pool_free(e);
         } else {
             // inserts/updates should be handled the same way
             e->install(item, t);
@@ -1029,7 +1104,7 @@ void RBTree<K, T, GlobalSize>::cleanup(TransItem& item, bool committed) {
             unlock_write(&treelock_);
             // invalidate the nodeversion after we erase
             e->nodeversion().set_nonopaque();
-            Transaction::rcu_free(e);
+            Transaction::rcu_pool_free(e);
         }
     }
 }
@@ -1067,6 +1142,9 @@ void RBTree<K, T, GlobalSize>::print(std::ostream& w, const TransItem& item) con
 // logN (instead of 2logN) insertion for STAMP
 template <typename K, typename T, bool GlobalSize>
 bool RBTree<K, T, GlobalSize>::stamp_insert(const K& key, const T& value) {
+    // see insert()
+    if (unlikely(Sto::aborted()))
+        return false;
     rbwrapper<rbpair<K, T>> node( rbpair<K, T>(key, value) );
     auto results = this->find_or_insert(node);
     wrapper_type* x = std::get<0>(results);
@@ -1170,7 +1248,7 @@ bool RBTree<K, T, GlobalSize>::nontrans_insert(const K& key, const T& value) {
     if (!found) {
         size_++;
         rbnodeptr<wrapper_type> p = std::get<0>(results);
-        wrapper_type* n = (wrapper_type*)malloc(sizeof(wrapper_type));
+        wrapper_type* n = (wrapper_type*)Transaction::pool_allocate(sizeof(wrapper_type));
         new (n) wrapper_type(rbpair<K, T>(key, value));
         erase_inserted(n->version());
         bool side = (p.node() == nullptr) ? false : (wrapper_tree_.r_.node_compare(*n, *p.node()) > 0);
@@ -1180,6 +1258,30 @@ bool RBTree<K, T, GlobalSize>::nontrans_insert(const K& key, const T& value) {
     return !found;
 }
 
+template <typename K, typename T, bool GlobalSize> template <typename It>
+void RBTree<K, T, GlobalSize>::bulk_load(It first, It last) {
+    lock_write(&treelock_);
+    always_assert(!wrapper_tree_.r_.root_ && "bulk_load needs an empty tree");
+    std::vector<wrapper_type*> nodes;
+    for (; first != last; ++first) {
+        wrapper_type* n = (wrapper_type*)Transaction::pool_allocate(sizeof(wrapper_type));
+        new (n) wrapper_type(rbpair<K, T>(first->first, first->second));
+        erase_inserted(n->version());
+        nodes.push_back(n);
+    }
+    auto less = [this](wrapper_type* a, wrapper_type* b) {
+        return wrapper_tree_.r_.node_compare(*a, *b) < 0;
+    };
+    if (!std::is_sorted(nodes.begin(), nodes.end(), less))
+        std::sort(nodes.begin(), nodes.end(), less);
+    always_assert(std::adjacent_find(nodes.begin(), nodes.end(), [&](wrapper_type* a, wrapper_type* b) {
+        return !less(a, b);
+    }) == nodes.end() && "bulk_load keys must be distinct");
+    wrapper_tree_.build(nodes.data(), nodes.size());
+    size_ = nodes.size();
+    unlock_write(&treelock_);
+}
+
 template <typename K, typename T, bool GlobalSize>
 bool RBTree<K, T, GlobalSize>::nontrans_contains(const K& key) {
     wrapper_type idx_pair(rbpair<K, T>(key, T()));
@@ -1219,7 +1321,7 @@ bool RBTree<K, T, GlobalSize>::nontrans_remove(const K& key) {
         size_--;
         wrapper_type* n = std::get<0>(results);
         wrapper_tree_.erase(*n);
-        free(n);
+        Transaction::pool_free(n, sizeof(wrapper_type));
     }
     unlock_write(&treelock_);
     return found;
@@ -1240,7 +1342,7 @@ bool RBTree<K, T, GlobalSize>::nontrans_remove(const K& key, T& oldval) {
 	// set the old value for the caller
 	oldval = n->writeable_value();
         wrapper_tree_.erase(*n);
-        free(n);
+        Transaction::pool_free(n, sizeof(wrapper_type));
     }
     unlock_write(&treelock_);
     return found;
@@ -6,6 +6,7 @@
 #include <iomanip>
 #include <iostream>
 #include "Interface.hh"
+#include "Transaction.hh"
 
 #ifndef rbaccount
 # define rbaccount(x)
@@ -192,6 +193,19 @@ class rbtree {
     template <typename K, typename Comp>
     inline std::tuple<T*, Version, bool, boundaries_type> find_any(const K& key, Comp comp) const;
 
+    // find_any() one level at a time: find_start() sets up a walk from the
+    // root, each find_step() descends one level and returns false once the
+    // walk has ended, and find_result() returns what find_any() would.
+    struct find_cursor {
+        rbnodeptr<T> n;
+        rbnodeptr<T> p;
+        boundaries_type boundary;
+    };
+    inline void find_start(find_cursor& c) const;
+    template <typename K, typename Comp>
+    inline bool find_step(find_cursor& c, const K& key, Comp comp) const;
+    inline std::tuple<T*, Version, bool, boundaries_type> find_result(const find_cursor& c) const;
+
     template <typename K, typename Comp>
     inline std::tuple<T*, Version, bool, boundaries_type, node_info_type> find_insert(K& key, Comp comp);
 
@@ -199,6 +213,8 @@ class rbtree {
     inline std::tuple<rbnodeptr<T>, bool> find_or_parent(const K& key, Comp comp) const;
 
     void insert_commit(T* x, rbnodeptr<T> p, bool side);
+    void build(T** nodes, size_t n);
+    rbnodeptr<T> build(T** nodes, size_t n, T* parent, int depth, int red_depth);
     T* delete_node(T* victim, T* successor_hint);
     void delete_node_fixup(rbnodeptr<T> p, bool side);
 
@@ -393,6 +409,34 @@ void rbtree<T, C>::insert_commit(T* x, rbnodeptr<T> p, bool side) {
     }
 }
 
+// links n nodes, sorted in increasing order, into an empty tree. Each
+// node is the midpoint of its range, so the tree is complete except for
+// its deepest level; nodes there are red and all others black.
+template <typename T, typename C>
+void rbtree<T, C>::build(T** nodes, size_t n) {
+    assert(!r_.root_);
+    if (!n)
+        return;
+    int depth = 0;
+    for (size_t x = n; x > 1; x /= 2)
+        ++depth;
+    r_.root_ = build(nodes, n, nullptr, 0, depth ? depth : -1).node();
+    r_.limit_[0] = nodes[0];
+    r_.limit_[1] = nodes[n - 1];
+}
+
+template <typename T, typename C>
+rbnodeptr<T> rbtree<T, C>::build(T** nodes, size_t n, T* parent, int depth, int red_depth) {
+    if (!n)
+        return rbnodeptr<T>(0, false);
+    size_t mid = n / 2;
+    T* x = nodes[mid];
+    x->rblinks_.p_ = parent;
+    x->rblinks_.c_[0] = build(nodes, mid, x, depth + 1, red_depth);
+    x->rblinks_.c_[1] = build(nodes + mid + 1, n - mid - 1, x, depth + 1, red_depth);
+    return rbnodeptr<T>(x, depth == red_depth);
+}
+
 template <typename T, typename C>
 rbnodeptr<T> rbtree<T, C>::insert(reference x) {
     rbaccount(insert);
@@ -516,38 +560,53 @@ template <typename T, typename C> template <typename K, typename Comp>
 inline std::tuple<T*, typename rbtree<T, C>::Version, bool,
        typename rbtree<T, C>::boundaries_type>
 rbtree<T, C>::find_any(const K& key, Comp comp) const {
+    find_cursor c;
+    find_start(c);
+    while (find_step(c, key, comp))
+        /* do nothing */;
+    return find_result(c);
+}
 
-    rbnodeptr<T> n(r_.root_, false);
-    rbnodeptr<T> p(nullptr, false);
+template <typename T, typename C>
+inline void rbtree<T, C>::find_start(find_cursor& c) const {
+    c.n = rbnodeptr<T>(r_.root_, false);
+    c.p = rbnodeptr<T>(nullptr, false);
 
     T* lhs = r_.limit_[0];
     T* rhs = r_.limit_[1];
-    boundaries_type boundary = std::make_pair(std::make_tuple(lhs, lhs ? lhs->nodeversion() : 0),
+    c.boundary = std::make_pair(std::make_tuple(lhs, lhs ? lhs->nodeversion() : 0),
                     std::make_tuple(rhs, rhs ? rhs->nodeversion() : 0));
+}
 
-    while (n.node()) {
-        int cmp = comp.compare(key, *n.node());
-        if (cmp == 0)
-            break;
-
-        // narrow down to find the boundary nodes
-        // update the LEFT boundary when going RIGHT, and vice versa
-        if (cmp > 0) {
-            T* nb = n.node();
-            boundary.first = std::make_tuple(nb, nb->nodeversion());
-        } else {
-            T* nb = n.node();
-            boundary.second = std::make_tuple(nb, nb->nodeversion());
-        }
-        p = n;
-        n = n.node()->rblinks_.c_[cmp > 0];
-    }
+template <typename T, typename C> template <typename K, typename Comp>
+inline bool rbtree<T, C>::find_step(find_cursor& c, const K& key, Comp comp) const {
+    if (!c.n.node())
+        return false;
+    int cmp = comp.compare(key, *c.n.node());
+    if (cmp == 0)
+        return false;
+
+    // narrow down to find the boundary nodes
+    // update the LEFT boundary when going RIGHT, and vice versa
+    T* nb = c.n.node();
+    if (cmp > 0)
+        c.boundary.first = std::make_tuple(nb, nb->nodeversion());
+    else
+        c.boundary.second = std::make_tuple(nb, nb->nodeversion());
+    c.p = c.n;
+    c.n = nb->rblinks_.c_[cmp > 0];
+    return c.n.node() != nullptr;
+}
 
-    bool found = (n.node() != nullptr);
-    T* retnode = found ? n.node() : p.node();
+template <typename T, typename C>
+inline std::tuple<T*, typename rbtree<T, C>::Version, bool,
+       typename rbtree<T, C>::boundaries_type>
+rbtree<T, C>::find_result(const find_cursor& c) const {
+    bool found = (c.n.node() != nullptr);
+    T* retnode = found ? c.n.node() : c.p.node();
     Version retver = retnode ? retnode->version() : treeversion_;
 
-    return std::make_tuple(retnode, retver, found, boundary);
+    return std::make_tuple(retnode, retver, found, c.boundary);
 }
 
 template <typename T, typename C> template <typename K, typename Comp>
@@ -608,7 +667,7 @@ rbtree<T, C>::find_insert(K& key, Comp comp) {
 
     // perform the insertion if not found
     if (!found) {
-        retnode = (T*)malloc(sizeof(T));
+        retnode = (T*)Transaction::pool_allocate(sizeof(T));
         new (retnode) T((rbpair<typename K::key_type, typename K::value_type>)key);
         retver = retnode->nodeversion();
         insert_commit(retnode, p, (cmp > 0));
@@ -0,0 +1,230 @@
+#include "StoStats.hh"
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <errno.h>
+#include <inttypes.h>
+
+static const char* const counter_names[] = {
+    "total_aborts", "total_starts", "commit_time_nonopaque",
+    "commit_time_aborts", "max_set", "hco", "hco_lock", "hco_invalid",
+    "hco_abort", "total_n", "total_r", "total_w", "max_transbuffer",
+    "total_transbuffer", "push_abort", "pop_abort", "total_check_read",
+    "total_check_predicate", "hash_find", "hash_collision",
+    "hash_collision2", "total_searched", "total_hash_probes",
+    "max_hash_probe", "cm_lock_retries", "cm_lock_giveups",
+    "cm_wait_retries", "cm_backoffs", "cm_backoff_spins", "batch_calls",
+    "batch_items"
+};
+static_assert(sizeof(counter_names) / sizeof(counter_names[0]) == txp_batch_items + 1,
+              "counter_names matches enum txp");
+
+static const char* const histogram_names[] = {
+    "execution", "lock", "validate", "install", "commit", "retries"
+};
+
+const char* StoStats::counter_name(unsigned p) {
+    return p <= txp_batch_items ? counter_names[p] : "unknown";
+}
+
+const char* StoStats::histogram_name(unsigned h) {
+    return h <= txh_retries ? histogram_names[h] : "unknown";
+}
+
+static double monotonic_now() {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+StoStats::snapshot StoStats::take() {
+    snapshot s;
+    s.time = monotonic_now();
+    s.interval = 0;
+    s.is_delta = false;
+    s.nthreads = TThread::id_limit();
+    s.commits = s.aborts = 0;
+    for (unsigned i = 0; i != s.nthreads; ++i) {
+        s.commits += Transaction::tinfo[i].ncommits;
+        s.aborts += Transaction::tinfo[i].naborts;
+    }
+    s.global_epoch = Transaction::global_epochs.global_epoch;
+    s.active_epoch = Transaction::global_epochs.active_epoch;
+    s.commit_tid = Transaction::opacity_tid();
+    s.counters = Transaction::txp_counters_combined();
+    s.histograms = Transaction::txh_histograms_combined();
+    return s;
+}
+
+StoStats::snapshot StoStats::delta(const snapshot& now, const snapshot& before) {
+    snapshot d = now;
+    d.interval = now.time - before.time;
+    d.is_delta = true;
+    d.commits -= before.commits;
+    d.aborts -= before.aborts;
+    for (unsigned p = 0; p != txp_count; ++p)
+        if (!txp_is_max(p))
+            d.counters.p_[p] -= before.counters.p_[p];
+    for (unsigned h = 0; h != txh_count; ++h)
+        d.histograms.h_[h].subtract(before.histograms.h_[h]);
+    return d;
+}
+
+namespace {
+struct histogram_summary {
+    uint64_t count, mean, p50, p99, p999, max;
+};
+}
+
+static histogram_summary summarize(const log_histogram& x, unsigned h) {
+    double scale = 1;
+#if STO_LATENCY_HISTOGRAMS
+    if (h != txh_retries)
+        scale = 1 / Transaction::tsc_per_ns();
+#else
+    (void) h;
+#endif
+    return histogram_summary{
+        x.count(), uint64_t(x.mean() * scale + 0.5),
+        uint64_t(x.percentile(0.5) * scale + 0.5),
+        uint64_t(x.percentile(0.99) * scale + 0.5),
+        uint64_t(x.percentile(0.999) * scale + 0.5),
+        uint64_t(x.max() * scale + 0.5)
+    };
+}
+
+std::string StoStats::json(const snapshot& s) {
+    char buf[256];
+    std::string out;
+    snprintf(buf, sizeof(buf), "{\"time\":%.6f,\"delta\":%s,\"interval\":%.6f,\"nthreads\":%u,"
+             "\"commits\":%" PRIu64 ",\"aborts\":%" PRIu64,
+             s.time, s.is_delta ? "true" : "false", s.interval, s.nthreads,
+             s.commits, s.aborts);
+    out += buf;
+    uint64_t attempts = s.commits + s.aborts;
+    snprintf(buf, sizeof(buf), ",\"abort_rate\":%.6f", attempts ? (double) s.aborts / attempts : 0.0);
+    out += buf;
+    if (s.is_delta && s.interval > 0) {
+        snprintf(buf, sizeof(buf), ",\"commits_per_sec\":%.1f", s.commits / s.interval);
+        out += buf;
+    }
+    snprintf(buf, sizeof(buf), ",\"epoch\":{\"global\":%" PRIu64 ",\"active\":%" PRIu64 "}"
+             ",\"commit_tid\":%" PRIu64,
+             uint64_t(s.global_epoch), uint64_t(s.active_epoch), uint64_t(s.commit_tid));
+    out += buf;
+    out += ",\"counters\":{";
+    for (unsigned p = 0; p != txp_count; ++p) {
+        snprintf(buf, sizeof(buf), "%s\"%s\":%" PRIu64, p ? "," : "",
+                 counter_name(p), uint64_t(s.counters.p_[p]));
+        out += buf;
+    }
+    out += "},\"histograms\":{";
+    for (unsigned h = 0; h != txh_count; ++h) {
+        histogram_summary x = summarize(s.histograms.h_[h], h);
+        snprintf(buf, sizeof(buf), "%s\"%s\":{\"count\":%" PRIu64 ",\"mean\":%" PRIu64
+                 ",\"p50\":%" PRIu64 ",\"p99\":%" PRIu64 ",\"p999\":%" PRIu64
+                 ",\"max\":%" PRIu64 "}",
+                 h ? "," : "", histogram_name(h), x.count, x.mean, x.p50, x.p99, x.p999, x.max);
+        out += buf;
+    }
+    out += "}}\n";
+    return out;
+}
+
+template <typename T>
+static void put(std::string& out, T v) {
+    // x86 is little-endian, so the in-memory representation is the format
+    out.append(reinterpret_cast<const char*>(&v), sizeof(v));
+}
+
+std::string StoStats::binary(const snapshot& s) {
+    std::string out;
+    put(out, uint32_t(0));      // length, filled in below
+    put(out, uint32_t(0x534F5453));
+    put(out, uint16_t(1));
+    put(out, uint16_t(s.is_delta));
+    put(out, uint16_t(txp_count));
+    put(out, uint16_t(txh_count));
+    put(out, uint32_t(s.nthreads));
+    put(out, s.time);
+    put(out, s.interval);
+    put(out, uint64_t(s.commits));
+    put(out, uint64_t(s.aborts));
+    put(out, uint64_t(s.global_epoch));
+    put(out, uint64_t(s.active_epoch));
+    put(out, uint64_t(s.commit_tid));
+    for (unsigned p = 0; p != txp_count; ++p)
+        put(out, uint64_t(s.counters.p_[p]));
+    for (unsigned h = 0; h != txh_count; ++h) {
+        histogram_summary x = summarize(s.histograms.h_[h], h);
+        put(out, x.count);
+        put(out, x.mean);
+        put(out, x.p50);
+        put(out, x.p99);
+        put(out, x.p999);
+        put(out, x.max);
+    }
+    uint32_t len = out.size();
+    memcpy(&out[0], &len, sizeof(len));
+    return out;
+}
+
+static struct {
+    pthread_t thread;
+    int fd;
+    double interval;
+    StoStats::format_type format;
+    volatile bool run;
+    bool active;
+} stats_stream;
+
+static void write_record(const StoStats::snapshot& s) {
+    std::string rec = stats_stream.format == StoStats::f_json
+        ? StoStats::json(s) : StoStats::binary(s);
+    const char* p = rec.data();
+    size_t n = rec.size();
+    while (n) {
+        ssize_t w = write(stats_stream.fd, p, n);
+        if (w < 0 && errno == EINTR)
+            continue;
+        if (w <= 0)
+            return;
+        p += w;
+        n -= w;
+    }
+}
+
+static void* stats_stream_thread(void*) {
+    StoStats::snapshot prev = StoStats::take();
+    while (stats_stream.run) {
+        double next = prev.time + stats_stream.interval;
+        // sleep in short steps so stop_stream() doesn't wait a full interval
+        double now;
+        while (stats_stream.run && (now = monotonic_now()) < next)
+            usleep(std::min(next - now, 0.01) * 1e6);
+        StoStats::snapshot cur = StoStats::take();
+        write_record(StoStats::delta(cur, prev));
+        prev = cur;
+    }
+    return nullptr;
+}
+
+bool StoStats::stream(int fd, double interval, format_type format) {
+    if (stats_stream.active)
+        return false;
+    stats_stream.fd = fd;
+    stats_stream.interval = interval;
+    stats_stream.format = format;
+    stats_stream.run = true;
+    stats_stream.active = true;
+    pthread_create(&stats_stream.thread, nullptr, stats_stream_thread, nullptr);
+    return true;
+}
+
+void StoStats::stop_stream() {
+    if (!stats_stream.active)
+        return;
+    stats_stream.run = false;
+    pthread_join(stats_stream.thread, nullptr);
+    stats_stream.active = false;
+}
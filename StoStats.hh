@@ -0,0 +1,52 @@
+#pragma once
+#include "Transaction.hh"
+#include <string>
+
+// Live statistics export. StoStats::take() snapshots the combined
+// profile counters, latency histograms and epoch state at any time;
+// snapshots serialize as one-line JSON or as a compact binary record.
+// stream() starts a thread that writes the delta since the previous
+// record to a file descriptor at a fixed interval.
+//
+// Binary records are little-endian:
+//   u32 length of the whole record, u32 magic 'STOS', u16 version (1),
+//   u16 flags (1 = delta), u16 ncounters, u16 nhistograms,
+//   u32 nthreads, f64 time, f64 interval,
+//   u64 commits, aborts, global_epoch, active_epoch, commit_tid,
+//   u64 counters[ncounters] (txp order),
+//   then per histogram (txh order) u64 count, mean, p50, p99, p999, max.
+// Histogram times are in ns; retries are counts.
+class StoStats {
+public:
+    struct snapshot {
+        double time;            // seconds, CLOCK_MONOTONIC
+        double interval;        // seconds covered by a delta, else 0
+        bool is_delta;
+        unsigned nthreads;
+        uint64_t commits;
+        uint64_t aborts;
+        Transaction::epoch_type global_epoch;
+        Transaction::epoch_type active_epoch;
+        TransactionTid::type commit_tid;
+        txp_counters counters;
+        txh_histograms histograms;
+    };
+
+    enum format_type { f_json, f_binary };
+
+    static snapshot take();
+    // Changes from `before` to `now`. Max-type counters and histogram
+    // maxima are not differenced.
+    static snapshot delta(const snapshot& now, const snapshot& before);
+
+    static std::string json(const snapshot& s);
+    static std::string binary(const snapshot& s);
+
+    // Returns false if a stream is already running.
+    static bool stream(int fd, double interval, format_type format = f_json);
+    // Writes a final delta and stops the stream thread.
+    static void stop_stream();
+
+    static const char* counter_name(unsigned p);
+    static const char* histogram_name(unsigned h);
+};
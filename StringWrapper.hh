@@ -25,6 +25,7 @@ private:
 
 template <>
 struct Packer<std::string, false> {
+    static constexpr bool is_simple = false;
     template <typename... Args>
     static void* pack(TransactionBuffer& buf, Args&&... args) {
         return buf.template allocate<std::string>(std::forward<Args>(args)...);
@@ -36,10 +37,7 @@ struct Packer<std::string, false> {
         return wrapper.value();
     }
     static void* pack_unique(TransactionBuffer& buf, const std::string& x) {
-        if (const void* ptr = buf.find<UniqueKey<std::string> >(x))
-            return const_cast<void*>(ptr);
-        else
-            return buf.allocate<UniqueKey<std::string> >(x);
+        return buf.intern(x);
     }
     template <typename... Args>
     static void* repack(TransactionBuffer& buf, void*, Args&&... args) {
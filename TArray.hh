@@ -3,7 +3,7 @@
 #include "TArrayProxy.hh"
 
 template <typename T, unsigned N, template <typename> class W = TOpaqueWrapped>
-class TArray : public TObject {
+class TArray : public TBatchObject<TArray<T, N, W> > {
 public:
     class iterator;
     class const_iterator;
@@ -69,6 +69,9 @@ public:
     bool check(TransItem& item, Transaction&) override {
         return item.check_version(data_[item.key<size_type>()].vers);
     }
+    volatile TransactionTid::type* validation_word(TransItem& item) {
+        return &data_[item.key<size_type>()].vers.value();
+    }
     void install(TransItem& item, Transaction& txn) override {
         size_type i = item.key<size_type>();
         data_[i].v.write(item.write_value<T>());
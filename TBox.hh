@@ -3,7 +3,7 @@
 #include "TWrapped.hh"
 
 template <typename T, typename W = TWrapped<T> >
-class TBox : public TObject {
+class TBox : public TBatchObject<TBox<T, W> > {
 public:
     typedef typename W::read_type read_type;
     typedef typename W::version_type version_type;
@@ -74,6 +74,9 @@ public:
     bool check(TransItem& item, Transaction&) override {
         return item.check_version(vers_);
     }
+    volatile TransactionTid::type* validation_word(TransItem&) {
+        return &vers_.value();
+    }
     void install(TransItem& item, Transaction& txn) override {
         v_.write(std::move(item.template write_value<T>()));
         txn.set_version_unlock(vers_, item);
@@ -1,7 +1,7 @@
 #include "TRcu.hh"
 
 TRcuSet::TRcuSet()
-    : clean_epoch_(0) {
+    : clean_epoch_(0), npending_(0), nadded_(0), bytes_added_(0) {
     unsigned capacity = (4080 - sizeof(TRcuGroup)) / sizeof(TRcuGroup::TRcuElement);
     current_ = first_ = TRcuGroup::make(capacity);
     // ngroups_ = 1;
@@ -49,12 +49,13 @@ void TRcuSet::grow() {
     assert(current_->head_ == 0 && current_->tail_ == 0);
 }
 
-inline bool TRcuGroup::clean_until(epoch_type max_epoch) {
+inline bool TRcuGroup::clean_until(epoch_type max_epoch, size_t& ncalled) {
     while (head_ != tail_ && signed_epoch_type(max_epoch - e_[head_].u.epoch) > 0) {
         ++head_;
         while (head_ != tail_ && e_[head_].function) {
             e_[head_].function(e_[head_].u.argument);
             ++head_;
+            ++ncalled;
         }
     }
     if (head_ == tail_) {
@@ -67,20 +68,59 @@ inline bool TRcuGroup::clean_until(epoch_type max_epoch) {
 void TRcuSet::hard_clean_until(epoch_type max_epoch) {
     TRcuGroup* empty_head = nullptr;
     TRcuGroup* empty_tail = nullptr;
+    size_t ncalled = 0;
     // clean [first_, current_]
-    while (first_->clean_until(max_epoch)) {
+    while (first_->clean_until(max_epoch, ncalled)) {
         if (!empty_head)
             empty_head = first_;
         empty_tail = first_;
         if (first_ == current_) {
             first_ = current_ = empty_head;
+            npending_ -= ncalled;
             return;
         }
         first_ = first_->next_;
     }
+    npending_ -= ncalled;
     // hook empties after current_; everything after current_ guaranteed empty
     if (empty_head) {
         empty_tail->next_ = current_->next_;
         current_->next_ = empty_head;
     }
 }
+
+size_t TRcuPool::cap_bytes = 4 << 20;
+
+TRcuPool::~TRcuPool() {
+    trim();
+}
+
+void* TRcuPool::hard_allocate(unsigned c, size_t size) {
+    if (c >= nclasses)
+        return malloc(size);
+    ++c_[c].stats.mallocs;
+    return malloc(class_size(c));
+}
+
+void TRcuPool::hard_free(unsigned c, void* p) {
+    if (c < nclasses)
+        ++c_[c].stats.releases;
+    ::free(p);
+}
+
+size_t TRcuPool::cached_bytes() const {
+    size_t n = 0;
+    for (unsigned c = 0; c != nclasses; ++c)
+        n += c_[c].stats.cached * class_size(c);
+    return n;
+}
+
+void TRcuPool::trim() {
+    for (unsigned c = 0; c != nclasses; ++c) {
+        while (free_block* b = c_[c].head) {
+            c_[c].head = b->next;
+            ::free(b);
+        }
+        c_[c].stats.cached = 0;
+    }
+}
@@ -1,6 +1,8 @@
 #pragma once
 #include "compiler.hh"
 #include <assert.h>
+#include <stdlib.h>
+#include <string.h>
 
 struct TRcuGroup {
     typedef uint64_t epoch_type;
@@ -56,7 +58,7 @@ public:
         e_[tail_].u.argument = argument;
         ++tail_;
     }
-    inline bool clean_until(epoch_type max_epoch);
+    inline bool clean_until(epoch_type max_epoch, size_t& ncalled);
 };
 
 class TRcuSet {
@@ -67,10 +69,16 @@ public:
     TRcuSet();
     ~TRcuSet();
 
-    void add(epoch_type epoch, void (*function)(void*), void* argument) {
+    // `size` is the number of bytes the callback frees, if known; it
+    // feeds pending_bytes()
+    void add(epoch_type epoch, void (*function)(void*), void* argument,
+             size_t size = 0) {
         if (unlikely(current_->tail_ + 2 > current_->capacity_))
             grow();
         current_->add(epoch, function, argument);
+        ++npending_;
+        ++nadded_;
+        bytes_added_ += size;
     }
     void clean_until(epoch_type max_epoch) {
         if (clean_epoch_ != max_epoch)
@@ -80,11 +88,24 @@ public:
     epoch_type clean_epoch() const {
         return clean_epoch_;
     }
+    // Callbacks not yet run. May be read from other threads.
+    size_t pending() const {
+        return npending_;
+    }
+    // Estimate of the bytes pending callbacks will free: pending() times
+    // the average size passed to add().
+    size_t pending_bytes() const {
+        size_t n = npending_, nadded = nadded_;
+        return nadded ? size_t((double) bytes_added_ * n / nadded) : 0;
+    }
 
 private:
     TRcuGroup* current_;
     TRcuGroup* first_;
     epoch_type clean_epoch_;
+    size_t npending_;
+    uint64_t nadded_;
+    uint64_t bytes_added_;
     // unsigned ngroups_;
 
     TRcuSet(const TRcuSet&) = delete;
@@ -93,3 +114,86 @@ private:
     void grow();
     void hard_clean_until(epoch_type max_epoch);
 };
+
+// Per-thread size-class free lists. Blocks come from malloc, rounded up
+// to a multiple of granularity; freed blocks are cached for reuse until a
+// class holds cap_bytes, then go back to malloc. Requests larger than
+// max_size bypass the pool. Not thread-safe: each thread uses its own.
+class TRcuPool {
+public:
+    static constexpr size_t granularity = 16;
+    static constexpr unsigned nclasses = 32;
+    static constexpr size_t max_size = granularity * nclasses;
+
+    // per-class cache limit, in bytes
+    static size_t cap_bytes;
+
+    struct class_stats {
+        uint64_t mallocs;       // blocks obtained from malloc
+        uint64_t reuses;        // allocations served from the cache
+        uint64_t releases;      // frees returned to malloc at the cap
+        size_t cached;          // blocks currently cached
+        void add(const class_stats& x) {
+            mallocs += x.mallocs;
+            reuses += x.reuses;
+            releases += x.releases;
+            cached += x.cached;
+        }
+    };
+
+    TRcuPool() {
+        memset(c_, 0, sizeof(c_));
+    }
+    ~TRcuPool();
+
+    static unsigned size_class(size_t size) {
+        return size ? (size - 1) / granularity : 0;
+    }
+    static size_t class_size(unsigned c) {
+        return (c + 1) * granularity;
+    }
+
+    void* allocate(size_t size) {
+        unsigned c = size_class(size);
+        if (c < nclasses && c_[c].head) {
+            free_block* b = c_[c].head;
+            c_[c].head = b->next;
+            --c_[c].stats.cached;
+            ++c_[c].stats.reuses;
+            return b;
+        }
+        return hard_allocate(c, size);
+    }
+    void free(void* p, size_t size) {
+        unsigned c = size_class(size);
+        if (c < nclasses && (c_[c].stats.cached + 1) * class_size(c) <= cap_bytes) {
+            free_block* b = static_cast<free_block*>(p);
+            b->next = c_[c].head;
+            c_[c].head = b;
+            ++c_[c].stats.cached;
+        } else
+            hard_free(c, p);
+    }
+
+    const class_stats& stats(unsigned c) const {
+        return c_[c].stats;
+    }
+    size_t cached_bytes() const;
+    // Return every cached block to malloc.
+    void trim();
+
+private:
+    struct free_block {
+        free_block* next;
+    };
+    struct size_class_state {
+        free_block* head;
+        class_stats stats;
+    };
+    size_class_state c_[nclasses];
+
+    TRcuPool(const TRcuPool&) = delete;
+    TRcuPool& operator=(const TRcuPool&) = delete;
+    void* hard_allocate(unsigned c, size_t size);
+    void hard_free(unsigned c, void* p);
+};
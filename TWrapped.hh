@@ -45,16 +45,10 @@ static T read_wait_atomic(const T* v, TransProxy item, const V& version, bool ad
             item.observe(v1, add_read);
             return result;
         }
-#if STO_SPIN_EXPBACKOFF
-        if (++n > STO_SPIN_BOUND_WAIT)
+        if (!item.transaction().wait_spin(++n)) {
             Sto::abort();
-        if (n > 3)
-            for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                relax_fence();
-#else
-        if (++n > (1 << STO_SPIN_BOUND_WAIT))
-            Sto::abort();
-#endif
+            return result;
+        }
         relax_fence();
     }
 }
@@ -69,16 +63,10 @@ static T read_wait_nonatomic(const T* v, TransProxy item, const V& version, bool
             return *v;
         }
         relax_fence();
-#if STO_SPIN_EXPBACKOFF
-        if (++n > STO_SPIN_BOUND_WAIT)
+        if (!item.transaction().wait_spin(++n)) {
             Sto::abort();
-        if (n > 3)
-            for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                relax_fence();
-#else
-        if (++n > (1 << STO_SPIN_BOUND_WAIT))
-            Sto::abort();
-#endif
+            return *v;
+        }
     }
 }
 }
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <type_traits>
+#include <typeinfo>
 #include <string.h>
 #include <assert.h>
 #include "Interface.hh"
@@ -203,6 +204,93 @@ private:
 };
 
 
+// Base class for TObjects whose batch commit hooks call T's per-item
+// hooks directly, so a span of items costs one virtual call per phase.
+//
+// If T defines validation_word(TransItem&), returning the version word
+// that check() compares the item's read version against (as with
+// TVersion::check_version), check_all validates reads in blocks: it
+// gathers those words and the expected versions, prefetches the words,
+// and compares the block with TransactionTid::check_versions. Items for
+// which validation_word returns nullptr fall back to T::check.
+//
+// A run whose owners are a subclass of T, which may override the
+// per-item hooks, goes through the default TObject batch hooks instead.
+template <typename T>
+class TBatchObject : public TObject {
+public:
+    typedef TransactionTid::type version_word;
+
+    volatile version_word* validation_word(TransItem&) {
+        return nullptr;
+    }
+
+    TransItem* lock_all(TransItem* first, TransItem* last, Transaction& txn) override {
+        if (!exact_type(first))
+            return TObject::lock_all(first, last, txn);
+        for (; first != last; ++first)
+            if (first->has_write()
+                && !static_cast<T*>(first->owner())->T::lock(*first, txn))
+                break;
+        return first;
+    }
+    TransItem* check_all(TransItem* first, TransItem* last, Transaction& txn) override {
+        if (!exact_type(first))
+            return TObject::check_all(first, last, txn);
+        TransItem* items[check_block];
+        volatile version_word* words[check_block];
+        version_word expected[check_block];
+        version_word current[check_block];
+        int here = TThread::id();
+        while (first != last) {
+            unsigned n = 0;
+            bool fallback = false;
+            for (; first != last && n != check_block; ++first)
+                if (first->has_read()) {
+                    auto w = static_cast<T*>(first->owner())->validation_word(*first);
+                    if (!w) {
+                        fallback = true;
+                        break;
+                    }
+                    __builtin_prefetch(const_cast<version_word*>(w));
+                    items[n] = first;
+                    words[n] = w;
+                    expected[n] = first->template read_value<version_word>();
+                    ++n;
+                }
+            for (unsigned i = 0; i != n; ++i)
+                current[i] = *words[i];
+            unsigned bad = TransactionTid::check_versions(current, expected, n, here);
+            if (bad != n)
+                return items[bad];
+            if (fallback) {
+                if (!static_cast<T*>(first->owner())->T::check(*first, txn))
+                    return first;
+                ++first;
+            }
+        }
+        return last;
+    }
+    void install_all(TransItem* first, TransItem* last, Transaction& txn) override {
+        if (!exact_type(first)) {
+            TObject::install_all(first, last, txn);
+            return;
+        }
+        for (; first != last; ++first)
+            if (first->has_write())
+                static_cast<T*>(first->owner())->T::install(*first, txn);
+    }
+
+private:
+    static constexpr unsigned check_block = 64;
+
+    // a batch hook's items all have owners of the same dynamic type
+    static bool exact_type(TransItem* first) {
+        return typeid(*first->owner()) == typeid(T);
+    }
+};
+
+
 class TransProxy {
   public:
     TransProxy(Transaction& t, TransItem& item)
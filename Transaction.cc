@@ -1,14 +1,179 @@
 #include "Transaction.hh"
 #include <typeinfo>
+#include <inttypes.h>
 
 Transaction::testing_type Transaction::testing;
 threadinfo_t Transaction::tinfo[MAX_THREADS];
 __thread int TThread::the_id;
+__thread int TThread::registered_id_ = -1;
+int TThread::id_limit_ = 1; // thread 0 is implicitly in use
+int TThread::slot_state_[MAX_THREADS] = {slot_set}; // so is its slot
 Transaction::epoch_state __attribute__((aligned(128))) Transaction::global_epochs = {
     1, 0, TransactionTid::increment_value, true
 };
 __thread Transaction *TThread::txn = nullptr;
-std::function<void(threadinfo_t::epoch_type)> Transaction::epoch_advance_callback;
+trans_hook_list<threadinfo_t::epoch_type> Transaction::epoch_hooks;
+bool Transaction::decentralized_tids = STO_DECENTRALIZED_TID;
+bool Transaction::batch_commit = true;
+unsigned Transaction::group_commit_size = 16;
+unsigned Transaction::epoch_interval = 100000;
+unsigned Transaction::epoch_poll_interval = 1000;
+size_t Transaction::epoch_pending_threshold = 0;
+size_t Transaction::epoch_pending_bytes_threshold = 0;
+uint64_t Transaction::epoch_early_advances = 0;
+static bool epoch_advance_lock;
+
+ContentionManager::policy_type ContentionManager::policy =
+    STO_SPIN_EXPBACKOFF ? ContentionManager::p_exponential : ContentionManager::p_spin;
+unsigned ContentionManager::spin_write_attempts = 1U << (STO_SPIN_EXPBACKOFF ? 3 : STO_SPIN_BOUND_WRITE);
+unsigned ContentionManager::backoff_write_attempts = STO_SPIN_EXPBACKOFF ? STO_SPIN_BOUND_WRITE : 7;
+unsigned ContentionManager::spin_wait_attempts = 1U << (STO_SPIN_EXPBACKOFF ? 20 : STO_SPIN_BOUND_WAIT);
+unsigned ContentionManager::backoff_wait_attempts = STO_SPIN_EXPBACKOFF ? STO_SPIN_BOUND_WAIT : 18;
+unsigned ContentionManager::max_backoff_shift = 16;
+
+static const char* const cm_policy_names[] = {
+    "spin", "exponential", "randomized", "adaptive"
+};
+
+const char* ContentionManager::policy_name(policy_type p) {
+    return unsigned(p) < p_npolicies ? cm_policy_names[p] : "unknown";
+}
+
+bool ContentionManager::parse_policy(const char* name, policy_type& p) {
+    for (unsigned i = 0; i != p_npolicies; ++i)
+        if (strcmp(name, cm_policy_names[i]) == 0) {
+            p = policy_type(i);
+            return true;
+        }
+    return false;
+}
+
+bool AbortTelemetry::enabled = false;
+unsigned AbortTelemetry::sample_period = 16;
+
+void AbortTelemetry::append(thread_state& ts, int threadid, const TObject* owner,
+                            uintptr_t key, const char* reason, phase_type phase) {
+    ring* r = ts.ring_;
+    if (!r) {
+        r = new ring();
+        release_fence();
+        ts.ring_ = r;
+    }
+    uint64_t h = r->head;
+    record& rec = r->r[h % ring_size];
+    rec.owner = owner;
+    rec.key = key;
+    rec.reason = reason;
+    rec.phase = phase;
+    rec.threadid = threadid;
+    release_fence();
+    r->head = h + 1;
+}
+
+std::vector<AbortTelemetry::record> AbortTelemetry::snapshot() {
+    std::vector<record> out;
+    for (int i = 0; i != TThread::id_limit(); ++i) {
+        ring* r = Transaction::tinfo[i].aborts.ring_;
+        if (!r)
+            continue;
+        acquire_fence();
+        uint64_t h = r->head;
+        acquire_fence();
+        uint64_t first = h > ring_size ? h - ring_size : 0;
+        size_t pos = out.size();
+        for (uint64_t x = first; x != h; ++x)
+            out.push_back(r->r[x % ring_size]);
+        acquire_fence();
+        // drop records the writer may have overwritten while we copied,
+        // including record h2 - ring_size, whose slot it may be writing now
+        uint64_t h2 = r->head;
+        if (h2 + 1 > first + ring_size) {
+            uint64_t lost = std::min(h2 + 1 - ring_size - first, h - first);
+            out.erase(out.begin() + pos, out.begin() + pos + lost);
+        }
+    }
+    return out;
+}
+
+template <typename T, typename Less, typename Make>
+static std::vector<T> abort_telemetry_top(std::vector<AbortTelemetry::record>& recs, unsigned n,
+                                          Less less, Make make) {
+    std::sort(recs.begin(), recs.end(), less);
+    std::vector<T> out;
+    for (auto it = recs.begin(); it != recs.end(); ) {
+        auto next = it + 1;
+        while (next != recs.end() && !less(*it, *next))
+            ++next;
+        out.push_back(make(*it, next - it));
+        it = next;
+    }
+    std::sort(out.begin(), out.end(), [](const T& a, const T& b) {
+            return a.count > b.count;
+        });
+    if (out.size() > n)
+        out.resize(n);
+    return out;
+}
+
+std::vector<AbortTelemetry::hot_key> AbortTelemetry::top_keys(unsigned n) {
+    auto recs = snapshot();
+    return abort_telemetry_top<hot_key>(recs, n,
+        [](const record& a, const record& b) {
+            return a.owner < b.owner || (a.owner == b.owner && a.key < b.key);
+        },
+        [](const record& r, uint64_t count) {
+            return hot_key{r.owner, r.key, count};
+        });
+}
+
+std::vector<AbortTelemetry::hot_owner> AbortTelemetry::top_owners(unsigned n) {
+    auto recs = snapshot();
+    return abort_telemetry_top<hot_owner>(recs, n,
+        [](const record& a, const record& b) {
+            return a.owner < b.owner;
+        },
+        [](const record& r, uint64_t count) {
+            return hot_owner{r.owner, count};
+        });
+}
+
+std::vector<AbortTelemetry::hot_reason> AbortTelemetry::top_reasons(unsigned n) {
+    auto recs = snapshot();
+    // compare reasons by content: equal literals needn't share storage
+    return abort_telemetry_top<hot_reason>(recs, n,
+        [](const record& a, const record& b) {
+            int c = strcmp(a.reason ? a.reason : "", b.reason ? b.reason : "");
+            return c < 0 || (c == 0 && a.phase < b.phase);
+        },
+        [](const record& r, uint64_t count) {
+            return hot_reason{r.reason, r.phase, count};
+        });
+}
+
+void AbortTelemetry::clear() {
+    for (int i = 0; i != TThread::id_limit(); ++i)
+        if (ring* r = Transaction::tinfo[i].aborts.ring_)
+            r->head = 0;
+}
+
+const char* AbortTelemetry::phase_name(unsigned phase) {
+    static const char* const names[] = {
+        "in-progress", "opacity", "commit lock", "commit check"
+    };
+    return phase < ph_nphases ? names[phase] : "unknown";
+}
+
+void AbortTelemetry::print(FILE* f, unsigned n) {
+    fprintf(f, "$ %zu sampled aborts (1 in %u)\n", snapshot().size(), sample_period);
+    for (auto& r : top_reasons(n))
+        fprintf(f, "$   %8" PRIu64 " %s (%s)\n", r.count,
+                r.reason ? r.reason : "unspecified", phase_name(r.phase));
+    for (auto& o : top_owners(n))
+        fprintf(f, "$   %8" PRIu64 " object %p\n", o.count, (const void*) o.owner);
+    for (auto& k : top_keys(n))
+        fprintf(f, "$   %8" PRIu64 " object %p key %#" PRIxPTR "\n", k.count,
+                (const void*) k.owner, k.key);
+}
 
 // reserve TransactionTid::increment_value for prepopulated
 uint128_t __attribute__((aligned(128))) Transaction::_GCLKS = {2 * TransactionTid::increment_value, Sto::invalid_snapshot};
@@ -20,58 +185,244 @@ static void __attribute__((used)) check_static_assertions() {
 void Transaction::initialize() {
     static_assert(tset_initial_capacity % tset_chunk == 0, "tset_initial_capacity not an even multiple of tset_chunk");
     hash_base_ = 32768;
+#if TRANSACTION_HASHTABLE
+    index_ = nullptr;
+    index_mask_ = 0;
+    index_active_ = false;
+#endif
     tset_size_ = 0;
     lrng_state_ = 12897;
+    tset_dir_size_ = tset_initial_dir_size;
+    tset_ = new TransItem*[tset_dir_size_];
     for (unsigned i = 0; i != tset_initial_capacity / tset_chunk; ++i)
         tset_[i] = &tset0_[i * tset_chunk];
-    for (unsigned i = tset_initial_capacity / tset_chunk; i != arraysize(tset_); ++i)
+    for (unsigned i = tset_initial_capacity / tset_chunk; i != tset_dir_size_; ++i)
         tset_[i] = nullptr;
+    writeset_ = nullptr;
+    writeset_capacity_ = 0;
+    protect_size_ = undo_floor_ = 0;
+    nested_depth_ = nguards_ = 0;
 }
 
 Transaction::~Transaction() {
     if (in_progress())
         silent_abort();
     TransItem* live = tset0_;
-    for (unsigned i = 0; i != arraysize(tset_); ++i, live += tset_chunk)
+    for (unsigned i = 0; i != tset_dir_size_; ++i, live += tset_chunk)
         if (live != tset_[i])
             delete[] tset_[i];
+    delete[] tset_;
+    delete[] writeset_;
+#if TRANSACTION_HASHTABLE
+    delete[] index_;
+#endif
 }
 
 void Transaction::refresh_tset_chunk() {
     assert(tset_size_ % tset_chunk == 0);
-    assert(tset_size_ < tset_max_capacity);
-    if (!tset_[tset_size_ / tset_chunk])
-        tset_[tset_size_ / tset_chunk] = new TransItem[tset_chunk];
-    tset_next_ = tset_[tset_size_ / tset_chunk];
+    unsigned ci = tset_size_ / tset_chunk;
+    // keep a spare directory entry: stop() forms
+    // &tset_[tset_size_ / tset_chunk][...] for a full tset
+    if (ci + 1 >= tset_dir_size_) {
+        TransItem** dir = new TransItem*[2 * tset_dir_size_];
+        memcpy(dir, tset_, sizeof(TransItem*) * tset_dir_size_);
+        memset(dir + tset_dir_size_, 0, sizeof(TransItem*) * tset_dir_size_);
+        delete[] tset_;
+        tset_ = dir;
+        tset_dir_size_ *= 2;
+    }
+    if (!tset_[ci])
+        tset_[ci] = new TransItem[tset_chunk];
+    tset_next_ = tset_[ci];
 }
 
+unsigned* Transaction::writeset_buffer() {
+    if (tset_size_ >= writeset_capacity_) {
+        delete[] writeset_;
+        writeset_capacity_ = std::max(2 * writeset_capacity_, tset_size_ + 1);
+        writeset_ = new unsigned[writeset_capacity_];
+    }
+    return writeset_;
+}
+
+#if TRANSACTION_HASHTABLE
+// Adds item `tidx` to the growable index, (re)building the index from the
+// whole tset when it is first used or gets more than half full.
+void Transaction::index_item(unsigned tidx) {
+    if (!index_active_ || 2 * tset_size_ > index_mask_ + 1) {
+        unsigned cap = index_active_ ? 2 * (index_mask_ + 1) : 4 * index_threshold;
+        while (2 * tset_size_ > cap)
+            cap *= 2;
+        if (cap > index_mask_ + 1 || !index_) {
+            delete[] index_;
+            index_ = new uint32_t[cap];
+            index_mask_ = cap - 1;
+        }
+        memset(index_, 0, sizeof(uint32_t) * (index_mask_ + 1));
+        index_active_ = true;
+        tidx = 0;
+    }
+    // insert in tset order so the first of any duplicate items is found
+    for (; tidx != tset_size_; ++tidx) {
+        TransItem* ti = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+        unsigned hi = index_hash(ti->owner(), ti->key_) & index_mask_;
+        while (index_[hi])
+            hi = (hi + 1) & index_mask_;
+        index_[hi] = tidx + 1;
+    }
+}
+
+void Transaction::clear_index() {
+    memset(index_, 0, sizeof(uint32_t) * (index_mask_ + 1));
+    index_active_ = false;
+}
+#endif
+
 void* Transaction::epoch_advancer(void*) {
     static int num_epoch_advancers = 0;
     if (fetch_and_add(&num_epoch_advancers, 1) != 0)
         std::cerr << "WARNING: more than one epoch_advancer thread\n";
 
-    // don't bother epoch'ing til things have picked up
-    usleep(100000);
     while (global_epochs.run) {
-        epoch_type g = global_epochs.global_epoch;
-        epoch_type e = g;
-        for (auto& t : tinfo) {
-            if (t.epoch != 0 && signed_epoch_type(t.epoch - e) < 0)
-                e = t.epoch;
-        }
-        global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
-        global_epochs.active_epoch = e;
-        global_epochs.recent_tid = Transaction::_GCLKS._TID;
-
-        if (epoch_advance_callback)
-            epoch_advance_callback(global_epochs.global_epoch);
-
-        usleep(100000);
+        if (!epoch_pending_threshold && !epoch_pending_bytes_threshold)
+            usleep(epoch_interval);
+        else
+            for (unsigned waited = 0; waited < epoch_interval; ) {
+                unsigned step = std::min(std::max(epoch_poll_interval, 1U), epoch_interval - waited);
+                usleep(step);
+                waited += step;
+                if (epoch_pending_over_threshold()) {
+                    ++epoch_early_advances;
+                    break;
+                }
+            }
+        if (global_epochs.run)
+            advance_epoch();
     }
     fetch_and_add(&num_epoch_advancers, -1);
     return NULL;
 }
 
+void Transaction::advance_epoch() {
+    // serializes the advancer with epoch_sync()
+    while (epoch_advance_lock || !bool_cmpxchg(&epoch_advance_lock, false, true))
+        relax_fence();
+    epoch_type g = global_epochs.global_epoch;
+    epoch_type e = g;
+    for (int i = 0; i != TThread::id_limit(); ++i) {
+        epoch_type te = tinfo[i].epoch;
+        if (te != 0 && signed_epoch_type(te - e) < 0)
+            e = te;
+    }
+    global_epochs.global_epoch = std::max(g + 1, epoch_type(1));
+    global_epochs.active_epoch = e;
+    global_epochs.recent_tid = opacity_tid();
+
+    epoch_hooks.call(global_epochs.global_epoch);
+    release_fence();
+    epoch_advance_lock = false;
+    TThread::clean_free_slots(e);
+}
+
+bool Transaction::epoch_pending_over_threshold() {
+    return (epoch_pending_threshold && rcu_pending() >= epoch_pending_threshold)
+        || (epoch_pending_bytes_threshold && rcu_pending_bytes() >= epoch_pending_bytes_threshold);
+}
+
+size_t Transaction::rcu_pending() {
+    size_t n = 0;
+    for (int i = 0; i != TThread::id_limit(); ++i)
+        n += tinfo[i].rcu_set.pending();
+    return n;
+}
+
+size_t Transaction::rcu_pending_bytes() {
+    size_t bytes = 0;
+    for (int i = 0; i != TThread::id_limit(); ++i)
+        bytes += tinfo[i].rcu_set.pending_bytes();
+    return bytes;
+}
+
+TRcuPool::class_stats Transaction::pool_stats_combined(unsigned size_class) {
+    TRcuPool::class_stats s = TRcuPool::class_stats();
+    for (int i = 0; i != TThread::id_limit(); ++i)
+        s.add(tinfo[i].pool.stats(size_class));
+    return s;
+}
+
+Transaction::epoch_type Transaction::epoch_sync() {
+    assert(!TThread::txn || !TThread::txn->in_progress());
+    rcu_quiesce();
+    // the first advance moves new transactions past the current epoch;
+    // the second makes that epoch inactive if nobody is still in it
+    advance_epoch();
+    advance_epoch();
+    epoch_type e = global_epochs.active_epoch;
+    tinfo[TThread::id()].rcu_set.clean_until(e);
+    return e;
+}
+
+void TThread::raise_id_limit(int id) {
+    int limit;
+    while ((limit = id_limit_) <= id
+           && !bool_cmpxchg(&id_limit_, limit, id + 1))
+        relax_fence();
+}
+
+void TThread::claim_slot(int id) {
+    int state;
+    while ((state = slot_state_[id]) != slot_set) {
+        always_assert(state != slot_registered && "set_id() on a registered thread's slot");
+        if (state == slot_free && bool_cmpxchg(&slot_state_[id], slot_free, slot_set))
+            break;
+        relax_fence();
+    }
+}
+
+int TThread::register_thread() {
+    for (int id = 0; id != MAX_THREADS; ++id)
+        if (slot_state_[id] == slot_free
+            && bool_cmpxchg(&slot_state_[id], slot_free, slot_registered)) {
+            registered_id_ = id;
+            set_id(id);
+            Sto::update_threadid();
+            return id;
+        }
+    always_assert(false && "no free thread slots");
+    return -1;
+}
+
+void TThread::unregister_thread() {
+    int id = registered_id_;
+    assert(id >= 0 && slot_state_[id] == slot_registered);
+    assert(!txn || !txn->in_progress());
+    // a quiesced slot never holds back the active epoch; its leftover RCU
+    // garbage is freed by clean_free_slots() or the slot's next owner
+    Transaction::tinfo[id].epoch = 0;
+    // the slot's next owner must not run this thread's hooks
+    Transaction::tinfo[id].start_hooks.clear();
+    Transaction::tinfo[id].end_hooks.clear();
+    registered_id_ = -1;
+    release_fence();
+    slot_state_[id] = slot_free;
+}
+
+void TThread::clean_free_slots(uint64_t max_epoch) {
+    int my_id = the_id;
+    for (int id = 0; id != id_limit_; ++id)
+        if (slot_state_[id] == slot_free
+            && Transaction::tinfo[id].rcu_set.pending()
+            && bool_cmpxchg(&slot_state_[id], slot_free, slot_draining)) {
+            // callbacks recycle into the running thread's pool, so run
+            // them as the slot's owner
+            the_id = id;
+            Transaction::tinfo[id].rcu_set.clean_until(max_epoch);
+            release_fence();
+            slot_state_[id] = slot_free;
+        }
+    the_id = my_id;
+}
+
 bool Transaction::preceding_duplicate_read(TransItem* needle) const {
     const TransItem* it = nullptr;
     for (unsigned tidx = 0; ; ++tidx) {
@@ -84,6 +435,193 @@ bool Transaction::preceding_duplicate_read(TransItem* needle) const {
     }
 }
 
+unsigned Transaction::item_index(const TransItem* ti) const {
+    for (unsigned ci = 0; ci * tset_chunk < tset_size_; ++ci)
+        if (ti >= tset_[ci] && ti < tset_[ci] + tset_chunk)
+            return ci * tset_chunk + (ti - tset_[ci]);
+    return tset_size_;
+}
+
+void Transaction::protect_item(TransItem* ti) const {
+    unsigned tidx = item_index(ti);
+    if (tidx < protect_size_
+        && (undo_.size() == undo_floor_ || undo_.back().tidx != tidx))
+        undo_.push_back(undo_entry{tidx, *ti});
+}
+
+Transaction::savepoint_type Transaction::savepoint() {
+    assert(state_ == s_in_progress);
+    savepoint_type sp{tset_size_, unsigned(undo_.size()), protect_size_, undo_floor_,
+                      any_writes_, any_nonopaque_, may_duplicate_items_, buf_.mark()};
+    protect_size_ = tset_size_;
+    undo_floor_ = undo_.size();
+    return sp;
+}
+
+void Transaction::rollback_to(const savepoint_type& sp) {
+    assert(state_ == s_in_progress && sp.tset_size <= tset_size_
+           && sp.undo_size <= undo_.size());
+    for (unsigned tidx = tset_size_; tidx != sp.tset_size; ) {
+        --tidx;
+        TransItem* it = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+        if (it->has_write())
+            it->owner()->cleanup(*it, false);
+#if TRANSACTION_HASHTABLE
+        if (tidx < index_threshold) {
+            unsigned hi = hash(it->owner(), it->key_);
+            for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
+                if (hashtable_[hi] == hash_base_ + tidx + 1) {
+                    hashtable_[hi] = 0;
+                    break;
+                }
+                hi = (hi + hash_step) % hash_size;
+            }
+        }
+#endif
+    }
+    // newest first, so each item ends up with its oldest copy
+    while (undo_.size() != sp.undo_size) {
+        undo_entry& u = undo_.back();
+        tset_[u.tidx / tset_chunk][u.tidx % tset_chunk] = u.item;
+        undo_.pop_back();
+    }
+    tset_size_ = sp.tset_size;
+    if (tset_size_ % tset_chunk || !tset_size_)
+        tset_next_ = &tset_[tset_size_ / tset_chunk][tset_size_ % tset_chunk];
+    else
+        tset_next_ = tset_[tset_size_ / tset_chunk - 1] + tset_chunk;
+#if TRANSACTION_HASHTABLE
+    if (index_active_) {
+        if (tset_size_ > index_threshold) {
+            index_active_ = false;
+            index_item(0);
+        } else
+            clear_index();
+    }
+#endif
+    buf_.rollback(sp.buf);
+    any_writes_ = sp.any_writes;
+    any_nonopaque_ = sp.any_nonopaque;
+    may_duplicate_items_ = sp.may_duplicate_items;
+    protect_size_ = sp.tset_size;
+    undo_floor_ = sp.undo_size;
+    abort_item_ = nullptr;
+    abort_reason_ = nullptr;
+}
+
+void Transaction::release_savepoint(const savepoint_type& sp) {
+    assert(undo_floor_ == sp.undo_size || state_ != s_in_progress);
+    protect_size_ = sp.parent_protect_size;
+    undo_floor_ = sp.parent_undo_floor;
+}
+
+// Runs closures [first, last) as one transaction, each from its own
+// savepoint, and tries to commit it. Closures to run alone are appended
+// to `deferred`. Returns false, leaving `deferred` unchanged, if the
+// group aborted.
+bool Transaction::run_group(const std::vector<std::function<void()> >& closures,
+                            size_t first, size_t last, std::vector<size_t>& deferred) {
+    size_t ndeferred = deferred.size();
+    start();
+    // abort() leaves the transaction running so we can roll back
+    ++nested_depth_;
+    try {
+        for (size_t i = first; i != last; ++i) {
+            savepoint_type sp = savepoint();
+            for (unsigned tries = 1; ; ++tries) {
+                try {
+                    closures[i]();
+                    break;
+                } catch (Abort&) {
+                    TransItem* blamed = abort_item_;
+                    // a stale read from an earlier closure dooms the group
+                    if (blamed && item_index(blamed) < sp.tset_size)
+                        throw;
+                    rollback_to(sp);
+                    if (!blamed || tries == TransactionLoopGuard::nested_attempts) {
+                        deferred.push_back(i);
+                        break;
+                    }
+                }
+            }
+            release_savepoint(sp);
+        }
+    } catch (Abort&) {
+        --nested_depth_;
+        silent_abort();
+        deferred.resize(ndeferred);
+        return false;
+    } catch (...) {
+        --nested_depth_;
+        silent_abort();
+        throw;
+    }
+    --nested_depth_;
+    if (!try_commit()) {
+        deferred.resize(ndeferred);
+        return false;
+    }
+    return true;
+}
+
+bool Transaction::run_alone(const std::function<void()>& closure) {
+    for (unsigned attempt = 0; attempt != batch_attempts; ++attempt) {
+        if (attempt)
+            retry_backoff();
+        start();
+        try {
+            closure();
+            if (try_commit())
+                return true;
+        } catch (Abort&) {
+        } catch (...) {
+            silent_abort();
+            throw;
+        }
+    }
+    return false;
+}
+
+unsigned Sto::run_batch(const std::vector<std::function<void()> >& closures,
+                        std::vector<bool>* results) {
+    Transaction* t = transaction();
+    always_assert(!t->in_progress());
+    if (results)
+        results->assign(closures.size(), false);
+    size_t group = std::max(Transaction::group_commit_size, 1U);
+    std::vector<size_t> deferred;
+    unsigned ncommitted = 0;
+    for (size_t first = 0; first < closures.size(); first += group) {
+        size_t last = std::min(first + group, closures.size());
+        deferred.clear();
+        bool ok = t->run_group(closures, first, last, deferred);
+        if (!ok) {
+            Transaction::retry_backoff();
+            ok = t->run_group(closures, first, last, deferred);
+        }
+        if (ok) {
+            auto dit = deferred.begin();
+            for (size_t i = first; i != last; ++i)
+                if (dit != deferred.end() && *dit == i)
+                    ++dit;
+                else {
+                    ++ncommitted;
+                    if (results)
+                        (*results)[i] = true;
+                }
+        } else
+            for (size_t i = first; i != last; ++i)
+                deferred.push_back(i);
+        for (size_t i : deferred)
+            if (t->run_alone(closures[i])) {
+                ++ncommitted;
+                if (results)
+                    (*results)[i] = true;
+            }
+    }
+    return ncommitted;
+}
+
 void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
     // ignore opacity checks during commit; we're in the middle of checking
     // things anyway
@@ -96,24 +634,32 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
 
     // die on recursive opacity check; this is only possible for predicates
     if (unlikely(state_ == s_opacity_check)) {
-        mark_abort_because(item, "recursive opacity check", t);
+        // decentralized TIDs are unordered within an epoch, so predicates
+        // revalidated below routinely see versions past start_tid_; they are
+        // rechecked at commit anyway
+        if (decentralized_tids) {
+            any_nonopaque_ = true;
+            return;
+        }
+        mark_abort_because(item, "recursive opacity check", t, AbortTelemetry::ph_opacity);
     abort:
         TXP_INCREMENT(txp_hco_abort);
         abort();
+        return;
     }
     assert(state_ == s_in_progress);
 
     TXP_INCREMENT(txp_hco);
     if (TransactionTid::is_locked_elsewhere(t, threadid_)) {
         TXP_INCREMENT(txp_hco_lock);
-        mark_abort_because(item, "locked", t);
+        mark_abort_because(item, "locked", t, AbortTelemetry::ph_opacity);
         goto abort;
     }
     if (t & TransactionTid::nonopaque_bit)
         TXP_INCREMENT(txp_hco_invalid);
 
     state_ = s_opacity_check;
-    start_tid_ = _GCLKS._TID;
+    start_tid_ = opacity_tid();
     release_fence();
     TransItem* it = nullptr;
     for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
@@ -122,13 +668,15 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
             TXP_INCREMENT(txp_total_check_read);
             if (!it->owner()->check(*it, *this)
                 && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
-                mark_abort_because(item, "opacity check");
+                mark_abort_because(it, "opacity check", 0, AbortTelemetry::ph_opacity);
                 goto abort;
             }
         } else if (it->has_predicate()) {
             TXP_INCREMENT(txp_total_check_predicate);
-            if (!it->owner()->check_predicate(*it, *this, false)) {
-                mark_abort_because(item, "opacity check_predicate");
+            // a non-throwing transaction might abort inside check_predicate
+            if (!it->owner()->check_predicate(*it, *this, false)
+                || unlikely(state_ == s_aborted)) {
+                mark_abort_because(it, "opacity check_predicate", 0, AbortTelemetry::ph_opacity);
                 goto abort;
             }
         }
@@ -137,8 +685,23 @@ void Transaction::hard_check_opacity(TransItem* item, TransactionTid::type t) {
 }
 
 void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
-    if (!committed) {
+    if (committed) {
+        ++tinfo[threadid_].ncommits;
+        ContentionManager::on_commit(tinfo[threadid_].cm);
+    } else {
+        ++tinfo[threadid_].naborts;
+        ContentionManager::on_abort(tinfo[threadid_].cm);
         TXP_INCREMENT(txp_total_aborts);
+        if (AbortTelemetry::enabled) {
+            if (!abort_reason_ && !abort_item_)
+                abort_phase_ = state_ == s_in_progress ? AbortTelemetry::ph_in_progress
+                    : state_ == s_opacity_check ? AbortTelemetry::ph_opacity
+                    : AbortTelemetry::ph_commit_check;
+            AbortTelemetry::on_abort(tinfo[threadid_].aborts, threadid_,
+                                     abort_item_ ? abort_item_->owner() : nullptr,
+                                     abort_item_ ? reinterpret_cast<uintptr_t>(abort_item_->key_) : 0,
+                                     abort_reason_, abort_phase_);
+        }
 #if STO_DEBUG_ABORTS
         if (local_random() <= uint32_t(0xFFFFFFFF * STO_DEBUG_ABORTS_FRACTION)) {
             std::ostringstream buf;
@@ -200,14 +763,97 @@ void Transaction::stop(bool committed, unsigned* writeset, unsigned nwriteset) {
     }
 
 after_unlock:
-    // TODO: this will probably mess up with nested transactions
+    // runs once per transaction: nested TRANSACTION blocks merge into their
+    // parent or roll back to a savepoint (see TransactionLoopGuard), and
+    // only committing or aborting the whole transaction gets here
     threadinfo_t& thr = tinfo[TThread::id()];
-    if (thr.trans_end_callback)
-        thr.trans_end_callback();
-    // XXX should reset trans_end_callback after calling it...
+    if (unlikely(!thr.end_hooks.empty()))
+        thr.end_hooks.call();
     state_ = s_aborted + committed;
 }
 
+// Returns the length of the run of items starting at `tidx` that can be
+// passed to one batch hook: same chunk, and owners of the same dynamic type.
+unsigned Transaction::owner_span(unsigned tidx) const {
+    if (!batch_commit)
+        return 1;
+    const TransItem* it = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+    unsigned n = std::min(tset_size_ - tidx, tset_chunk - tidx % tset_chunk);
+    TObject* owner = it->owner();
+    const std::type_info* type = nullptr;
+    unsigned i = 1;
+    for (; i != n; ++i) {
+        TObject* o = it[i].owner();
+        if (o != owner) {
+            if (!type)
+                type = &typeid(*owner);
+            if (&typeid(*o) != type)
+                break;
+        }
+    }
+    return i;
+}
+
+bool Transaction::lock_span(TransItem* first, TransItem* last) {
+    TransItem* stop;
+    if (last == first + 1)
+        stop = first->owner()->lock(*first, *this) ? last : first;
+    else {
+        TXP_INCREMENT(txp_batch_calls);
+        TXP_ACCOUNT(txp_batch_items, last - first);
+        stop = first->owner()->lock_all(first, last, *this);
+    }
+    for (; first != stop; ++first)
+        if (first->has_write())
+            first->__or_flags(TransItem::lock_bit);
+    if (stop != last) {
+        mark_abort_because(stop, "commit lock", 0, AbortTelemetry::ph_commit_lock);
+        return false;
+    }
+    return true;
+}
+
+bool Transaction::check_span(TransItem* first, TransItem* last) {
+    if (txp_count > txp_total_check_read)
+        for (TransItem* it = first; it != last; ++it)
+            if (it->has_read())
+                TXP_INCREMENT(txp_total_check_read);
+    while (first != last) {
+        TransItem* bad;
+        if (last == first + 1)
+            bad = !first->has_read() || first->owner()->check(*first, *this) ? last : first;
+        else {
+            TXP_INCREMENT(txp_batch_calls);
+            TXP_ACCOUNT(txp_batch_items, last - first);
+            bad = first->owner()->check_all(first, last, *this);
+        }
+        if (bad == last)
+            break;
+        if (!may_duplicate_items_ || !preceding_duplicate_read(bad)) {
+            mark_abort_because(bad, "commit check");
+            return false;
+        }
+        first = bad + 1;
+    }
+    return true;
+}
+
+void Transaction::install_span(TransItem* first, TransItem* last) {
+    if (last == first + 1)
+        first->owner()->install(*first, *this);
+    else {
+        TXP_INCREMENT(txp_batch_calls);
+        TXP_ACCOUNT(txp_batch_items, last - first);
+        first->owner()->install_all(first, last, *this);
+    }
+}
+
+void Transaction::reject_read_only_write(TransItem& item) {
+    mark_abort_because(&item, "write in read-only transaction");
+    silent_abort();
+    throw ReadOnlyViolation();
+}
+
 bool Transaction::try_commit() {
     assert(TThread::id() == threadid_);
 #if ASSERT_TX_SIZE
@@ -224,48 +870,78 @@ bool Transaction::try_commit() {
     if (state_ >= s_aborted)
         return state_ > s_aborted;
 
+    uint64_t tsc_commit = TXH_TIMESTAMP(), tsc_phase = tsc_commit, tsc_now;
+    TXH_RECORD(txh_execution, tsc_commit - start_tsc_);
+
     if (any_nonopaque_)
         TXP_INCREMENT(txp_commit_time_nonopaque);
 #if !CONSISTENCY_CHECK
     // commit immediately if read-only transaction with opacity
     if (!any_writes_ && !any_nonopaque_) {
         stop(true, nullptr, 0);
+        TXH_RECORD(txh_commit, TXH_TIMESTAMP() - tsc_commit);
+        return true;
+    }
+#else
+    // opacity checks already validated every read as it was made
+    if (read_only_ && !any_nonopaque_) {
+        stop(true, nullptr, 0);
+        TXH_RECORD(txh_commit, TXH_TIMESTAMP() - tsc_commit);
         return true;
     }
 #endif
 
     state_ = s_committing;
 
-    unsigned writeset[tset_size_];
+    unsigned* writeset = writeset_buffer();
     unsigned nwriteset = 0;
     writeset[0] = tset_size_;
 
     TransItem* it = nullptr;
-    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-        if (it->has_write()) {
-            writeset[nwriteset++] = tidx;
+    for (unsigned tidx = 0; tidx != tset_size_; ) {
+        TransItem* first = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+        TransItem* last = first + owner_span(tidx);
 #if !STO_SORT_WRITESET
-            if (nwriteset == 1) {
-                first_write_ = writeset[0];
-                state_ = s_committing_locked;
-            }
-            if (!it->owner()->lock(*it, *this)) {
-                mark_abort_because(it, "commit lock");
-                goto abort;
+        // writes in [lock_first, it) are not yet locked
+        TransItem* lock_first = first;
+        bool need_lock = false;
+#endif
+        for (it = first; it != last; ++it, ++tidx) {
+            if (it->has_write()) {
+                writeset[nwriteset++] = tidx;
+#if !STO_SORT_WRITESET
+                if (nwriteset == 1) {
+                    first_write_ = writeset[0];
+                    state_ = s_committing_locked;
+                }
+                need_lock = true;
+#endif
             }
-            it->__or_flags(TransItem::lock_bit);
+            if (it->has_read())
+                TXP_INCREMENT(txp_total_r);
+            else if (it->has_predicate()) {
+#if !STO_SORT_WRITESET
+                // lock earlier writes, and this item, before checking
+                if (need_lock && !lock_span(lock_first, it + 1))
+                    goto abort;
+                lock_first = it + 1;
+                need_lock = false;
 #endif
-        }
-        if (it->has_read())
-            TXP_INCREMENT(txp_total_r);
-        else if (it->has_predicate()) {
-            TXP_INCREMENT(txp_total_check_predicate);
-            if (!it->owner()->check_predicate(*it, *this, true)) {
-                mark_abort_because(it, "commit check_predicate");
-                goto abort;
+                TXP_INCREMENT(txp_total_check_predicate);
+                bool ok = it->owner()->check_predicate(*it, *this, true);
+                // a non-throwing transaction might abort inside check_predicate
+                if (unlikely(state_ == s_aborted))
+                    return false;
+                if (!ok) {
+                    mark_abort_because(it, "commit check_predicate");
+                    goto abort;
+                }
             }
         }
+#if !STO_SORT_WRITESET
+        if (need_lock && !lock_span(lock_first, last))
+            goto abort;
+#endif
     }
 
     first_write_ = writeset[0];
@@ -284,7 +960,7 @@ bool Transaction::try_commit() {
         for (auto it = writeset; it != writeset_end; ) {
             TransItem* me = &tset_[*it / tset_chunk][*it % tset_chunk];
             if (!me->owner()->lock(*me, *this)) {
-                mark_abort_because(me, "commit lock");
+                mark_abort_because(me, "commit lock", 0, AbortTelemetry::ph_commit_lock);
                 goto abort;
             }
             me->__or_flags(TransItem::lock_bit);
@@ -295,24 +971,30 @@ bool Transaction::try_commit() {
 
 
 #if CONSISTENCY_CHECK
-    fence();
-    commit_tid();
-    fence();
+    if (!read_only_) {
+        fence();
+        commit_tid();
+        fence();
+    }
 #endif
 
+    tsc_now = TXH_TIMESTAMP();
+    TXH_RECORD(txh_lock, tsc_now - tsc_phase);
+    tsc_phase = tsc_now;
+
     //phase2
-    for (unsigned tidx = 0; tidx != tset_size_; ++tidx) {
-        it = (tidx % tset_chunk ? it + 1 : tset_[tidx / tset_chunk]);
-        if (it->has_read()) {
-            TXP_INCREMENT(txp_total_check_read);
-            if (!it->owner()->check(*it, *this)
-                && (!may_duplicate_items_ || !preceding_duplicate_read(it))) {
-                mark_abort_because(it, "commit check");
-                goto abort;
-            }
-        }
+    for (unsigned tidx = 0; tidx != tset_size_; ) {
+        it = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+        unsigned n = owner_span(tidx);
+        tidx += n;
+        if (!check_span(it, it + n))
+            goto abort;
     }
 
+    tsc_now = TXH_TIMESTAMP();
+    TXH_RECORD(txh_validate, tsc_now - tsc_phase);
+    tsc_phase = tsc_now;
+
     // fence();
 
     //phase3
@@ -327,19 +1009,25 @@ bool Transaction::try_commit() {
 #else
     if (nwriteset) {
         auto writeset_end = writeset + nwriteset;
-        for (auto idxit = writeset; idxit != writeset_end; ++idxit) {
+        for (auto idxit = writeset; idxit != writeset_end; ) {
             if (likely(*idxit < tset_initial_capacity))
                 it = &tset0_[*idxit];
             else
                 it = &tset_[*idxit / tset_chunk][*idxit % tset_chunk];
-            TXP_INCREMENT(txp_total_w);
-            it->owner()->install(*it, *this);
+            unsigned n = owner_span(*idxit);
+            unsigned tidx_end = *idxit + n;
+            for (; idxit != writeset_end && *idxit < tidx_end; ++idxit)
+                TXP_INCREMENT(txp_total_w);
+            install_span(it, it + n);
         }
     }
 #endif
 
     // fence();
     stop(true, writeset, nwriteset);
+    tsc_now = TXH_TIMESTAMP();
+    TXH_RECORD(txh_install, tsc_now - tsc_phase);
+    TXH_RECORD(txh_commit, tsc_now - tsc_commit);
     return true;
 
 abort:
@@ -349,6 +1037,43 @@ abort:
     return false;
 }
 
+#if STO_LATENCY_HISTOGRAMS
+double Transaction::tsc_per_ns() {
+    static double rate;
+    if (!rate) {
+        struct timespec t0, t1;
+        clock_gettime(CLOCK_MONOTONIC, &t0);
+        uint64_t c0 = read_tsc();
+        do {
+            clock_gettime(CLOCK_MONOTONIC, &t1);
+        } while ((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec) < 10000000);
+        uint64_t c1 = read_tsc();
+        rate = (double) (c1 - c0)
+            / ((t1.tv_sec - t0.tv_sec) * 1000000000LL + (t1.tv_nsec - t0.tv_nsec));
+    }
+    return rate;
+}
+
+void Transaction::print_latency_stats(FILE* f) {
+    static const char* const names[] = {
+        "execution", "lock", "validate", "install", "commit", "retries"
+    };
+    txh_histograms out = txh_histograms_combined();
+    double scale = 1 / tsc_per_ns();
+    for (int h = 0; h != txh_count; ++h) {
+        const log_histogram& x = out.h_[h];
+        if (!x.count())
+            continue;
+        // retries are a count, everything else is time
+        double m = h == txh_retries ? 1 : scale;
+        fprintf(f, "$ %s%s: %llu samples, mean %.1f, p50 %.0f, p99 %.0f, p999 %.0f, max %.0f\n",
+                names[h], h == txh_retries ? "" : " ns", (unsigned long long) x.count(),
+                x.mean() * m, x.percentile(0.5) * m, x.percentile(0.99) * m,
+                x.percentile(0.999) * m, x.max() * m);
+    }
+}
+#endif
+
 void Transaction::print_stats() {
     txp_counters out = txp_counters_combined();
     if (txp_count >= txp_max_set) {
@@ -379,10 +1104,32 @@ void Transaction::print_stats() {
         fprintf(stderr, "$ %llu (%.3f%%) hash collisions, %llu second level\n", out.p(txp_hash_collision),
                 100.0 * (double) out.p(txp_hash_collision) / out.p(txp_hash_find),
                 out.p(txp_hash_collision2));
+    if (txp_count >= txp_max_hash_probe)
+        fprintf(stderr, "$ %.3f item lookup probes per find, %llu max\n",
+                (double) out.p(txp_total_hash_probes) / out.p(txp_hash_find),
+                out.p(txp_max_hash_probe));
     if (txp_count >= txp_total_transbuffer)
         fprintf(stderr, "$ %llu max buffer per txn, %llu total buffer\n",
                 out.p(txp_max_transbuffer), out.p(txp_total_transbuffer));
-    fprintf(stderr, "$ %llu next commit-tid\n", (unsigned long long) _GCLKS._TID);
+    if (txp_count >= txp_batch_items)
+        fprintf(stderr, "$ %llu batch commit calls, %.3f items per call\n",
+                out.p(txp_batch_calls),
+                (double) out.p(txp_batch_items) / out.p(txp_batch_calls));
+    if (txp_count >= txp_cm_backoff_spins)
+        fprintf(stderr, "$ %s contention policy: %llu lock retries, %llu lock give-ups, %llu wait retries, %llu backoffs (%llu spins)\n",
+                ContentionManager::policy_name(ContentionManager::policy),
+                out.p(txp_cm_lock_retries), out.p(txp_cm_lock_giveups),
+                out.p(txp_cm_wait_retries), out.p(txp_cm_backoffs),
+                out.p(txp_cm_backoff_spins));
+    if (AbortTelemetry::enabled)
+        AbortTelemetry::print(stderr, 5);
+#if STO_LATENCY_HISTOGRAMS
+    print_latency_stats(stderr);
+#endif
+    if (decentralized_tids)
+        fprintf(stderr, "$ decentralized commit-tids, epoch %llu\n", (unsigned long long) global_epochs.global_epoch);
+    else
+        fprintf(stderr, "$ %llu next commit-tid\n", (unsigned long long) _GCLKS._TID);
 }
 
 const char* Transaction::state_name(int state) {
@@ -409,6 +1156,26 @@ void Transaction::print() const {
     print(std::cerr);
 }
 
+TransItem* TObject::lock_all(TransItem* first, TransItem* last, Transaction& txn) {
+    for (; first != last; ++first)
+        if (first->has_write() && !first->owner()->lock(*first, txn))
+            break;
+    return first;
+}
+
+TransItem* TObject::check_all(TransItem* first, TransItem* last, Transaction& txn) {
+    for (; first != last; ++first)
+        if (first->has_read() && !first->owner()->check(*first, txn))
+            break;
+    return first;
+}
+
+void TObject::install_all(TransItem* first, TransItem* last, Transaction& txn) {
+    for (; first != last; ++first)
+        if (first->has_write())
+            first->owner()->install(*first, txn);
+}
+
 void TObject::print(std::ostream& w, const TransItem& item) const {
     w << "{" << typeid(*this).name() << " " << (void*) this << "." << item.key<void*>();
     if (item.has_read())
@@ -4,18 +4,28 @@
 #include "compiler.hh"
 #include "small_vector.hh"
 #include "TRcu.hh"
+#include "ContentionManager.hh"
+#include "AbortTelemetry.hh"
+#include "LogHistogram.hh"
 #include <algorithm>
 #include <functional>
 #include <memory>
 #include <type_traits>
+#include <vector>
 #include <unistd.h>
 #include <iostream>
 #include <sstream>
+#include <stdexcept>
 
 #ifndef STO_PROFILE_COUNTERS
 #define STO_PROFILE_COUNTERS 0
 #endif
 
+// per-thread TSC latency histograms (see enum txh)
+#ifndef STO_LATENCY_HISTOGRAMS
+#define STO_LATENCY_HISTOGRAMS 0
+#endif
+
 #ifndef STO_DEBUG_HASH_COLLISIONS
 #define STO_DEBUG_HASH_COLLISIONS 0
 #endif
@@ -34,6 +44,12 @@
 #define STO_SORT_WRITESET 0
 #endif
 
+// default for Transaction::decentralized_tids
+#ifndef STO_DECENTRALIZED_TID
+#define STO_DECENTRALIZED_TID 0
+#endif
+
+// compile-time defaults for ContentionManager
 #ifndef STO_SPIN_EXPBACKOFF
 #define STO_SPIN_EXPBACKOFF 0
 #endif
@@ -69,8 +85,6 @@
 
 #include "config.h"
 
-#define MAX_THREADS 32
-
 // TRANSACTION macros that can be used to wrap transactional code
 #define TRANSACTION                               \
     do {                                          \
@@ -82,12 +96,38 @@
                 if (__txn_guard.try_commit())     \
                     break;                        \
             } catch (Transaction::Abort e) {      \
+                __txn_guard.caught_abort();       \
             }                                     \
             if (!(retry))                         \
                 throw Transaction::Abort();       \
         }                                         \
     } while (0)
 
+// like TRANSACTION, but runs a read-only transaction (see
+// Sto::start_read_only_transaction); finish with RETRY
+#define TRANSACTION_RO                            \
+    do {                                          \
+        TransactionLoopGuard __txn_guard(true);   \
+        while (1) {                               \
+            __txn_guard.start();                  \
+            try {
+
+// non-throwing transactions (see Sto::start_nothrow_transaction). The body
+// may `break` out early once Sto::aborted(). If `retry` is false and the
+// transaction aborts, Sto::aborted() is true after the loop.
+#define TRANSACTION_NOTHROW                       \
+    do {                                          \
+        TransactionLoopGuard __txn_guard(false, true); \
+        while (1) {                               \
+            __txn_guard.start();                  \
+            do {
+#define RETRY_NOTHROW(retry)                      \
+            } while (0);                          \
+            if (__txn_guard.try_commit() || !(retry)) \
+                break;                            \
+        }                                         \
+    } while (0)
+
 // transaction performance counters
 enum txp {
     // all logging levels
@@ -114,6 +154,15 @@ enum txp {
     txp_hash_collision,
     txp_hash_collision2,
     txp_total_searched,
+    txp_total_hash_probes,
+    txp_max_hash_probe,
+    txp_cm_lock_retries,
+    txp_cm_lock_giveups,
+    txp_cm_wait_retries,
+    txp_cm_backoffs,
+    txp_cm_backoff_spins,
+    txp_batch_calls,
+    txp_batch_items,
 #if !STO_PROFILE_COUNTERS
     txp_count = 0
 #elif STO_PROFILE_COUNTERS == 1
@@ -125,7 +174,7 @@ enum txp {
 typedef uint64_t txp_counter_type;
 
 inline constexpr bool txp_is_max(unsigned p) {
-    return p == txp_max_set || p == txp_max_transbuffer;
+    return p == txp_max_set || p == txp_max_transbuffer || p == txp_max_hash_probe;
 }
 
 template <unsigned P, unsigned N, bool Less = (P < N)> struct txp_helper;
@@ -163,6 +212,29 @@ struct txp_counters {
     }
 };
 
+// transaction latency histograms; times are in TSC cycles
+enum txh {
+    txh_execution = 0,  // start to try_commit
+    txh_lock,           // commit phase 1: lock writes, check predicates
+    txh_validate,       // commit phase 2: check reads
+    txh_install,        // commit phase 3 and unlock
+    txh_commit,         // all of a successful try_commit
+    txh_retries,        // aborted attempts per committed TRANSACTION loop
+#if STO_LATENCY_HISTOGRAMS
+    txh_count
+#else
+    txh_count = 0
+#endif
+};
+
+struct txh_histograms {
+    log_histogram h_[txh_count + (txh_count == 0)];
+    void reset() {
+        for (unsigned i = 0; i != txh_count; ++i)
+            h_[i].clear();
+    }
+};
+
 
 #include "Interface.hh"
 #include "TransItem.hh"
@@ -170,17 +242,93 @@ struct txp_counters {
 void reportPerf();
 #define STO_SHUTDOWN() reportPerf()
 
+// A small fixed list of hooks, each a plain function pointer plus
+// context, called in registration order. Adding an existing
+// (function, context) pair is a no-op. Only one thread may modify a
+// list at a time; call() may run concurrently with add().
+template <typename... Args>
+class trans_hook_list {
+public:
+    typedef void (*function_type)(void*, Args...);
+    static constexpr unsigned capacity = 8;
+
+    trans_hook_list()
+        : n_(0) {
+    }
+
+    bool empty() const {
+        return n_ == 0;
+    }
+    unsigned size() const {
+        return n_;
+    }
+    bool add(function_type f, void* context) {
+        unsigned n = n_;
+        for (unsigned i = 0; i != n; ++i)
+            if (h_[i].f == f && h_[i].context == context)
+                return true;
+        if (n == capacity)
+            return false;
+        h_[n].f = f;
+        h_[n].context = context;
+        release_fence();
+        n_ = n + 1;
+        return true;
+    }
+    bool remove(function_type f, void* context) {
+        unsigned n = n_;
+        for (unsigned i = 0; i != n; ++i)
+            if (h_[i].f == f && h_[i].context == context) {
+                for (; i + 1 != n; ++i)
+                    h_[i] = h_[i + 1];
+                n_ = n - 1;
+                return true;
+            }
+        return false;
+    }
+    void clear() {
+        n_ = 0;
+    }
+    void call(Args... args) const {
+        unsigned n = n_;
+        acquire_fence();
+        for (unsigned i = 0; i != n; ++i)
+            h_[i].f(h_[i].context, args...);
+    }
+
+private:
+    struct hook {
+        function_type f;
+        void* context;
+    };
+    volatile unsigned n_;
+    hook h_[capacity];
+};
+
 struct __attribute__((aligned(128))) threadinfo_t {
     using epoch_type = TRcuSet::epoch_type;
     epoch_type epoch;
+    // while nonzero, start() leaves epoch to the InterleavedExecutor
+    unsigned epoch_pins;
+    // declared before rcu_set, which may recycle into it when destroyed
+    TRcuPool pool;
     TRcuSet rcu_set;
-    // XXX(NH): these should be vectors so multiple data structures can register
-    // callbacks for these
-    std::function<void(void)> trans_start_callback;
-    std::function<void(void)> trans_end_callback;
+    // see Transaction::add_start_hook
+    trans_hook_list<> start_hooks;
+    trans_hook_list<> end_hooks;
+    // last commit TID handed out in decentralized TID mode
+    TransactionTid::type last_commit_tid;
+    // always maintained, for StoStats
+    uint64_t ncommits;
+    uint64_t naborts;
+    ContentionManager::thread_state cm;
+    AbortTelemetry::thread_state aborts;
     txp_counters p_;
+#if STO_LATENCY_HISTOGRAMS
+    txh_histograms h_;
+#endif
     threadinfo_t()
-        : epoch(0) {
+        : epoch(0), epoch_pins(0), last_commit_tid(0), ncommits(0), naborts(0) {
     }
 };
 
@@ -197,10 +345,16 @@ public:
 
     static constexpr unsigned hash_size = 1024;
     static constexpr unsigned hash_step = 5;
+    // transactions with more items than this are looked up through a
+    // growable open-addressing index instead of hashtable_
+    static constexpr unsigned index_threshold = hash_size / 2;
 
     static constexpr TransactionTid::type disable_snapshot = 0;
     static constexpr TransactionTid::type invalid_snapshot = 0;
 
+    // in decentralized TID mode, the epoch lives in the high TID bits
+    static constexpr unsigned tid_epoch_shift = 32;
+
     using epoch_type = TRcuSet::epoch_type;
     using signed_epoch_type = TRcuSet::signed_epoch_type;
 
@@ -212,15 +366,76 @@ public:
         bool run;
     } global_epochs;
     typedef TransactionTid::type tid_type;
+
+    // Commit TID mode. By default commit TIDs come from a global clock
+    // (_GCLKS) bumped with fetch-and-add on every writing commit. When
+    // decentralized_tids is set, a commit TID is instead computed locally,
+    // Silo-style: it exceeds every version the transaction observed or
+    // locked and the thread's previous commit TID, and is at least the
+    // current epoch shifted into the high bits. Versions stay strictly
+    // increasing per item as long as data structures lock through
+    // Transaction::try_lock. Opacity is checked against the epoch the
+    // transaction started in rather than the clock, so any version
+    // installed in the current epoch forces a hard opacity check, and
+    // predicates rechecked during a hard opacity check are not themselves
+    // opacity-checked (they are still verified at commit).
+    // Sto::take_snapshot() is unsupported in this mode. Only change the
+    // mode while no transactions are running.
+    static bool decentralized_tids;
+
+    // If set, try_commit groups runs of items whose owners share a
+    // dynamic type and hands each run to the TObject batch hooks.
+    static bool batch_commit;
+
+    // Sto::run_batch commits up to this many closures as one transaction.
+    static unsigned group_commit_size;
+    // attempts a closure gets on its own before run_batch reports failure
+    static constexpr unsigned batch_attempts = 16;
+
+    static tid_type epoch_tid(epoch_type e) {
+        return tid_type(e) << tid_epoch_shift;
+    }
+    // Versions below this TID were installed by transactions whose commit
+    // TIDs were assigned before this call.
+    static tid_type opacity_tid() {
+        if (decentralized_tids)
+            return epoch_tid(global_epochs.global_epoch);
+        else
+            return _GCLKS._TID;
+    }
 private:
     static uint128_t _GCLKS;
 public:
 
-    static std::function<void(threadinfo_t::epoch_type)> epoch_advance_callback;
+    // Hooks run by the epoch advancer after each advance, with the new
+    // global epoch. Remove epoch hooks only while no advancer runs.
+    static trans_hook_list<threadinfo_t::epoch_type> epoch_hooks;
+    static bool add_epoch_hook(void (*f)(void*, epoch_type), void* context) {
+        return epoch_hooks.add(f, context);
+    }
+    static bool remove_epoch_hook(void (*f)(void*, epoch_type), void* context) {
+        return epoch_hooks.remove(f, context);
+    }
+    // Hooks run on the calling thread at the start and end (commit or
+    // abort) of each of its transactions. Each thread registers its own;
+    // TThread::unregister_thread() drops them. Return false if the
+    // thread's list is full.
+    static bool add_start_hook(void (*f)(void*), void* context) {
+        return tinfo[TThread::id()].start_hooks.add(f, context);
+    }
+    static bool add_end_hook(void (*f)(void*), void* context) {
+        return tinfo[TThread::id()].end_hooks.add(f, context);
+    }
+    static bool remove_start_hook(void (*f)(void*), void* context) {
+        return tinfo[TThread::id()].start_hooks.remove(f, context);
+    }
+    static bool remove_end_hook(void (*f)(void*), void* context) {
+        return tinfo[TThread::id()].end_hooks.remove(f, context);
+    }
 
     static txp_counters txp_counters_combined() {
         txp_counters out;
-        for (int i = 0; i != MAX_THREADS; ++i)
+        for (int i = 0; i != TThread::id_limit(); ++i)
             for (int p = 0; p != txp_count; ++p) {
                 if (txp_is_max(p))
                     out.p_[p] = std::max(out.p_[p], tinfo[i].p_.p_[p]);
@@ -230,23 +445,80 @@ public:
         return out;
     }
 
+#if STO_LATENCY_HISTOGRAMS
+    static txh_histograms txh_histograms_combined() {
+        txh_histograms out;
+        for (int i = 0; i != TThread::id_limit(); ++i)
+            for (int h = 0; h != txh_count; ++h)
+                out.h_[h].merge(tinfo[i].h_.h_[h]);
+        return out;
+    }
+    template <unsigned H> static void txh_record(uint64_t v) {
+        tinfo[TThread::id()].h_.h_[H].add(v);
+    }
+    static uint64_t txh_timestamp() {
+        return read_tsc();
+    }
+#else
+    static txh_histograms txh_histograms_combined() {
+        return txh_histograms();
+    }
+    template <unsigned H> static void txh_record(uint64_t) {
+    }
+    static uint64_t txh_timestamp() {
+        return 0;
+    }
+#endif
+
+#define TXH_RECORD(h, v) Transaction::txh_record<(h)>((v))
+#define TXH_TIMESTAMP() Transaction::txh_timestamp()
+
     static void print_stats();
+#if STO_LATENCY_HISTOGRAMS
+    static void print_latency_stats(FILE* f);
+    // TSC ticks per nanosecond, measured on first call
+    static double tsc_per_ns();
+#endif
 
     static void clear_stats() {
-        for (int i = 0; i != MAX_THREADS; ++i)
+        for (int i = 0; i != TThread::id_limit(); ++i) {
             tinfo[i].p_.reset();
+#if STO_LATENCY_HISTOGRAMS
+            tinfo[i].h_.reset();
+#endif
+        }
     }
 
+    // Epoch advancer tuning, in microseconds. The advancer bumps the
+    // epoch every epoch_interval. If either pending threshold is nonzero,
+    // it also checks every epoch_poll_interval and advances early once the
+    // RCU callbacks pending across all threads, or their estimated bytes,
+    // reach the threshold.
+    static unsigned epoch_interval;
+    static unsigned epoch_poll_interval;
+    static size_t epoch_pending_threshold;
+    static size_t epoch_pending_bytes_threshold;
+    static uint64_t epoch_early_advances;
+
     static void* epoch_advancer(void*);
+    // Advance the epoch now and clean the calling thread's RCU set. Call
+    // outside any transaction; the calling thread is quiesced. Afterwards,
+    // callbacks registered before the call are reclaimable once every
+    // other thread has started a new transaction or quiesced. Returns the
+    // new active epoch.
+    static epoch_type epoch_sync();
+    static size_t rcu_pending();
+    static size_t rcu_pending_bytes();
+
     template <typename T>
     static void rcu_delete(T* x) {
         auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free, x);
+        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free, x, sizeof(T));
     }
     template <typename T>
     static void rcu_delete_array(T* x) {
         auto& thr = tinfo[TThread::id()];
-        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free_array, x);
+        thr.rcu_set.add(thr.epoch, ObjectDestroyer<T>::destroy_and_free_array, x, sizeof(T));
     }
     static void rcu_free(void* ptr) {
         auto& thr = tinfo[TThread::id()];
@@ -259,6 +531,85 @@ public:
     static void rcu_quiesce() {
         tinfo[TThread::id()].epoch = 0;
     }
+    // Like rcu_free, but tagged with the current global epoch rather than
+    // the thread's, which is stale outside a transaction and may predate
+    // readers that started later. For memory unlinked from a structure
+    // that non-transactional operations also walk.
+    static void rcu_free_current(void* ptr) {
+        tinfo[TThread::id()].rcu_set.add(global_epochs.global_epoch, ::free, ptr);
+    }
+
+    // Holds the calling thread's epoch for the length of a
+    // non-transactional operation, so RCU memory it reaches is not freed
+    // under it. Does nothing if the thread's epoch is already set: a
+    // stale epoch holds back reclamation just as well.
+    class epoch_guard {
+    public:
+        epoch_guard()
+            : thr_(tinfo[TThread::id()]), set_(!thr_.epoch) {
+            if (set_) {
+                thr_.epoch = global_epochs.global_epoch;
+                fence();
+            }
+        }
+        ~epoch_guard() {
+            if (set_)
+                thr_.epoch = 0;
+        }
+    private:
+        threadinfo_t& thr_;
+        bool set_;
+    };
+
+    // Allocation from the calling thread's TRcuPool. Memory freed through
+    // rcu_pool_delete/rcu_pool_free is recycled into the pool of the
+    // thread that freed it once the grace period ends, so steady-state
+    // churn of same-sized objects does not reach malloc.
+    static void* pool_allocate(size_t size) {
+        return tinfo[TThread::id()].pool.allocate(size);
+    }
+    static void pool_free(void* p, size_t size) {
+        tinfo[TThread::id()].pool.free(p, size);
+    }
+    template <typename T, typename... Args>
+    static T* pool_new(Args&&... args) {
+        static_assert(alignof(T) <= alignof(max_align_t), "pool_new alignment");
+        return new(pool_allocate(sizeof(T))) T(std::forward<Args>(args)...);
+    }
+    // destroy x and recycle its memory after the grace period
+    template <typename T>
+    static void rcu_pool_delete(T* x) {
+        auto& thr = tinfo[TThread::id()];
+        thr.rcu_set.add(thr.epoch, pool_destroy_and_recycle<T>, x, sizeof(T));
+    }
+    // recycle x's memory after the grace period without destroying it
+    template <typename T>
+    static void rcu_pool_free(T* x) {
+        auto& thr = tinfo[TThread::id()];
+        thr.rcu_set.add(thr.epoch, pool_recycle<T>, x, sizeof(T));
+    }
+    // rcu_pool_delete tagged with the current global epoch (see
+    // rcu_free_current)
+    template <typename T>
+    static void rcu_pool_delete_current(T* x) {
+        tinfo[TThread::id()].rcu_set.add(global_epochs.global_epoch,
+                                         pool_destroy_and_recycle<T>, x, sizeof(T));
+    }
+    static TRcuPool::class_stats pool_stats_combined(unsigned size_class);
+
+private:
+    template <typename T>
+    static void pool_destroy_and_recycle(void* x) {
+        reinterpret_cast<T*>(x)->~T();
+        pool_free(x, sizeof(T));
+    }
+    template <typename T>
+    static void pool_recycle(void* x) {
+        pool_free(x, sizeof(T));
+    }
+    static void advance_epoch();
+    static bool epoch_pending_over_threshold();
+public:
 
 #if STO_PROFILE_COUNTERS
     template <unsigned P> static void txp_account(txp_counter_type n) {
@@ -275,7 +626,8 @@ public:
 
 private:
     static constexpr unsigned tset_chunk = 512;
-    static constexpr unsigned tset_max_capacity = 32768;
+    // initial number of chunk pointers in tset_; grows on demand
+    static constexpr unsigned tset_initial_dir_size = 64;
 
     void initialize();
 
@@ -308,11 +660,17 @@ private:
         //if (isAborted_
         //   && tinfo[TThread::id()].p(txp_total_aborts) % 0x10000 == 0xFFFF)
            //print_stats();
-        thr.epoch = global_epochs.global_epoch;
+        if (likely(!thr.epoch_pins))
+            thr.epoch = global_epochs.global_epoch;
         thr.rcu_set.clean_until(global_epochs.active_epoch);
-        if (thr.trans_start_callback)
-            thr.trans_start_callback();
-        hash_base_ += tset_size_ + 1;
+        if (unlikely(!thr.start_hooks.empty()))
+            thr.start_hooks.call();
+#if TRANSACTION_HASHTABLE
+        // hashtable_ only ever holds the first index_threshold items
+        hash_base_ += std::min(tset_size_, unsigned(index_threshold)) + 1;
+        if (unlikely(index_active_))
+            clear_index();
+#endif
         tset_size_ = 0;
         tset_next_ = tset0_;
 #if TRANSACTION_HASHTABLE
@@ -322,17 +680,22 @@ private:
         }
 #endif
         any_writes_ = any_nonopaque_ = may_duplicate_items_ = false;
+        read_only_ = nothrow_ = false;
         first_write_ = 0;
         start_tid_ = commit_tid_ = 0;
+        max_observed_tid_ = 0;
         gsc_snapshot_ = invalid_snapshot;
         active_sid_ = disable_snapshot;
         buf_.clear();
-#if STO_DEBUG_ABORTS
+        protect_size_ = undo_floor_ = 0;
+        undo_.clear();
         abort_item_ = nullptr;
         abort_reason_ = nullptr;
+#if STO_DEBUG_ABORTS
         abort_version_ = 0;
 #endif
         TXP_INCREMENT(txp_total_starts);
+        start_tsc_ = TXH_TIMESTAMP();
         state_ = s_in_progress;
     }
 
@@ -343,9 +706,18 @@ private:
         //2654435761
         return (n + (n >> 16) * 9) % hash_size;
     }
+    static unsigned index_hash(const TObject* obj, void* key) {
+        uint64_t n = reinterpret_cast<uintptr_t>(key)
+            ^ (reinterpret_cast<uintptr_t>(obj) >> 4) * 0x9E3779B97F4A7C15ULL;
+        return (n * 0xC2B2AE3D27D4EB4FULL) >> 32;
+    }
+
+    void index_item(unsigned tidx);
+    void clear_index();
 #endif
 
     void refresh_tset_chunk();
+    unsigned* writeset_buffer();
 
     TransItem* allocate_item(const TObject* obj, void* xkey) {
         if (tset_size_ && tset_size_ % tset_chunk == 0)
@@ -353,13 +725,17 @@ private:
         ++tset_size_;
         new(reinterpret_cast<void*>(tset_next_)) TransItem(const_cast<TObject*>(obj), xkey);
 #if TRANSACTION_HASHTABLE
-        unsigned hi = hash(obj, xkey);
+        if (unlikely(tset_size_ > index_threshold))
+            index_item(tset_size_ - 1);
+        else {
+            unsigned hi = hash(obj, xkey);
 # if TRANSACTION_HASHTABLE > 1
-        if (hashtable_[hi] > hash_base_)
-            hi = (hi + hash_step) % hash_size;
+            if (hashtable_[hi] > hash_base_)
+                hi = (hi + hash_step) % hash_size;
 # endif
-        if (hashtable_[hi] <= hash_base_)
-            hashtable_[hi] = hash_base_ + tset_size_;
+            if (hashtable_[hi] <= hash_base_)
+                hashtable_[hi] = hash_base_ + tset_size_;
+        }
 #endif
         return tset_next_++;
     }
@@ -391,6 +767,8 @@ public:
         TransItem* ti = find_item(const_cast<TObject*>(obj), xkey);
         if (!ti)
             ti = allocate_item(obj, xkey);
+        else if (unlikely(protect_size_))
+            protect_item(ti);
         return TransProxy(*this, *ti);
     }
 
@@ -406,6 +784,8 @@ public:
             may_duplicate_items_ = tset_size_ > 0;
         if (!ti)
             ti = allocate_item(obj, xkey);
+        else if (unlikely(protect_size_))
+            protect_item(ti);
         return TransProxy(*this, *ti);
     }
 
@@ -413,16 +793,45 @@ public:
     OptionalTransProxy check_item(const TObject* obj, T key) const {
         void* xkey = Packer<T>::pack_unique(buf_, std::move(key));
         TransItem* ti = find_item(const_cast<TObject*>(obj), xkey);
+        if (ti && unlikely(protect_size_))
+            protect_item(ti);
         return OptionalTransProxy(const_cast<Transaction&>(*this), ti);
     }
 
+    // Savepoints. rollback_to(sp) undoes what the transaction did since
+    // savepoint() returned sp: newer items are cleaned up and dropped,
+    // older items get back their flags and read/write data, and the
+    // TransactionBuffer is cut back. sp stays valid, so its block can be
+    // rerun; release_savepoint(sp) keeps the work. Savepoints nest and
+    // must be released or rolled back innermost first. Older items must
+    // be looked up again after the savepoint (TransProxy objects held
+    // across it are not tracked), and a write value changed in place
+    // through write_value<T>() is not restored.
+    struct savepoint_type {
+        unsigned tset_size;
+        unsigned undo_size;
+        unsigned parent_protect_size;
+        unsigned parent_undo_floor;
+        bool any_writes;
+        bool any_nonopaque;
+        bool may_duplicate_items;
+        TransactionBuffer::mark_type buf;
+    };
+
+    savepoint_type savepoint();
+    void rollback_to(const savepoint_type& sp);
+    void release_savepoint(const savepoint_type& sp);
+
 private:
     // tries to find an existing item with this key, returns NULL if not found
     TransItem* find_item(TObject* obj, void* xkey) const {
 #if TRANSACTION_HASHTABLE
         TXP_INCREMENT(txp_hash_find);
+        if (unlikely(index_active_))
+            return find_indexed_item(obj, xkey);
         unsigned hi = hash(obj, xkey);
         for (int steps = 0; steps < TRANSACTION_HASHTABLE; ++steps) {
+            TXP_INCREMENT(txp_total_hash_probes);
             if (hashtable_[hi] <= hash_base_)
                 return nullptr;
             unsigned tidx = hashtable_[hi] - hash_base_ - 1;
@@ -458,19 +867,43 @@ private:
         return nullptr;
     }
 
+#if TRANSACTION_HASHTABLE
+    TransItem* find_indexed_item(TObject* obj, void* xkey) const {
+        unsigned hi = index_hash(obj, xkey) & index_mask_;
+        unsigned nprobes = 1;
+        TransItem* ti = nullptr;
+        for (; index_[hi]; hi = (hi + 1) & index_mask_, ++nprobes) {
+            unsigned tidx = index_[hi] - 1;
+            TransItem* x = &tset_[tidx / tset_chunk][tidx % tset_chunk];
+            if (x->owner() == obj && x->key_ == xkey) {
+                ti = x;
+                break;
+            }
+        }
+        TXP_ACCOUNT(txp_total_hash_probes, nprobes);
+        TXP_ACCOUNT(txp_max_hash_probe, nprobes);
+        return ti;
+    }
+#endif
+
     bool preceding_duplicate_read(TransItem *it) const;
+    unsigned item_index(const TransItem* ti) const;
+    void protect_item(TransItem* ti) const;
 
-#if STO_DEBUG_ABORTS
-    void mark_abort_because(TransItem* item, const char* reason, TVersion::type version = 0) const {
+    void mark_abort_because(TransItem* item, const char* reason, TVersion::type version = 0,
+                            AbortTelemetry::phase_type phase = AbortTelemetry::ph_auto) const {
         abort_item_ = item;
         abort_reason_ = reason;
+        if (phase == AbortTelemetry::ph_auto)
+            phase = state_ == s_in_progress ? AbortTelemetry::ph_in_progress : AbortTelemetry::ph_commit_check;
+        abort_phase_ = phase;
+#if STO_DEBUG_ABORTS
         if (version)
             abort_version_ = version;
-    }
 #else
-    void mark_abort_because(TransItem*, const char*, TVersion::type = 0) const {
-    }
+        (void) version;
 #endif
+    }
 
     void abort_because(TransItem& item, const char* reason, TVersion::type version = 0) {
         mark_abort_because(&item, reason, version);
@@ -484,8 +917,15 @@ public:
     }
 
     void abort() {
+        // inside a nested TRANSACTION, leave the transaction running so
+        // the nested block can roll back and retry (see caught_abort)
+        if (unlikely(nested_depth_) && !nothrow_ && state_ <= s_opacity_check) {
+            state_ = s_in_progress;
+            throw Abort();
+        }
         silent_abort();
-        throw Abort();
+        if (!nothrow_)
+            throw Abort();
     }
 
     bool try_commit();
@@ -503,6 +943,21 @@ public:
         return state_ < s_aborted;
     }
 
+    // true if transactional operations may be called: the transaction is in
+    // progress, or it is non-throwing and has aborted (see
+    // Sto::start_nothrow_transaction)
+    bool usable() const {
+        return state_ < s_aborted || (nothrow_ && state_ == s_aborted);
+    }
+
+    bool nothrow() const {
+        return nothrow_;
+    }
+
+    bool read_only() const {
+        return read_only_;
+    }
+
     // opacity checking
     // These function will eventually help us track the commit TID when we
     // have no opacity, or for GV7 opacity.
@@ -516,42 +971,49 @@ public:
 #if STO_SORT_WRITESET
         (void) item;
         TransactionTid::lock(vers, threadid_);
+        observe_tid(vers);
         return true;
 #else
         // This function will eventually help us track the commit TID when we
         // have no opacity, or for GV7 opacity.
         unsigned n = 0;
         while (1) {
-            if (TransactionTid::try_lock(vers, threadid_))
+            if (TransactionTid::try_lock(vers, threadid_)) {
+                observe_tid(vers);
                 return true;
-            ++n;
-# if STO_SPIN_EXPBACKOFF
-            if (item.has_read() || n == STO_SPIN_BOUND_WRITE) {
-#  if STO_DEBUG_ABORTS
-                abort_version_ = vers;
-#  endif
-                return false;
             }
-            if (n > 3)
-                for (unsigned x = 1 << std::min(15U, n - 2); x; --x)
-                    relax_fence();
-# else
-            if (item.has_read() || n == (1 << STO_SPIN_BOUND_WRITE)) {
-#  if STO_DEBUG_ABORTS
+            ++n;
+            if (!ContentionManager::lock_spin(tinfo[threadid_].cm, n, item.has_read())) {
+                TXP_INCREMENT(txp_cm_lock_giveups);
+# if STO_DEBUG_ABORTS
                 abort_version_ = vers;
-#  endif
+# endif
                 return false;
             }
-# endif
-            relax_fence();
+            TXP_INCREMENT(txp_cm_lock_retries);
         }
 #endif
     }
 
+    // Called by readers after the `n`th time they find a version locked.
+    // Delays and returns true to look again, or returns false to give up.
+    bool wait_spin(unsigned n) const {
+        TXP_INCREMENT(txp_cm_wait_retries);
+        return ContentionManager::wait_spin(tinfo[threadid_].cm, n);
+    }
+
+    static void retry_backoff() {
+        unsigned x = ContentionManager::retry_backoff(tinfo[TThread::id()].cm);
+        if (x) {
+            TXP_INCREMENT(txp_cm_backoffs);
+            TXP_ACCOUNT(txp_cm_backoff_spins, x);
+        }
+    }
+
     void check_opacity(TransItem& item, TransactionTid::type v) {
-        assert(state_ <= s_committing_locked);
+        assert(state_ <= s_committing_locked || nothrow_);
         if (!start_tid_)
-            start_tid_ = _GCLKS._TID;
+            start_tid_ = opacity_tid();
         if (!TransactionTid::try_check_opacity(start_tid_, v)
             && state_ < s_committing)
             hard_check_opacity(&item, v);
@@ -563,23 +1025,27 @@ public:
     }
 
     void check_opacity(TransactionTid::type v) {
-        assert(state_ <= s_committing_locked);
+        assert(state_ <= s_committing_locked || nothrow_);
         if (!start_tid_)
-            start_tid_ = _GCLKS._TID;
+            start_tid_ = opacity_tid();
         if (!TransactionTid::try_check_opacity(start_tid_, v)
             && state_ < s_committing)
             hard_check_opacity(nullptr, v);
     }
 
     void check_opacity() {
-        check_opacity(_GCLKS._TID);
+        check_opacity(opacity_tid());
     }
 
     // committing
     tid_type commit_tid() const {
         //assert(state_ == s_committing_locked || state_ == s_committing);
-        if (!commit_tid_)
-            commit_tid_ = fetch_and_add(&_GCLKS._TID, TransactionTid::increment_value);
+        if (!commit_tid_) {
+            if (decentralized_tids)
+                commit_tid_ = decentralized_commit_tid();
+            else
+                commit_tid_ = fetch_and_add(&_GCLKS._TID, TransactionTid::increment_value);
+        }
         return commit_tid_;
     }
     void set_active_sid(tid_type sid) {
@@ -632,6 +1098,13 @@ public:
     void print(std::ostream& w) const;
 
     class Abort {};
+    // thrown when a read-only transaction tries to write
+    class ReadOnlyViolation : public std::logic_error {
+    public:
+        ReadOnlyViolation()
+            : std::logic_error("STO: write in read-only transaction") {
+        }
+    };
 
     uint32_t local_random() const {
         lrng_state_ = lrng_state_ * 1664525 + 1013904223;
@@ -642,6 +1115,24 @@ public:
     }
 
 private:
+    // records a version read or locked by this transaction; decentralized
+    // commit TIDs must exceed all of them
+    void observe_tid(tid_type v) {
+        v = TransactionTid::unlocked(v);
+        if (v > max_observed_tid_)
+            max_observed_tid_ = v;
+    }
+    tid_type decentralized_commit_tid() const {
+        threadinfo_t& thr = tinfo[threadid_];
+        tid_type t = std::max(max_observed_tid_, thr.last_commit_tid);
+        t = (t | (TransactionTid::increment_value - 1)) + 1;
+        // reading the epoch here is the serialization point, like the clock
+        // fetch-and-add in the default mode
+        t = std::max(t, epoch_tid(global_epochs.global_epoch));
+        thr.last_commit_tid = t;
+        return t;
+    }
+
     enum {
         s_in_progress = 0, s_opacity_check = 1, s_committing = 2,
         s_committing_locked = 3, s_aborted = 4, s_committed = 5
@@ -649,9 +1140,11 @@ private:
 
     int threadid_;
     uint16_t hash_base_;
-    uint16_t first_write_;
+    unsigned first_write_;
     uint8_t state_;
     bool any_writes_;
+    bool read_only_;
+    bool nothrow_;
     bool any_nonopaque_;
     bool may_duplicate_items_;
     bool is_test_;
@@ -659,29 +1152,63 @@ private:
     unsigned tset_size_;
     mutable tid_type start_tid_;
     mutable tid_type commit_tid_;
+    tid_type max_observed_tid_;
+    uint64_t start_tsc_;
     mutable tid_type gsc_snapshot_;
     mutable tid_type active_sid_;
     mutable TransactionBuffer buf_;
     mutable uint32_t lrng_state_;
-#if STO_DEBUG_ABORTS
     mutable TransItem* abort_item_;
     mutable const char* abort_reason_;
+    mutable AbortTelemetry::phase_type abort_phase_;
+#if STO_DEBUG_ABORTS
     mutable TVersion::type abort_version_;
 #endif
-    TransItem* tset_[tset_max_capacity / tset_chunk];
+    // savepoint state: items below protect_size_ are copied to undo_
+    // when first looked up after the innermost savepoint, whose entries
+    // start at undo_floor_
+    struct undo_entry {
+        unsigned tidx;
+        TransItem item;
+    };
+    unsigned protect_size_;
+    mutable unsigned undo_floor_;
+    mutable std::vector<undo_entry> undo_;
+    // active nested TRANSACTION blocks and all TransactionLoopGuards
+    unsigned nested_depth_;
+    unsigned nguards_;
+    TransItem** tset_;
+    unsigned tset_dir_size_;
+    // commit-time write list, sized to the largest tset seen
+    unsigned* writeset_;
+    unsigned writeset_capacity_;
 #if TRANSACTION_HASHTABLE
     uint16_t hashtable_[hash_size];
+    // tset index + 1 per slot, 0 if empty; in use iff index_active_
+    uint32_t* index_;
+    unsigned index_mask_;
+    bool index_active_;
 #endif
     TransItem tset0_[tset_initial_capacity];
 
     void hard_check_opacity(TransItem* item, TransactionTid::type t);
+    void reject_read_only_write(TransItem& item) __attribute__((noreturn));
+    bool run_group(const std::vector<std::function<void()> >& closures,
+                   size_t first, size_t last, std::vector<size_t>& deferred);
+    bool run_alone(const std::function<void()>& closure);
     void stop(bool committed, unsigned* writes, unsigned nwrites);
+    unsigned owner_span(unsigned tidx) const;
+    bool lock_span(TransItem* first, TransItem* last);
+    bool check_span(TransItem* first, TransItem* last);
+    void install_span(TransItem* first, TransItem* last);
 
     friend class TransProxy;
     friend class TransItem;
     friend class Sto;
     friend class TestTransaction;
     friend class TNonopaqueVersion;
+    friend class TransactionLoopGuard;
+    template <typename Task> friend class InterleavedExecutor;
 };
 
 
@@ -699,6 +1226,26 @@ public:
         t->start();
     }
 
+    // Starts a transaction that promises not to write. If every read it
+    // makes is opacity-checked, it commits without validating its read set
+    // and without taking a commit TID. Writes throw
+    // Transaction::ReadOnlyViolation.
+    static void start_read_only_transaction() {
+        start_transaction();
+        TThread::txn->read_only_ = true;
+    }
+
+    // Starts a transaction that reports aborts without throwing: abort()
+    // marks it aborted (see Sto::aborted()) and returns, and try_commit()
+    // then returns false. The abort runs the transaction's cleanup, so
+    // nothing undoes shared changes made after it: data structures check
+    // Sto::aborted() before linking new nodes (see Hashtable::trans_write,
+    // RBTree::insert), and bodies should stop at the first abort.
+    static void start_nothrow_transaction() {
+        start_transaction();
+        TThread::txn->nothrow_ = true;
+    }
+
     static void update_threadid() {
         if (TThread::txn)
             TThread::txn->threadid_ = TThread::id();
@@ -708,8 +1255,16 @@ public:
         return TThread::txn && TThread::txn->in_progress();
     }
 
+    static bool usable() {
+        return TThread::txn && TThread::txn->usable();
+    }
+
+    static bool aborted() {
+        return TThread::txn && TThread::txn->aborted();
+    }
+
     static void abort() {
-        always_assert(in_progress());
+        always_assert(usable());
         TThread::txn->abort();
     }
 
@@ -718,43 +1273,70 @@ public:
             TThread::txn->silent_abort();
     }
 
+    static Transaction::savepoint_type savepoint() {
+        always_assert(in_progress());
+        return TThread::txn->savepoint();
+    }
+
+    static void rollback_to(const Transaction::savepoint_type& sp) {
+        always_assert(in_progress());
+        TThread::txn->rollback_to(sp);
+    }
+
+    static void release_savepoint(const Transaction::savepoint_type& sp) {
+        always_assert(in_progress());
+        TThread::txn->release_savepoint(sp);
+    }
+
+    // Group commit for small independent transactions. Runs each closure
+    // as its own atomic block, back to back on this thread, committing
+    // up to Transaction::group_commit_size of them as one transaction, so
+    // they share one start, one commit TID and one commit pass. A closure
+    // that conflicts with itself is rolled back and rerun in place; one
+    // that aborts for another reason, or whose group fails to commit
+    // twice, is run as a transaction of its own, with up to
+    // Transaction::batch_attempts attempts. Sets (*results)[i] if
+    // closure i committed, and returns the number that committed.
+    static unsigned run_batch(const std::vector<std::function<void()> >& closures,
+                              std::vector<bool>* results = nullptr);
+
     template <typename T>
     static TransProxy item(const TObject* s, T key) {
-        always_assert(in_progress());
+        always_assert(usable());
         return TThread::txn->item(s, key);
     }
 
     static void check_opacity(TransactionTid::type t) {
-        always_assert(in_progress());
+        always_assert(usable());
         TThread::txn->check_opacity(t);
     }
 
     static void check_opacity() {
-        always_assert(in_progress());
+        always_assert(usable());
         TThread::txn->check_opacity();
     }
 
     template <typename T>
     static OptionalTransProxy check_item(const TObject* s, T key) {
-        always_assert(in_progress());
+        always_assert(usable());
         return TThread::txn->check_item(s, key);
     }
 
     template <typename T>
     static TransProxy new_item(const TObject* s, T key) {
-        always_assert(in_progress());
+        always_assert(usable());
         return TThread::txn->new_item(s, key);
     }
 
     template <typename T>
     static TransProxy read_item(const TObject* s, T key) {
-        always_assert(in_progress());
+        always_assert(usable());
         return TThread::txn->read_item(s, key);
     }
 
     template <typename T>
     static TransProxy fresh_item(const TObject* s, T key) {
-        always_assert(in_progress());
+        always_assert(usable());
         return TThread::txn->fresh_item(s, key);
     }
 
@@ -764,7 +1346,7 @@ public:
     }
 
     static bool try_commit() {
-        always_assert(in_progress());
+        always_assert(usable());
         return TThread::txn->try_commit();
     }
 
@@ -788,6 +1370,8 @@ public:
     }
 
     static TransactionTid::type take_snapshot() {
+        always_assert(!Transaction::decentralized_tids
+                      && "snapshots require the global commit-TID clock");
         TransactionTid::type sid;
         while (true) {
             uint128_t v = Transaction::_GCLKS;
@@ -839,7 +1423,8 @@ public:
         if (base_ && !base_->is_test_) {
             TThread::txn = base_;
             TThread::set_id(base_->threadid_);
-        }
+        } else if (TThread::txn == &t_)
+            TThread::txn = nullptr;
     }
     void use() {
         TThread::txn = &t_;
@@ -874,19 +1459,97 @@ class TransactionGuard {
     }
 };
 
+// A TRANSACTION inside a running transaction is a closed nested
+// transaction: it runs in the enclosing transaction's mode from a
+// savepoint. If it aborts because of an item it added itself (say a
+// read that failed an opacity check), only the nested block is rolled
+// back and rerun, up to nested_attempts times; other aborts pass to the
+// enclosing block. Its "commit" merges its work into the parent.
 class TransactionLoopGuard {
   public:
-    TransactionLoopGuard() {
+    static constexpr unsigned nested_attempts = 8;
+
+    TransactionLoopGuard(bool read_only = false, bool nothrow = false)
+        : read_only_(read_only), nothrow_(nothrow), saved_(false), done_(false), attempts_(0) {
+        Transaction* t = Sto::transaction();
+        nested_ = t->in_progress() || t->nguards_;
+        ++t->nguards_;
     }
     ~TransactionLoopGuard() {
-        if (TThread::txn->in_progress())
-            TThread::txn->silent_abort();
+        Transaction* t = TThread::txn;
+        if (nested_) {
+            release();
+            // leaving a nested block early aborts, unless an enclosing
+            // nested block may still catch the Abort
+            if (!done_ && !t->nested_depth_ && t->in_progress())
+                t->silent_abort();
+        } else if (t->in_progress())
+            t->silent_abort();
+        --t->nguards_;
     }
     void start() {
-        Sto::start_transaction();
+        if (nested_) {
+            Transaction* t = TThread::txn;
+            if (saved_)
+                t->rollback_to(sp_);
+            else if (!attempts_ && t->in_progress() && !t->nothrow_) {
+                sp_ = t->savepoint();
+                saved_ = true;
+                ++t->nested_depth_;
+            }
+            ++attempts_;
+            return;
+        }
+        if (attempts_)
+            Transaction::retry_backoff();
+        ++attempts_;
+        if (read_only_)
+            Sto::start_read_only_transaction();
+        else if (nothrow_)
+            Sto::start_nothrow_transaction();
+        else
+            Sto::start_transaction();
     }
     bool try_commit() {
-        return TThread::txn->try_commit();
+        if (nested_) {
+            release();
+            done_ = true;
+            return true;
+        }
+        bool ok = TThread::txn->try_commit();
+        if (ok)
+            TXH_RECORD(txh_retries, attempts_ - 1);
+        return ok;
+    }
+    // Called when Transaction::Abort reaches the loop. Returns if the
+    // block should be retried; otherwise rethrows to the enclosing block.
+    void caught_abort() {
+        if (!nested_)
+            return;
+        Transaction* t = TThread::txn;
+        if (saved_ && t->in_progress() && attempts_ < nested_attempts
+            && t->abort_item_ && t->item_index(t->abort_item_) >= sp_.tset_size)
+            return;
+        release();
+        if (!t->nested_depth_)
+            t->silent_abort();
+        throw Transaction::Abort();
+    }
+  private:
+    bool read_only_;
+    bool nothrow_;
+    bool nested_;
+    bool saved_;
+    bool done_;
+    unsigned attempts_;
+    Transaction::savepoint_type sp_;
+
+    void release() {
+        if (saved_) {
+            TThread::txn->release_savepoint(sp_);
+            --TThread::txn->nested_depth_;
+            saved_ = false;
+        }
     }
 };
 
@@ -918,9 +1581,12 @@ inline TransProxy& TransProxy::add_read_opaque(T rdata) {
 
 inline TransProxy& TransProxy::observe(TVersion version, bool add_read) {
     assert(!has_stash());
-    if (version.is_locked_elsewhere(t()->threadid_))
+    if (version.is_locked_elsewhere(t()->threadid_)) {
         t()->abort_because(item(), "locked", version.value());
+        return *this;
+    }
     t()->check_opacity(item(), version.value());
+    t()->observe_tid(version.value());
     if (add_read && !has_read()) {
         item().__or_flags(TransItem::read_bit);
         item().rdata_ = Packer<TVersion>::pack(t()->buf_, std::move(version));
@@ -930,8 +1596,11 @@ inline TransProxy& TransProxy::observe(TVersion version, bool add_read) {
 
 inline TransProxy& TransProxy::observe(TNonopaqueVersion version, bool add_read) {
     assert(!has_stash());
-    if (version.is_locked_elsewhere(t()->threadid_))
+    if (version.is_locked_elsewhere(t()->threadid_)) {
         t()->abort_because(item(), "locked", version.value());
+        return *this;
+    }
+    t()->observe_tid(version.value());
     if (add_read && !has_read()) {
         item().__or_flags(TransItem::read_bit);
         item().rdata_ = Packer<TNonopaqueVersion>::pack(t()->buf_, std::move(version));
@@ -942,9 +1611,12 @@ inline TransProxy& TransProxy::observe(TNonopaqueVersion version, bool add_read)
 
 inline TransProxy& TransProxy::observe(TCommutativeVersion version, bool add_read) {
     assert(!has_stash());
-    if (version.is_locked())
+    if (version.is_locked()) {
         t()->abort_because(item(), "locked", version.value());
+        return *this;
+    }
     t()->check_opacity(item(), version.value());
+    t()->observe_tid(version.value());
     if (add_read && !has_read()) {
         item().__or_flags(TransItem::read_bit);
         item().rdata_ = Packer<TCommutativeVersion>::pack(t()->buf_, std::move(version));
@@ -978,8 +1650,12 @@ inline TransProxy& TransProxy::observe_opacity(TCommutativeVersion version) {
 
 template <typename T>
 inline TransProxy& TransProxy::update_read(T old_rdata, T new_rdata) {
-    if (has_read() && this->read_value<T>() == old_rdata)
-        item().rdata_ = Packer<T>::repack(t()->buf_, item().rdata_, new_rdata);
+    if (has_read() && this->read_value<T>() == old_rdata) {
+        if (!Packer<T>::is_simple && unlikely(t()->protect_size_))
+            item().rdata_ = Packer<T>::pack(t()->buf_, std::move(new_rdata));
+        else
+            item().rdata_ = Packer<T>::repack(t()->buf_, item().rdata_, new_rdata);
+    }
     return *this;
 }
 
@@ -1008,6 +1684,8 @@ inline T& TransProxy::predicate_value(T default_pdata) {
 
 inline TransProxy& TransProxy::add_write() {
     if (!has_write()) {
+        if (unlikely(t()->read_only_))
+            t()->reject_read_only_write(item());
         item().__or_flags(TransItem::write_bit);
         t()->any_writes_ = true;
     }
@@ -1028,10 +1706,15 @@ inline TransProxy& TransProxy::add_write(T&& wdata) {
 template <typename T, typename... Args>
 inline TransProxy& TransProxy::add_write(Args&&... args) {
     if (!has_write()) {
+        if (unlikely(t()->read_only_))
+            t()->reject_read_only_write(item());
         item().__or_flags(TransItem::write_bit);
         item().wdata_ = Packer<T>::pack(t()->buf_, std::forward<Args>(args)...);
         t()->any_writes_ = true;
-    } else
+    } else if (!Packer<T>::is_simple && unlikely(t()->protect_size_))
+        // a savepoint's undo copy may still point at the old value
+        item().wdata_ = Packer<T>::pack(t()->buf_, std::forward<Args>(args)...);
+    else
         // TODO: this assumes that a given writer data always has the same type.
         // this is certainly true now but we probably shouldn't assume this in general
         // (hopefully we'll have a system that can automatically call destructors and such
@@ -1046,7 +1729,9 @@ inline TransProxy& TransProxy::set_stash(T sdata) {
     if (!has_stash()) {
         item().__or_flags(TransItem::stash_bit);
         item().rdata_ = Packer<T>::pack(t()->buf_, std::move(sdata));
-    } else
+    } else if (!Packer<T>::is_simple && unlikely(t()->protect_size_))
+        item().rdata_ = Packer<T>::pack(t()->buf_, std::move(sdata));
+    else
         item().rdata_ = Packer<T>::repack(t()->buf_, item().rdata_, std::move(sdata));
     return *this;
 }
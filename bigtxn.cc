@@ -0,0 +1,81 @@
+// Regression benchmark for very large transactions: each transaction reads
+// and writes every element of an array of TBoxes, and we report the time
+// spent building the transaction set, the commit latency, and the peak RSS.
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cassert>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "clp.h"
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, NULL);
+    return tv.tv_sec + tv.tv_usec / 1000000.0;
+}
+
+static long peak_rss_kb() {
+    struct rusage ru;
+    getrusage(RUSAGE_SELF, &ru);
+    return ru.ru_maxrss;
+}
+
+static void run(unsigned nitems, int ntrials) {
+    std::vector<TBox<int> > boxes(nitems);
+    double build = 0, commit = 0;
+    for (int trial = 0; trial != ntrials; ++trial) {
+        double t0 = now();
+        Sto::start_transaction();
+        for (unsigned i = 0; i != nitems; ++i)
+            boxes[i] = boxes[i] + 1;
+        double t1 = now();
+        bool ok = Sto::try_commit();
+        double t2 = now();
+        always_assert(ok);
+        build += t1 - t0;
+        commit += t2 - t1;
+    }
+    for (unsigned i = 0; i != nitems; ++i)
+        always_assert(boxes[i].nontrans_read() == ntrials);
+    printf("%9u items: %9.3f ms build, %9.3f ms commit, %7ld KB peak RSS\n",
+           nitems, build * 1000 / ntrials, commit * 1000 / ntrials, peak_rss_kb());
+}
+
+enum { opt_nitems = 1, opt_ntrials };
+
+static const Clp_Option options[] = {
+    { "nitems", 'n', opt_nitems, Clp_ValUnsigned, 0 },
+    { "ntrials", 't', opt_ntrials, Clp_ValInt, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    std::vector<unsigned> sizes;
+    int ntrials = 3;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nitems:
+            sizes.push_back(clp->val.u);
+            break;
+        case opt_ntrials:
+            ntrials = clp->val.i;
+            break;
+        default:
+            fprintf(stderr, "Usage: %s [--nitems=N]... [--ntrials=T]\n", argv[0]);
+            exit(1);
+        }
+    }
+    Clp_DeleteParser(clp);
+
+    if (sizes.empty())
+        sizes = {100000, 1000000};
+    for (unsigned n : sizes)
+        run(n, ntrials);
+    return 0;
+}
@@ -0,0 +1,147 @@
+// Commit dispatch microbenchmark: each transaction reads and writes
+// NITEMS items of one data structure, and we report the average cycles
+// spent in try_commit with and without Transaction::batch_commit.
+// The "readset" test instead reads NITEMS random boxes from a table much
+// larger than the cache and writes one, so commit time is dominated by
+// read validation misses.
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Transaction.hh"
+#include "TBox.hh"
+#include "TArray.hh"
+#include "Hashtable.hh"
+#include "clp.h"
+
+static constexpr unsigned array_size = 4096;
+static unsigned nitems = 200;
+static int ntrials = 20000;
+
+struct HashtableBench {
+    Hashtable<int, int> h_;
+    HashtableBench() {
+        for (unsigned i = 0; i != nitems; ++i)
+            h_.nontrans_insert(i, 0);
+    }
+    void run() {
+        for (unsigned i = 0; i != nitems; ++i) {
+            int v = 0;
+            h_.transGet(i, v);
+            h_.transPut(i, v + 1);
+        }
+    }
+};
+
+struct TArrayBench {
+    TArray<int, array_size> a_;
+    void run() {
+        for (unsigned i = 0; i != nitems; ++i)
+            a_[i] = a_[i] + 1;
+    }
+};
+
+struct TBoxBench {
+    std::vector<TBox<int> > boxes_;
+    TBoxBench()
+        : boxes_(nitems) {
+    }
+    void run() {
+        for (unsigned i = 0; i != nitems; ++i)
+            boxes_[i] = boxes_[i] + 1;
+    }
+};
+
+struct ReadSetBench {
+    std::vector<TBox<int> > boxes_;
+    uint32_t rng_;
+    ReadSetBench()
+        : boxes_(1 << 21), rng_(1) {
+    }
+    void run() {
+        int sum = 0;
+        for (unsigned i = 0; i != nitems; ++i) {
+            rng_ ^= rng_ << 13;
+            rng_ ^= rng_ >> 17;
+            rng_ ^= rng_ << 5;
+            sum += boxes_[rng_ % boxes_.size()];
+        }
+        boxes_[0] = sum;
+    }
+};
+
+template <typename B>
+static double commit_cycles(B& bench, bool batch) {
+    Transaction::batch_commit = batch;
+    uint64_t total = 0;
+    for (int trial = 0; trial != ntrials; ++trial) {
+        Sto::start_transaction();
+        bench.run();
+        uint64_t t0 = read_tsc();
+        bool ok = Sto::try_commit();
+        uint64_t t1 = read_tsc();
+        always_assert(ok);
+        total += t1 - t0;
+    }
+    return (double) total / ntrials;
+}
+
+template <typename B>
+static void run(const char* name) {
+    B bench;
+    commit_cycles(bench, true); // warm up
+    double unbatched = commit_cycles(bench, false);
+    double batched = commit_cycles(bench, true);
+    printf("%-10s %5u items: %10.0f cycles/commit unbatched, %10.0f batched (%.1f%%)\n",
+           name, nitems, unbatched, batched, 100 * (unbatched - batched) / unbatched);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [hashtable|tarray|tbox|readset] [--nitems=N] [--ntrials=T]\n", name);
+    exit(1);
+}
+
+enum { opt_nitems = 1, opt_ntrials };
+
+static const Clp_Option options[] = {
+    { "nitems", 'n', opt_nitems, Clp_ValUnsigned, 0 },
+    { "ntrials", 't', opt_ntrials, Clp_ValInt, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    const char* test = nullptr;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nitems:
+            nitems = clp->val.u;
+            break;
+        case opt_ntrials:
+            ntrials = clp->val.i;
+            break;
+        case Clp_NotOption:
+            test = clp->vstr;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if ((nitems > array_size && (!test || strcmp(test, "tarray") == 0))
+        || (test && strcmp(test, "hashtable") != 0 && strcmp(test, "tarray") != 0
+            && strcmp(test, "tbox") != 0 && strcmp(test, "readset") != 0))
+        usage(argv[0]);
+
+    if (!test || strcmp(test, "hashtable") == 0)
+        run<HashtableBench>("hashtable");
+    if (!test || strcmp(test, "tarray") == 0)
+        run<TArrayBench>("tarray");
+    if (!test || strcmp(test, "tbox") == 0)
+        run<TBoxBench>("tbox");
+    if (!test || strcmp(test, "readset") == 0)
+        run<ReadSetBench>("readset");
+    return 0;
+}
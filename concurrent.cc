@@ -12,6 +12,7 @@
 #include "Vector.hh"
 #include "TVector.hh"
 #include "Transaction.hh"
+#include "StoStats.hh"
 #include "IntStr.hh"
 #include "clp.h"
 #include "randgen.hh"
@@ -34,6 +35,7 @@
 #define USE_MASSTREE_STR 8
 #define USE_HASHTABLE_STR 9
 #define USE_ARRAY_NONOPAQUE 10
+#define USE_HASHTABLE_GROW 11
 
 // set this to USE_DATASTRUCTUREYOUWANT
 #define DATA_STRUCTURE USE_HASHTABLE
@@ -139,7 +141,7 @@ inline value_type strtoval(const std::string& s) {
 #endif
 }
 
-unsigned initial_seeds[64];
+unsigned initial_seeds[2 * MAX_THREADS];
 
 
 template <int DS> struct Container {};
@@ -293,10 +295,7 @@ template <> struct Container<USE_MASSTREE> {
         return v_.transUpdate(IntStr(key).str(), value);
     }
     static void init() {
-        Transaction::epoch_advance_callback = [] (unsigned) {
-            // just advance blindly because of the way Masstree uses epochs
-            globalepoch++;
-        };
+        type::static_init();
     }
     static void thread_init(Container<USE_MASSTREE>&) {
         type::thread_init();
@@ -339,10 +338,7 @@ template <> struct Container<USE_MASSTREE_STR> {
         return v_.transUpdate(IntStr(key).str(), valtostr(value));
     }
     static void init() {
-        Transaction::epoch_advance_callback = [] (unsigned) {
-            // just advance blindly because of the way Masstree uses epochs
-            globalepoch++;
-        };
+        type::static_init();
     }
     static void thread_init(Container<USE_MASSTREE_STR>&) {
         type::thread_init();
@@ -387,6 +383,43 @@ private:
     type v_;
 };
 
+// starts at the default 129 buckets and resizes as it fills
+template <> struct Container<USE_HASHTABLE_GROW> {
+#ifndef BOOSTING
+    typedef Hashtable<int, value_type> type;
+#else
+    typedef TransMap<int, value_type> type;
+#endif
+    typedef int index_type;
+    static constexpr bool has_delete = true;
+    value_type nontrans_get(index_type key) {
+        return v_.unsafe_get(key);
+    }
+    value_type transGet(index_type key) {
+        value_type v = value_type();
+        v_.transGet(key, v);
+        return v;
+    }
+    void transPut(index_type key, value_type value) {
+        v_.transPut(key, value);
+    }
+    bool transDelete(index_type key) {
+        return v_.transDelete(key);
+    }
+    bool transInsert(index_type key, value_type value) {
+        return v_.transInsert(key, value);
+    }
+    bool transUpdate(index_type key, value_type value) {
+        return v_.transUpdate(key, value);
+    }
+    static void init() {
+    }
+    static void thread_init(Container<USE_HASHTABLE_GROW>&) {
+    }
+private:
+    type v_;
+};
+
 template <> struct Container<USE_HASHTABLE_STR> {
     typedef Hashtable<int, std::string, false, static_cast<unsigned>(ARRAY_SZ/HASHTABLE_LOAD_FACTOR)> type;
     typedef int index_type;
@@ -434,6 +467,16 @@ int prepopulate =
     ARRAY_SZ/10;
 double write_percent = 0.5;
 bool blindRandomWrite = false;
+bool tidScaling = false;
+double readonly_percent = 0.9;
+bool readOnlyApi = true;
+bool roSweep = false;
+bool noThrow = false;
+bool noThrowCompare = false;
+double statsInterval = 0;
+int hot_slots = 16;
+int batchSize = 0;
+bool batchCompare = false;
 
 
 using namespace std;
@@ -556,6 +599,7 @@ template <int DS> struct DSTester : public Tester {
 };
 
 template <int DS> void DSTester<DS>::initialize() {
+    delete a;
     a = new container_type;
     if (prepopulate()) {
         prepopulate_func(*a);
@@ -596,6 +640,136 @@ template <int DS> void ReadThenWrite<DS>::run(int me) {
 }
 
 
+// A fraction readonly_percent of transactions only read; the rest
+// increment opspertrans slots. Readers use TRANSACTION_RO if readOnlyApi.
+template <int DS> struct ReadOnlyMix : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    ReadOnlyMix() {}
+    void run(int me);
+};
+
+template <int DS> void ReadOnlyMix<DS>::run(int me) {
+  TThread::set_id(me);
+  Sto::update_threadid();
+  container_type* a = this->a;
+  container_type::thread_init(*a);
+
+  std::uniform_int_distribution<long> slotdist(0, ARRAY_SZ-1);
+  uint32_t ro_thresh = (uint32_t) (readonly_percent * Rand::max());
+  Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+  int N = ntrans/nthreads;
+  int OPS = opspertrans;
+  for (int i = 0; i < N; ++i) {
+    // so that retries of this transaction do the same thing
+    Rand transgen_snap = transgen;
+    bool ro = transgen() < ro_thresh;
+    Rand transgen_ro = transgen;
+    auto gen = [&]() { return slotdist(transgen); };
+    if (ro && readOnlyApi) {
+      TRANSACTION_RO {
+        transgen = transgen_ro;
+        nreads(*a, OPS, gen);
+      } RETRY(true);
+    } else if (ro) {
+      TRANSACTION {
+        transgen = transgen_ro;
+        nreads(*a, OPS, gen);
+      } RETRY(true);
+    } else {
+      TRANSACTION {
+        transgen = transgen_snap;
+        transgen();
+        nwrites(*a, OPS, gen);
+      } RETRY(true);
+    }
+  }
+}
+
+
+// Increments opspertrans slots chosen from the first hot_slots, so most
+// transactions conflict. With noThrow, aborts are reported through
+// Sto::aborted() instead of exceptions.
+template <int DS> struct AbortHot : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    AbortHot() {}
+    void run(int me);
+};
+
+template <int DS> void AbortHot<DS>::run(int me) {
+  TThread::set_id(me);
+  Sto::update_threadid();
+  container_type* a = this->a;
+  container_type::thread_init(*a);
+
+  std::uniform_int_distribution<long> slotdist(0, std::min(hot_slots, ARRAY_SZ) - 1);
+  Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+  int N = ntrans/nthreads;
+  int OPS = opspertrans;
+  for (int i = 0; i < N; ++i) {
+    // so that retries of this transaction do the same thing
+    Rand transgen_snap = transgen;
+    if (noThrow) {
+      TRANSACTION_NOTHROW {
+        transgen = transgen_snap;
+        for (int j = 0; j < OPS && !Sto::aborted(); ++j)
+          doWrite(*a, slotdist(transgen), j);
+      } RETRY_NOTHROW(true);
+    } else {
+      TRANSACTION {
+        transgen = transgen_snap;
+        for (int j = 0; j < OPS; ++j)
+          doWrite(*a, slotdist(transgen), j);
+      } RETRY(true);
+    }
+  }
+}
+
+
+// One-operation transactions that each increment a random slot, run
+// one at a time or, with --batch=N, through Sto::run_batch N at a time.
+template <int DS> struct SmallTxns : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    SmallTxns() {}
+    void run(int me);
+};
+
+template <int DS> void SmallTxns<DS>::run(int me) {
+  TThread::set_id(me);
+  Sto::update_threadid();
+  container_type* a = this->a;
+  container_type::thread_init(*a);
+
+  std::uniform_int_distribution<long> slotdist(0, ARRAY_SZ-1);
+  Rand transgen(initial_seeds[2*me], initial_seeds[2*me + 1]);
+
+  int N = ntrans/nthreads;
+  if (batchSize <= 0) {
+    for (int i = 0; i < N; ++i) {
+      int slot = slotdist(transgen);
+      TRANSACTION {
+        int ctr = 0;
+        doWrite(*a, slot, ctr);
+      } RETRY(true);
+    }
+    return;
+  }
+  std::vector<std::function<void()> > closures;
+  for (int i = 0; i < N; i += batchSize) {
+    closures.clear();
+    for (int j = i; j < std::min(i + batchSize, N); ++j) {
+      int slot = slotdist(transgen);
+      closures.push_back([a, slot]() {
+          int ctr = 0;
+          doWrite(*a, slot, ctr);
+        });
+    }
+    Sto::run_batch(closures);
+  }
+}
+
+
 template <int DS> struct RandomRWs_parent : public DSTester<DS> {
     typedef typename DSTester<DS>::container_type container_type;
     RandomRWs_parent() {}
@@ -867,6 +1041,46 @@ template <int DS> bool XorDelete<DS, true>::check() {
 }
 
 
+// Inserts distinct keys into an empty container, opspertrans per
+// transaction. With hashtable-grow this measures growth from empty.
+template <int DS, bool Ok = Container<DS>::has_delete> struct GrowInserts;
+template <int DS> struct GrowInserts<DS, false> : public DSTester<DS> {};
+template <int DS> struct GrowInserts<DS, true> : public DSTester<DS> {
+    typedef typename DSTester<DS>::container_type container_type;
+    GrowInserts() {}
+    bool prepopulate() { return false; }
+    void run(int me);
+    bool check();
+};
+
+template <int DS> void GrowInserts<DS, true>::run(int me) {
+  TThread::set_id(me);
+  Sto::update_threadid();
+  container_type* a = this->a;
+  container_type::thread_init(*a);
+
+  long N = ntrans/nthreads;
+  int OPS = opspertrans;
+
+  for (long i = 0; i < N; ++i) {
+    TRANSACTION {
+      for (int j = 0; j < OPS; ++j) {
+        int slot = ((i * OPS + j) * nthreads + me) % ARRAY_SZ;
+        a->transInsert(slot, val(slot + 1));
+      }
+    } RETRY(true);
+  }
+}
+
+template <int DS> bool GrowInserts<DS, true>::check() {
+  long n = std::min(long(ntrans/nthreads) * opspertrans * nthreads, long(ARRAY_SZ));
+  for (long slot = 0; slot < n; ++slot) {
+    assert(this->a->nontrans_get(slot) == val(slot + 1));
+  }
+  return true;
+}
+
+
 template <int DS> struct IsolatedWrites : public DSTester<DS> {
     typedef typename DSTester<DS>::container_type container_type;
     IsolatedWrites() {}
@@ -1088,9 +1302,13 @@ void startAndWait(int n, Tester* tester) {
       testers[i].me = i;
       pthread_create(&tids[i], NULL, runfunc, &testers[i]);
   }
-  pthread_t advancer;
-  pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
-  pthread_detach(advancer);
+  static bool advancer_started = false;
+  if (!advancer_started) {
+    pthread_t advancer;
+    pthread_create(&advancer, NULL, Transaction::epoch_advancer, NULL);
+    pthread_detach(advancer);
+    advancer_started = true;
+  }
 
   for (int i = 0; i < n; ++i) {
     pthread_join(tids[i], NULL);
@@ -1102,6 +1320,96 @@ void print_time(struct timeval tv1, struct timeval tv2) {
   printf("%f\n", (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0);
 }
 
+// Runs the test at 1, 2, 4, ..., nthreads threads, once with the global
+// commit-TID clock and once with decentralized commit TIDs, and prints
+// transactions per second for each.
+void tid_scaling(Tester* tester) {
+  int max_threads = nthreads;
+  printf("threads  global-clock  decentralized  (txns/sec)\n");
+  for (int n = 1; ; n = std::min(2 * n, max_threads)) {
+    double tput[2];
+    for (int mode = 0; mode != 2; ++mode) {
+      Transaction::decentralized_tids = mode;
+      nthreads = n;
+      tester->initialize();
+      struct timeval tv1, tv2;
+      gettimeofday(&tv1, NULL);
+      startAndWait(n, tester);
+      gettimeofday(&tv2, NULL);
+      double elapsed = (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+      tput[mode] = (ntrans / n) * n / elapsed;
+    }
+    printf("%7d  %12.0f  %13.0f\n", n, tput[0], tput[1]);
+    if (n == max_threads)
+      break;
+  }
+  nthreads = max_threads;
+}
+
+// Runs the test at several read-only fractions, with read-only
+// transactions started normally and through the read-only API, and prints
+// transactions per second for each.
+void ro_sweep(Tester* tester) {
+  static const double fractions[] = {0, 0.5, 0.9, 0.99, 1};
+  printf("readonly  TRANSACTION  TRANSACTION_RO  (txns/sec)\n");
+  for (double f : fractions) {
+    double tput[2];
+    for (int mode = 0; mode != 2; ++mode) {
+      readonly_percent = f;
+      readOnlyApi = mode;
+      tester->initialize();
+      struct timeval tv1, tv2;
+      gettimeofday(&tv1, NULL);
+      startAndWait(nthreads, tester);
+      gettimeofday(&tv2, NULL);
+      double elapsed = (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+      tput[mode] = (ntrans / nthreads) * nthreads / elapsed;
+    }
+    printf("%8.2f  %11.0f  %14.0f\n", f, tput[0], tput[1]);
+  }
+}
+
+// Runs the test unbatched and with --batch (default 16) and prints
+// transactions per second and aborts for each.
+void batch_compare(Tester* tester) {
+  int batch = batchSize > 0 ? batchSize : 16;
+  printf("mode        txns/sec      aborts\n");
+  for (int mode = 0; mode != 2; ++mode) {
+    batchSize = mode ? batch : 0;
+    Transaction::clear_stats();
+    tester->initialize();
+    struct timeval tv1, tv2;
+    gettimeofday(&tv1, NULL);
+    startAndWait(nthreads, tester);
+    gettimeofday(&tv2, NULL);
+    double elapsed = (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+    char name[32];
+    snprintf(name, sizeof(name), mode ? "batch=%d" : "single", batch);
+    printf("%-10s  %8.0f  %10llu\n", name,
+           (ntrans / nthreads) * nthreads / elapsed,
+           (unsigned long long) Transaction::txp_counters_combined().p(txp_total_aborts));
+  }
+}
+
+// Runs the test with throwing and non-throwing transactions and prints
+// transactions per second and aborts for each.
+void nothrow_compare(Tester* tester) {
+  printf("mode      txns/sec      aborts\n");
+  for (int mode = 0; mode != 2; ++mode) {
+    noThrow = mode;
+    Transaction::clear_stats();
+    tester->initialize();
+    struct timeval tv1, tv2;
+    gettimeofday(&tv1, NULL);
+    startAndWait(nthreads, tester);
+    gettimeofday(&tv2, NULL);
+    double elapsed = (tv2.tv_sec-tv1.tv_sec) + (tv2.tv_usec-tv1.tv_usec)/1000000.0;
+    printf("%-8s  %8.0f  %10llu\n", mode ? "nothrow" : "throw",
+           (ntrans / nthreads) * nthreads / elapsed,
+           (unsigned long long) Transaction::txp_counters_combined().p(txp_total_aborts));
+  }
+}
+
 #define MAKE_TESTER(name, desc, type, ...)            \
     {name, desc, 0, new type<0, ## __VA_ARGS__>},     \
     {name, desc, 1, new type<1, ## __VA_ARGS__>},     \
@@ -1111,7 +1419,8 @@ void print_time(struct timeval tv1, struct timeval tv2) {
     {name, desc, 7, new type<7, ## __VA_ARGS__>},     \
     {name, desc, 8, new type<8, ## __VA_ARGS__>},     \
     {name, desc, 9, new type<9, ## __VA_ARGS__>},     \
-    {name, desc, 10, new type<10, ## __VA_ARGS__>}
+    {name, desc, 10, new type<10, ## __VA_ARGS__>},    \
+    {name, desc, 11, new type<11, ## __VA_ARGS__>}
 
 struct Test {
     const char* name;
@@ -1126,7 +1435,11 @@ struct Test {
     MAKE_TESTER("readthenwrite", 0, ReadThenWrite),
     MAKE_TESTER("kingofthedelete", 0, KingDelete),
     MAKE_TESTER("xordelete", 0, XorDelete),
-    MAKE_TESTER("randomrw-d", "uncheckable", RandomRWs, true)
+    MAKE_TESTER("randomrw-d", "uncheckable", RandomRWs, true),
+    MAKE_TESTER("readonlymix", "uncheckable; see --readonlypercent", ReadOnlyMix),
+    MAKE_TESTER("aborthot", "uncheckable; see --nothrow", AbortHot),
+    MAKE_TESTER("smalltxns", "uncheckable; see --batch", SmallTxns),
+    MAKE_TESTER("growinserts", "try hashtable-grow", GrowInserts)
 };
 
 struct {
@@ -1138,6 +1451,7 @@ struct {
     {"hashtable", USE_HASHTABLE},
     {"hash", USE_HASHTABLE},
     {"hash-str", USE_HASHTABLE_STR},
+    {"hashtable-grow", USE_HASHTABLE_GROW},
     {"masstree", USE_MASSTREE},
     {"mass", USE_MASSTREE},
     {"masstree-str", USE_MASSTREE_STR},
@@ -1148,7 +1462,11 @@ struct {
 };
 
 enum {
-    opt_test = 1, opt_nrmyw, opt_check, opt_nthreads, opt_ntrans, opt_opspertrans, opt_writepercent, opt_blindrandwrites, opt_prepopulate, opt_seed
+    opt_test = 1, opt_nrmyw, opt_check, opt_nthreads, opt_ntrans, opt_opspertrans, opt_writepercent, opt_blindrandwrites, opt_prepopulate, opt_seed,
+    opt_dtids, opt_tidscaling, opt_readonlypercent, opt_roapi, opt_rosweep,
+    opt_nothrow, opt_nothrowcompare, opt_hotslots, opt_cm,
+    opt_aborttelemetry, opt_statsinterval, opt_epochinterval, opt_epochpending,
+    opt_batch, opt_batchcompare
 };
 
 static const Clp_Option options[] = {
@@ -1160,7 +1478,22 @@ static const Clp_Option options[] = {
   { "writepercent", 0, opt_writepercent, Clp_ValDouble, Clp_Optional },
   { "blindrandwrites", 0, opt_blindrandwrites, 0, Clp_Negate },
   { "prepopulate", 0, opt_prepopulate, Clp_ValInt, Clp_Optional },
-  { "seed", 's', opt_seed, Clp_ValUnsigned, 0 }
+  { "seed", 's', opt_seed, Clp_ValUnsigned, 0 },
+  { "decentralized-tids", 0, opt_dtids, 0, Clp_Negate },
+  { "tid-scaling", 0, opt_tidscaling, 0, Clp_Negate },
+  { "readonlypercent", 0, opt_readonlypercent, Clp_ValDouble, 0 },
+  { "readonly-api", 0, opt_roapi, 0, Clp_Negate },
+  { "ro-sweep", 0, opt_rosweep, 0, Clp_Negate },
+  { "nothrow", 0, opt_nothrow, 0, Clp_Negate },
+  { "nothrow-compare", 0, opt_nothrowcompare, 0, Clp_Negate },
+  { "hotslots", 0, opt_hotslots, Clp_ValInt, 0 },
+  { "cm", 0, opt_cm, Clp_ValString, 0 },
+  { "abort-telemetry", 0, opt_aborttelemetry, Clp_ValUnsigned, 0 },
+  { "stats-interval", 0, opt_statsinterval, Clp_ValDouble, 0 },
+  { "epoch-interval", 0, opt_epochinterval, Clp_ValUnsigned, 0 },
+  { "epoch-pending", 0, opt_epochpending, Clp_ValUnsigned, 0 },
+  { "batch", 0, opt_batch, Clp_ValInt, 0 },
+  { "batch-compare", 0, opt_batchcompare, 0, Clp_Negate }
 };
 
 static void help(const char *name) {
@@ -1174,8 +1507,24 @@ Options:\n\
  --writepercent=WRITEPERCENT, probability with which to do writes versus reads (default %f)\n\
  --blindrandwrites, do blind random writes for random tests. makes checking impossible\n\
  --prepopulate=PREPOPULATE, prepopulate table with given number of items (default %d)\n\
- --seed=SEED\n",
-         name, nthreads, ntrans, opspertrans, write_percent, prepopulate);
+ --seed=SEED\n\
+ --decentralized-tids, use per-thread commit TIDs instead of the global clock\n\
+ --tid-scaling, compare throughput of both commit TID modes at 1..NTHREADS threads\n\
+ --readonlypercent=F, fraction of read-only transactions in readonlymix (default %f)\n\
+ --no-readonly-api, run readonlymix readers as ordinary transactions\n\
+ --ro-sweep, compare readonlymix readers with and without the read-only API\n\
+ --nothrow, run aborthot with non-throwing transactions\n\
+ --nothrow-compare, compare aborthot with throwing and non-throwing transactions\n\
+ --hotslots=N, number of slots aborthot touches (default %d)\n\
+ --cm=POLICY, contention management policy: spin, exponential, randomized, adaptive (default %s)\n\
+ --abort-telemetry=N, record 1 in N aborts and report the hottest objects and keys\n\
+ --stats-interval=SECONDS, write a JSON stats delta to stderr every SECONDS while running\n\
+ --epoch-interval=USEC, epoch advance interval (default %u)\n\
+ --epoch-pending=N, advance the epoch early once N RCU callbacks are pending\n\
+ --batch=N, run smalltxns through Sto::run_batch, N transactions per call\n\
+ --batch-compare, compare smalltxns with and without batching\n",
+         name, nthreads, ntrans, opspertrans, write_percent, prepopulate, readonly_percent, hot_slots,
+         ContentionManager::policy_name(ContentionManager::policy), Transaction::epoch_interval);
   printf("\nTests:\n");
   size_t testidx = 0;
   for (size_t ti = 0; ti != sizeof(tests)/sizeof(tests[0]); ++ti)
@@ -1238,6 +1587,55 @@ int main(int argc, char *argv[]) {
     case opt_seed:
         seed = clp->val.u;
         break;
+    case opt_dtids:
+      Transaction::decentralized_tids = !clp->negated;
+      break;
+    case opt_tidscaling:
+      tidScaling = !clp->negated;
+      break;
+    case opt_readonlypercent:
+      readonly_percent = clp->val.d;
+      break;
+    case opt_roapi:
+      readOnlyApi = !clp->negated;
+      break;
+    case opt_rosweep:
+      roSweep = !clp->negated;
+      break;
+    case opt_nothrow:
+      noThrow = !clp->negated;
+      break;
+    case opt_nothrowcompare:
+      noThrowCompare = !clp->negated;
+      break;
+    case opt_hotslots:
+      hot_slots = clp->val.i;
+      break;
+    case opt_statsinterval:
+      statsInterval = clp->val.d;
+      break;
+    case opt_epochinterval:
+      Transaction::epoch_interval = clp->val.u;
+      break;
+    case opt_epochpending:
+      Transaction::epoch_pending_threshold = clp->val.u;
+      break;
+    case opt_batch:
+      batchSize = clp->val.i;
+      break;
+    case opt_batchcompare:
+      batchCompare = !clp->negated;
+      break;
+    case opt_aborttelemetry:
+      AbortTelemetry::enabled = clp->val.u != 0;
+      AbortTelemetry::sample_period = clp->val.u;
+      break;
+    case opt_cm:
+      if (!ContentionManager::parse_policy(clp->val.s, ContentionManager::policy)) {
+        fprintf(stderr, "unknown contention policy %s\n", clp->val.s);
+        exit(1);
+      }
+      break;
     default:
       help(argv[0]);
     }
@@ -1293,15 +1691,34 @@ int main(int argc, char *argv[]) {
   }
 
   Tester* tester = tests[test].tester;
+  if (tidScaling) {
+    tid_scaling(tester);
+    return 0;
+  }
+  if (roSweep) {
+    ro_sweep(tester);
+    return 0;
+  }
+  if (noThrowCompare) {
+    nothrow_compare(tester);
+    return 0;
+  }
+  if (batchCompare) {
+    batch_compare(tester);
+    return 0;
+  }
   tester->initialize();
 
   struct timeval tv1,tv2;
   struct rusage ru1,ru2;
+  if (statsInterval > 0)
+    StoStats::stream(STDERR_FILENO, statsInterval);
   gettimeofday(&tv1, NULL);
   getrusage(RUSAGE_SELF, &ru1);
   startAndWait(nthreads, tester);
   gettimeofday(&tv2, NULL);
   getrusage(RUSAGE_SELF, &ru2);
+  StoStats::stop_stream();
 #if !DATA_COLLECT
   printf("real time: ");
 #endif
@@ -1323,6 +1740,13 @@ int main(int argc, char *argv[]) {
   printf("  STO_SORT_WRITESET: %d\n", STO_SORT_WRITESET);
 #endif
 
+#if !STO_PROFILE_COUNTERS
+  if (AbortTelemetry::enabled)
+      AbortTelemetry::print(stderr, 5);
+# if STO_LATENCY_HISTOGRAMS
+  Transaction::print_latency_stats(stderr);
+# endif
+#endif
 #if STO_PROFILE_COUNTERS
   Transaction::print_stats();
   if (txp_count >= txp_total_aborts) {
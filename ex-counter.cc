@@ -9,7 +9,7 @@
 #include "randgen.hh"
 #include "clp.h"
 #define GUARDED if (TransactionGuard tguard{})
-unsigned initial_seeds[64];
+unsigned initial_seeds[2 * MAX_THREADS];
 unsigned ops_per_trans = 1;
 double usleep_fraction = 0.1;
 
@@ -0,0 +1,157 @@
+// FlatHashtable vs. Hashtable. Each table is loaded with NKEYS keys,
+// then runs NTXNS transactions of NOPS lookups, a WRITEPERCENT fraction
+// of which also write the key back incremented. Keys are drawn
+// uniformly and from a scrambled Zipfian distribution (YCSB-style,
+// --theta, default 0.99). Runs 1M and 100M keys unless --nkeys is given;
+// 100M keys needs about 10GB of memory.
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "FlatHashtable.hh"
+#include "clp.h"
+
+static unsigned nops = 4;
+static unsigned ntxns = 2000000;
+static double write_percent = 0.1;
+static double theta = 0.99;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+static double drand() {
+    return (double) random() / ((double) RAND_MAX + 1);
+}
+
+class zipf_generator {
+public:
+    zipf_generator(uint64_t n, double theta)
+        : n_(n), theta_(theta) {
+        double zeta2 = 0;
+        zetan_ = 0;
+        for (uint64_t i = 1; i <= n; ++i) {
+            zetan_ += 1 / pow(i, theta);
+            if (i == 2)
+                zeta2 = zetan_;
+        }
+        alpha_ = 1 / (1 - theta);
+        eta_ = (1 - pow(2.0 / n, 1 - theta)) / (1 - zeta2 / zetan_);
+    }
+    // scrambled, so the hottest keys are spread over the table
+    uint64_t operator()() {
+        double u = drand(), uz = u * zetan_;
+        uint64_t rank;
+        if (uz < 1)
+            rank = 0;
+        else if (uz < 1 + pow(0.5, theta_))
+            rank = 1;
+        else
+            rank = n_ * pow(eta_ * u - eta_ + 1, alpha_);
+        return (std::min(rank, n_ - 1) * 0x9E3779B97F4A7C15ULL) % n_;
+    }
+private:
+    uint64_t n_;
+    double theta_, zetan_, alpha_, eta_;
+};
+
+template <typename T>
+static void run(const char* name, const char* dist, T& table, const std::vector<int>& keys) {
+    unsigned nwrite = unsigned(write_percent * nops + 0.5);
+    double t0 = now();
+    for (unsigned i = 0; i != ntxns; ++i) {
+        const int* k = &keys[i * nops];
+        TRANSACTION {
+            for (unsigned j = 0; j != nops; ++j) {
+                int v = 0;
+                table.transGet(k[j], v);
+                if (j < nwrite)
+                    table.transPut(k[j], v + 1);
+            }
+        } RETRY(true);
+    }
+    double t1 = now();
+    printf("%-14s %-8s %10.0f txns/s\n", name, dist, ntxns / (t1 - t0));
+}
+
+static void run_all(unsigned nkeys) {
+    printf("%u keys:\n", nkeys);
+    std::vector<int> uniform(ntxns * nops), zipf(ntxns * nops);
+    for (auto& k : uniform)
+        k = random() % nkeys;
+    zipf_generator zg(nkeys, theta);
+    for (auto& k : zipf)
+        k = zg();
+
+    {
+        Hashtable<int, int> table(nkeys);
+        for (unsigned i = 0; i != nkeys; ++i)
+            table.nontrans_insert(i, i);
+        run("Hashtable", "uniform", table, uniform);
+        run("Hashtable", "zipf", table, zipf);
+    }
+    {
+        FlatHashtable<int, int> table(nkeys);
+        for (unsigned i = 0; i != nkeys; ++i)
+            table.nontrans_insert(i, i);
+        run("FlatHashtable", "uniform", table, uniform);
+        run("FlatHashtable", "zipf", table, zipf);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--nkeys=N]... [--nops=N] [--ntxns=N] [--writepercent=F] [--theta=F]\n", name);
+    exit(1);
+}
+
+enum { opt_nkeys = 1, opt_nops, opt_ntxns, opt_writepercent, opt_theta };
+
+static const Clp_Option options[] = {
+    { "nkeys", 'k', opt_nkeys, Clp_ValUnsigned, 0 },
+    { "nops", 'o', opt_nops, Clp_ValUnsigned, 0 },
+    { "ntxns", 'n', opt_ntxns, Clp_ValUnsigned, 0 },
+    { "writepercent", 'w', opt_writepercent, Clp_ValDouble, 0 },
+    { "theta", 't', opt_theta, Clp_ValDouble, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    std::vector<unsigned> sizes;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nkeys:
+            sizes.push_back(clp->val.u);
+            break;
+        case opt_nops:
+            nops = std::max(clp->val.u, 1U);
+            break;
+        case opt_ntxns:
+            ntxns = clp->val.u;
+            break;
+        case opt_writepercent:
+            write_percent = clp->val.d;
+            break;
+        case opt_theta:
+            theta = clp->val.d;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (sizes.empty())
+        sizes = {1000000, 100000000};
+
+    for (unsigned n : sizes)
+        run_all(n);
+    return 0;
+}
@@ -0,0 +1,175 @@
+// Interleaved execution benchmark. Transactions each look up NOPS random
+// keys in a Hashtable of NKEYS keys (default 10M, far larger than the
+// cache) and write the sum of the values to one more key. "plain" runs
+// them one at a time; each --depth=D run uses an InterleavedExecutor
+// with D slots, yielding after prefetching each bucket and chain head.
+// Built with CXX20=1, each depth also runs coroutine tasks that use
+// Hashtable::co_transGet.
+
+#include <iostream>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "Interleave.hh"
+#include "clp.h"
+
+typedef Hashtable<int, int> table_type;
+
+static unsigned nkeys = 10000000;
+static unsigned nops = 4;
+static unsigned ntxns = 1000000;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+struct lookup_task {
+    table_type* table;
+    const int* keys;            // nops lookups, then the key to write
+    unsigned pos;
+    unsigned stage;
+    int sum;
+
+    void reset() {
+        pos = stage = 0;
+        sum = 0;
+    }
+    bool step() {
+        int k = keys[pos];
+        if (stage == 0) {
+            table->prefetch(k);
+            stage = 1;
+            return false;
+        } else if (stage == 1) {
+            table->prefetch_chain(k);
+            stage = 2;
+            return false;
+        }
+        stage = 0;
+        if (pos == nops) {
+            table->transPut(k, sum);
+            return true;
+        }
+        int v;
+        if (table->transGet(k, v))
+            sum += v;
+        ++pos;
+        return false;
+    }
+};
+
+static void run_plain(table_type& table, const std::vector<int>& keys) {
+    double t0 = now();
+    for (unsigned i = 0; i != ntxns; ++i) {
+        const int* k = &keys[i * (nops + 1)];
+        TRANSACTION {
+            int sum = 0, v;
+            for (unsigned j = 0; j != nops; ++j)
+                if (table.transGet(k[j], v))
+                    sum += v;
+            table.transPut(k[nops], sum);
+        } RETRY(true);
+    }
+    double t1 = now();
+    printf("plain:    %10.0f txns/s\n", ntxns / (t1 - t0));
+}
+
+static void run_interleaved(table_type& table, const std::vector<int>& keys, unsigned depth) {
+    std::vector<lookup_task> tasks(ntxns);
+    for (unsigned i = 0; i != ntxns; ++i) {
+        tasks[i].table = &table;
+        tasks[i].keys = &keys[i * (nops + 1)];
+    }
+    InterleavedExecutor<lookup_task> exec(depth);
+    double t0 = now();
+    uint64_t naborts = exec.run(tasks.begin(), tasks.end());
+    double t1 = now();
+    printf("depth %2u: %10.0f txns/s, %llu aborts\n", depth, ntxns / (t1 - t0),
+           (unsigned long long) naborts);
+}
+
+#if STO_COROUTINES
+static void run_coroutine(table_type& table, const std::vector<int>& keys, unsigned depth) {
+    std::vector<CoroutineTask> tasks;
+    tasks.reserve(ntxns);
+    for (unsigned i = 0; i != ntxns; ++i) {
+        const int* k = &keys[i * (nops + 1)];
+        tasks.emplace_back([&table, k]() -> Coroutine<void> {
+                int sum = 0, v;
+                for (unsigned j = 0; j != nops; ++j)
+                    if (co_await table.co_transGet(k[j], v))
+                        sum += v;
+                table.transPut(k[nops], sum);
+            });
+    }
+    InterleavedExecutor<CoroutineTask> exec(depth);
+    double t0 = now();
+    uint64_t naborts = exec.run(tasks.begin(), tasks.end());
+    double t1 = now();
+    printf("coro %2u:  %10.0f txns/s, %llu aborts\n", depth, ntxns / (t1 - t0),
+           (unsigned long long) naborts);
+}
+#endif
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--nkeys=N] [--nops=N] [--ntxns=N] [--depth=D]...\n", name);
+    exit(1);
+}
+
+enum { opt_nkeys = 1, opt_nops, opt_ntxns, opt_depth };
+
+static const Clp_Option options[] = {
+    { "nkeys", 'k', opt_nkeys, Clp_ValUnsigned, 0 },
+    { "nops", 'o', opt_nops, Clp_ValUnsigned, 0 },
+    { "ntxns", 'n', opt_ntxns, Clp_ValUnsigned, 0 },
+    { "depth", 'd', opt_depth, Clp_ValUnsigned, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    std::vector<unsigned> depths;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nkeys:
+            nkeys = clp->val.u;
+            break;
+        case opt_nops:
+            nops = clp->val.u;
+            break;
+        case opt_ntxns:
+            ntxns = clp->val.u;
+            break;
+        case opt_depth:
+            depths.push_back(std::max(clp->val.u, 1U));
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (depths.empty())
+        depths = {1, 2, 4, 8, 16};
+
+    table_type table(nkeys);
+    for (unsigned i = 0; i != nkeys; ++i)
+        table.nontrans_insert(i, i);
+    std::vector<int> keys(ntxns * (nops + 1));
+    for (auto& k : keys)
+        k = random() % nkeys;
+
+    run_plain(table, keys);
+    for (unsigned d : depths) {
+        run_interleaved(table, keys, d);
+#if STO_COROUTINES
+        run_coroutine(table, keys, d);
+#endif
+    }
+    return 0;
+}
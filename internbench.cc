@@ -0,0 +1,135 @@
+// Key interning microbenchmark. The "buffer" test packs NKEYS distinct
+// std::string item keys into a TransactionBuffer twice each, as a
+// transaction that reads then writes every key would, comparing the
+// hashed TransactionBuffer::intern against the old linear find().
+// The "masstrans" test runs MassTrans<std::string> transactions that
+// read and write NKEYS string keys. Both run at 10, 100 and 1000 keys
+// unless --nkeys is given.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include "Transaction.hh"
+#include "StringWrapper.hh"
+#include "MassTrans.hh"
+#include "clp.h"
+
+static int ntrials = 2000;
+
+static std::vector<std::string> make_keys(unsigned nkeys) {
+    std::vector<std::string> keys;
+    for (unsigned i = 0; i != nkeys; ++i) {
+        char buf[64];
+        sprintf(buf, "user:%08u:profile", i * 2654435761U);
+        keys.push_back(buf);
+    }
+    return keys;
+}
+
+static void* linear_pack_unique(TransactionBuffer& buf, const std::string& x) {
+    if (const void* ptr = buf.find<UniqueKey<std::string> >(x))
+        return const_cast<void*>(ptr);
+    else
+        return buf.allocate<UniqueKey<std::string> >(x);
+}
+
+template <typename F>
+static double buffer_cycles(const std::vector<std::string>& keys, F pack_unique) {
+    TransactionBuffer buf;
+    uintptr_t sum = 0;
+    uint64_t t0 = read_tsc();
+    for (int trial = 0; trial != ntrials; ++trial) {
+        for (int pass = 0; pass != 2; ++pass)
+            for (auto& k : keys)
+                sum += reinterpret_cast<uintptr_t>(pack_unique(buf, k));
+        buf.clear();
+    }
+    uint64_t t1 = read_tsc();
+    always_assert(sum != 0);
+    return (double) (t1 - t0) / ntrials;
+}
+
+static void run_buffer(unsigned nkeys) {
+    auto keys = make_keys(nkeys);
+    double linear = buffer_cycles(keys, linear_pack_unique);
+    double hashed = buffer_cycles(keys, Packer<std::string>::pack_unique);
+    printf("buffer    %5u keys: %12.0f cycles/txn linear, %12.0f hashed (%.1fx)\n",
+           nkeys, linear, hashed, linear / hashed);
+}
+
+static void run_masstrans(unsigned nkeys) {
+    typedef MassTrans<std::string> table_type;
+    table_type table;
+    table_type::static_init();
+    table_type::thread_init();
+    auto keys = make_keys(nkeys);
+    for (auto& k : keys) {
+        TRANSACTION {
+            table.transPut(k, k);
+        } RETRY(false);
+    }
+
+    uint64_t t0 = read_tsc();
+    for (int trial = 0; trial != ntrials; ++trial) {
+        TRANSACTION {
+            std::string v;
+            for (auto& k : keys) {
+                table.transGet(k, v);
+                table.transPut(k, v);
+            }
+        } RETRY(false);
+    }
+    uint64_t t1 = read_tsc();
+    printf("masstrans %5u keys: %12.0f cycles/txn\n",
+           nkeys, (double) (t1 - t0) / ntrials);
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [buffer|masstrans] [--nkeys=N] [--ntrials=T]\n", name);
+    exit(1);
+}
+
+enum { opt_nkeys = 1, opt_ntrials };
+
+static const Clp_Option options[] = {
+    { "nkeys", 'n', opt_nkeys, Clp_ValUnsigned, 0 },
+    { "ntrials", 't', opt_ntrials, Clp_ValInt, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    const char* test = nullptr;
+    std::vector<unsigned> sizes;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nkeys:
+            sizes.push_back(clp->val.u);
+            break;
+        case opt_ntrials:
+            ntrials = clp->val.i;
+            break;
+        case Clp_NotOption:
+            test = clp->vstr;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+    Clp_DeleteParser(clp);
+    if (test && strcmp(test, "buffer") != 0 && strcmp(test, "masstrans") != 0)
+        usage(argv[0]);
+    if (sizes.empty())
+        sizes = {10, 100, 1000};
+
+    for (unsigned n : sizes) {
+        if (!test || strcmp(test, "buffer") == 0)
+            run_buffer(n);
+        if (!test || strcmp(test, "masstrans") == 0)
+            run_masstrans(n);
+    }
+    return 0;
+}
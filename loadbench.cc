@@ -0,0 +1,158 @@
+// Startup time: loading NKEYS keys into Hashtable, RBTree and MassTrans one
+// transaction at a time (as concurrent.cc's prepopulation does), one
+// non-transactional insert at a time, and with bulk_load on NTHREADS
+// threads. Hashtable keys are loaded in random order, RBTree and MassTrans
+// keys in sorted order. Nothing is freed between runs, so large NKEYS
+// need a lot of memory; --ds picks a single structure.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "RBTree.hh"
+#include "MassTrans.hh"
+#include "clp.h"
+
+static unsigned nkeys = 1000000;
+static unsigned nthreads = 4;
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+template <typename F>
+static void run(const char* name, const char* how, F f) {
+    double t0 = now();
+    f();
+    double t = now() - t0;
+    printf("%-10s %-12s %8.3f s %12.0f keys/s\n", name, how, t, nkeys / t);
+}
+
+static void run_hashtable(const char* bulk) {
+    std::vector<std::pair<int, int>> kv;
+    for (unsigned i = 0; i != nkeys; ++i)
+        kv.push_back(std::make_pair(i, i + 1));
+    std::random_shuffle(kv.begin(), kv.end());
+
+    run("Hashtable", "txn", [&] {
+        auto h = new Hashtable<int, int>;
+        for (auto& p : kv) {
+            TRANSACTION {
+                h->transPut(p.first, p.second);
+            } RETRY(false);
+        }
+    });
+    run("Hashtable", "nontrans", [&] {
+        auto h = new Hashtable<int, int>;
+        for (auto& p : kv)
+            h->nontrans_insert(p.first, p.second);
+    });
+    run("Hashtable", bulk, [&] {
+        auto h = new Hashtable<int, int>;
+        h->bulk_load(kv.begin(), kv.end(), nthreads);
+    });
+}
+
+static void run_rbtree() {
+    std::vector<std::pair<int, int>> kv;
+    for (unsigned i = 0; i != nkeys; ++i)
+        kv.push_back(std::make_pair(i, i + 1));
+
+    run("RBTree", "txn", [&] {
+        auto t = new RBTree<int, int, true>;
+        for (auto& p : kv) {
+            TRANSACTION {
+                (*t)[p.first] = p.second;
+            } RETRY(false);
+        }
+    });
+    run("RBTree", "nontrans", [&] {
+        auto t = new RBTree<int, int, true>;
+        for (auto& p : kv)
+            t->nontrans_insert(p.first, p.second);
+    });
+    run("RBTree", "bulk", [&] {
+        auto t = new RBTree<int, int, true>;
+        t->bulk_load(kv.begin(), kv.end());
+    });
+}
+
+static void run_masstree(const char* bulk) {
+    // fixed-width keys, so string order is numeric order
+    std::vector<std::pair<std::string, int>> kv;
+    char buf[16];
+    for (unsigned i = 0; i != nkeys; ++i) {
+        snprintf(buf, sizeof(buf), "%010u", i);
+        kv.push_back(std::make_pair(std::string(buf), i + 1));
+    }
+
+    run("MassTrans", "txn", [&] {
+        auto m = new MassTrans<int>;
+        for (auto& p : kv) {
+            TRANSACTION {
+                m->transPut(p.first, p.second);
+            } RETRY(false);
+        }
+    });
+    run("MassTrans", bulk, [&] {
+        auto m = new MassTrans<int>;
+        m->bulk_load(kv.begin(), kv.end(), nthreads);
+    });
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--nkeys=N] [-j NTHREADS] [--ds=hashtable|rbtree|masstree]\n", name);
+    exit(1);
+}
+
+enum { opt_nkeys = 1, opt_nthreads, opt_ds };
+
+static const Clp_Option options[] = {
+    { "nkeys", 'k', opt_nkeys, Clp_ValUnsigned, 0 },
+    { "nthreads", 'j', opt_nthreads, Clp_ValUnsigned, 0 },
+    { "ds", 0, opt_ds, Clp_ValString, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    const char* ds = nullptr;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nkeys:
+            nkeys = clp->val.u;
+            break;
+        case opt_nthreads:
+            nthreads = std::max(clp->val.u, 1U);
+            break;
+        case opt_ds:
+            ds = clp->val.s;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    MassTrans<int>::static_init();
+    MassTrans<int>::thread_init();
+
+    char bulk[32];
+    snprintf(bulk, sizeof(bulk), "bulk -j%u", nthreads);
+    printf("%u keys:\n", nkeys);
+    if (!ds || strcmp(ds, "hashtable") == 0)
+        run_hashtable(bulk);
+    if (!ds || strcmp(ds, "rbtree") == 0)
+        run_rbtree();
+    if (!ds || strcmp(ds, "masstree") == 0)
+        run_masstree(bulk);
+    Clp_DeleteParser(clp);
+    return 0;
+}
@@ -0,0 +1,141 @@
+// transMultiGet vs. a transGet loop. Hashtable and MassTrans are loaded
+// with NKEYS keys, then run read-only transactions of BATCH uniformly
+// random keys, for batch sizes 1 to 100, NLOOKUPS keys per run.
+// --ds picks a single structure.
+
+#include <iostream>
+#include <vector>
+#include <string>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <sys/time.h>
+#include "Transaction.hh"
+#include "Hashtable.hh"
+#include "MassTrans.hh"
+#include "clp.h"
+
+static unsigned nkeys = 10000000;
+static unsigned nlookups = 4000000;
+static const unsigned batches[] = {1, 2, 4, 8, 16, 32, 64, 100};
+
+static double now() {
+    struct timeval tv;
+    gettimeofday(&tv, nullptr);
+    return tv.tv_sec + tv.tv_usec / 1e6;
+}
+
+// runs f(first key index, batch size) once per transaction
+template <typename F>
+static double run(unsigned batch, F f) {
+    unsigned ntxns = nlookups / batch;
+    double t0 = now();
+    for (unsigned i = 0; i != ntxns; ++i) {
+        TRANSACTION {
+            f((i * batch) % (nlookups - batch + 1), batch);
+        } RETRY(true);
+    }
+    return ntxns * batch / (now() - t0);
+}
+
+static void report(const char* name, unsigned batch, double single, double multi) {
+    printf("%-10s %5u %14.0f %14.0f  %5.2fx\n", name, batch, single, multi, multi / single);
+}
+
+static void run_hashtable(const std::vector<unsigned>& order) {
+    Hashtable<int, int> h;
+    std::vector<std::pair<int, int>> kv;
+    for (unsigned i = 0; i != nkeys; ++i)
+        kv.push_back(std::make_pair(i, i));
+    h.bulk_load(kv.begin(), kv.end());
+    std::vector<int> keys(order.begin(), order.end());
+    int values[100];
+    bool found[100];
+
+    for (unsigned batch : batches) {
+        double single = run(batch, [&](unsigned first, unsigned n) {
+            for (unsigned j = 0; j != n; ++j)
+                found[j] = h.transGet(keys[first + j], values[j]);
+        });
+        double multi = run(batch, [&](unsigned first, unsigned n) {
+            h.transMultiGet(&keys[first], n, values, found);
+        });
+        report("Hashtable", batch, single, multi);
+    }
+}
+
+static void run_masstree(const std::vector<unsigned>& order) {
+    MassTrans<int> m;
+    // fixed-width keys, so string order is numeric order
+    std::vector<std::pair<std::string, int>> kv;
+    char buf[16];
+    for (unsigned i = 0; i != nkeys; ++i) {
+        snprintf(buf, sizeof(buf), "%010u", i);
+        kv.push_back(std::make_pair(std::string(buf), i));
+    }
+    m.bulk_load(kv.begin(), kv.end());
+    std::vector<MassTrans<int>::Str> keys;
+    for (unsigned k : order)
+        keys.push_back(kv[k].first);
+    int values[100];
+    bool found[100];
+
+    for (unsigned batch : batches) {
+        double single = run(batch, [&](unsigned first, unsigned n) {
+            for (unsigned j = 0; j != n; ++j)
+                found[j] = m.transGet(keys[first + j], values[j]);
+        });
+        double multi = run(batch, [&](unsigned first, unsigned n) {
+            m.transMultiGet(&keys[first], n, values, found);
+        });
+        report("MassTrans", batch, single, multi);
+    }
+}
+
+static void usage(const char* name) {
+    fprintf(stderr, "Usage: %s [--nkeys=N] [--nlookups=N] [--ds=hashtable|masstree]\n", name);
+    exit(1);
+}
+
+enum { opt_nkeys = 1, opt_nlookups, opt_ds };
+
+static const Clp_Option options[] = {
+    { "nkeys", 'k', opt_nkeys, Clp_ValUnsigned, 0 },
+    { "nlookups", 'n', opt_nlookups, Clp_ValUnsigned, 0 },
+    { "ds", 0, opt_ds, Clp_ValString, 0 }
+};
+
+int main(int argc, char* argv[]) {
+    Clp_Parser* clp = Clp_NewParser(argc, argv, arraysize(options), options);
+    const char* ds = nullptr;
+    int opt;
+    while ((opt = Clp_Next(clp)) != Clp_Done) {
+        switch (opt) {
+        case opt_nkeys:
+            nkeys = std::max(clp->val.u, 1U);
+            break;
+        case opt_nlookups:
+            nlookups = std::max(clp->val.u, 100U);
+            break;
+        case opt_ds:
+            ds = clp->val.s;
+            break;
+        default:
+            usage(argv[0]);
+        }
+    }
+
+    MassTrans<int>::static_init();
+    MassTrans<int>::thread_init();
+
+    std::vector<unsigned> order(nlookups);
+    for (auto& k : order)
+        k = random() % nkeys;
+    printf("%u keys:\n%-10s %5s %14s %14s\n", nkeys, "", "batch", "transGet/s", "multiGet/s");
+    if (!ds || strcmp(ds, "hashtable") == 0)
+        run_hashtable(order);
+    if (!ds || strcmp(ds, "masstree") == 0)
+        run_masstree(order);
+    Clp_DeleteParser(clp);
+    return 0;
+}
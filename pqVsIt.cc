@@ -22,7 +22,7 @@ int prepopulate = 1000;
 double push_percent = 0.75;
 int blocks = 1000;
 int runtime = 10;
-unsigned initial_seeds[128];
+unsigned initial_seeds[2 * MAX_THREADS];
 
 volatile bool running = true;
 
@@ -16,7 +16,7 @@
 #define N_THREADS 4
 
 typedef PriorityQueue<int> data_structure;
-unsigned initial_seeds[128];
+unsigned initial_seeds[2 * MAX_THREADS];
 
 
 struct txn_record {
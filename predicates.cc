@@ -24,7 +24,7 @@ double pushback_percent = 0.2; // pop_percent will be the same to keep the size
 
 unsigned find_aborts[32];
 uint64_t checksums[32];
-uint32_t initial_seeds[64];
+uint32_t initial_seeds[2 * MAX_THREADS];
 int unsuccessful_finds = 0;
 TransactionTid::type lock;
 
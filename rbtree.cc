@@ -240,6 +240,106 @@ void mem_tests() {
     }
 }
 
+void bulk_load_tests() {
+    for (int n : {0, 1, 2, 3, 7, 8, 1000}) {
+        tree_type tree;
+        std::vector<std::pair<int, int>> kv;
+        for (int i = 0; i < n; ++i)
+            kv.push_back(PAIR(2 * i, i));
+        // unsorted input is sorted first
+        if (n > 2)
+            std::swap(kv[0], kv[n - 1]);
+        tree.bulk_load(kv.begin(), kv.end());
+        tree.debug_check();
+        TransactionGuard t;
+        assert((int) tree.size() == n);
+        for (int i = 0; i < n; ++i) {
+            assert(tree.count(2 * i) == 1 && tree[2 * i] == i);
+            assert(tree.count(2 * i + 1) == 0);
+        }
+    }
+    {
+        // loaded nodes behave like committed ones
+        tree_type tree;
+        std::vector<std::pair<int, int>> kv;
+        for (int i = 0; i < 100; ++i)
+            kv.push_back(PAIR(2 * i, i));
+        tree.bulk_load(kv.begin(), kv.end());
+        TestTransaction t1(1), t2(2), t3(3);
+        t1.use();
+        assert(tree.count(51) == 0);
+        int x = tree[50];
+        assert(x == 25);
+        t2.use();
+        tree[51] = 51;
+        assert(t2.try_commit());
+        t3.use();
+        tree.erase(60);
+        assert(t3.try_commit());
+        t1.use();
+        tree[52] = 0;
+        assert(!t1.try_commit());
+        tree.debug_check();
+    }
+}
+
+void nothrow_tests() {
+    tree_type tree;
+    reset_tree(tree);
+    Sto::start_nothrow_transaction();
+    tree[5] = 5;
+    Sto::abort();
+    assert(Sto::aborted());
+    // the abort's cleanup has run: an insert must not link a node now
+    tree[4] = 4;
+    int x = tree[6];
+    assert(x == 0);
+    assert(!Sto::try_commit());
+    tree.debug_check();
+    {
+        TransactionGuard t;
+        assert(tree.count(4) == 0 && tree.count(5) == 0 && tree.count(6) == 0);
+        assert(tree.size() == 3);
+        tree[4] = 44;
+    }
+    {
+        TransactionGuard t;
+        int y = tree[4];
+        assert(y == 44);
+    }
+}
+
+#if STO_COROUTINES
+void coroutine_tests() {
+    tree_type tree;
+    {
+        TransactionGuard t;
+        for (int i = 0; i < 1000; i += 2)
+            tree[i] = i;
+    }
+    std::vector<int> counts(200, -1);
+    std::vector<CoroutineTask> tasks;
+    for (int i = 0; i < 200; ++i)
+        tasks.emplace_back([&tree, &counts, i]() -> Coroutine<void> {
+                int n = co_await tree.co_count(i);
+                // odd keys are inserted while other slots are mid-descent
+                if (i % 2)
+                    tree[i] = i;
+                counts[i] = n;
+            });
+    InterleavedExecutor<CoroutineTask> exec(8);
+    exec.run(tasks.begin(), tasks.end());
+    for (int i = 0; i < 200; ++i)
+        assert(counts[i] == !(i % 2));
+    {
+        TransactionGuard t;
+        assert(tree.size() == 600);
+        assert(tree.count(199) == 1 && tree.count(201) == 0);
+    }
+    tree.debug_check();
+}
+#endif
+
 int main() {
     // test single-threaded operations
     {
@@ -296,6 +396,11 @@ int main() {
     update_conflict_tests();
     insert_then_delete_tests();
     mem_tests();
+    bulk_load_tests();
+    nothrow_tests();
+#if STO_COROUTINES
+    coroutine_tests();
+#endif
     // test abort-cleanup
     std::cout << "ALL TESTS PASS!!" << std:: endl;
     return 0;
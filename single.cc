@@ -1,6 +1,8 @@
 #include <iostream>
 #include <assert.h>
 #include <stdio.h>
+#include <stdlib.h>
+#include <thread>
 
 #include "Hashtable.hh"
 #include "MassTrans.hh"
@@ -453,6 +455,45 @@ void basicQueryTests(MassTrans<K, V>& h) {
 template <typename T>
 void basicQueryTests(T&) {}
 
+template <typename MapType>
+void uncommittedInsertTests(MapType& h) {
+  int vunused = 0;
+  TestTransaction t9(3);
+  assert(h.transInsert(3, 0));
+  TestTransaction t10(4);
+  assert(h.transInsert(4, 4));
+  try{
+    // t9 inserted invalid node, so we are forced to abort
+    h.transUpdate(3, vunused);
+    assert(0);
+  } catch (Transaction::Abort E) {}
+  TestTransaction t10_2(5);
+  try {
+    // deletes should also force abort from invalid nodes
+    h.transDelete(3);
+    assert(0);
+  } catch (Transaction::Abort E) {}
+  assert(t9.try_commit());
+  assert(!t10.try_commit() && !t10_2.try_commit());
+}
+
+template <typename K, typename V>
+void uncommittedInsertTests(Hashtable<K, V>& h) {
+  // Hashtable reads t9's uncommitted insert as absent; the conflict
+  // shows up when t9 commits first
+  int vunused = 0;
+  TestTransaction t9(3);
+  assert(h.transInsert(3, 0));
+  TestTransaction t10(4);
+  assert(h.transInsert(4, 4));
+  assert(!h.transUpdate(3, vunused));
+  TestTransaction t10_2(5);
+  assert(!h.transDelete(3));
+  h.transPut(1000, 0);
+  assert(t9.try_commit());
+  assert(!t10.try_commit() && !t10_2.try_commit());
+}
+
 template <typename MapType>
 void basicMapTests(MapType& h) {
   typedef int Value;
@@ -504,23 +545,7 @@ void basicMapTests(MapType& h) {
 
   assert(!t7.try_commit());
 
-  TestTransaction t9(3);
-  assert(h.transInsert(3, 0));
-  TestTransaction t10(4);
-  assert(h.transInsert(4, 4));
-  try{
-    // t9 inserted invalid node, so we are forced to abort
-    h.transUpdate(3, vunused);
-    assert(0);
-  } catch (Transaction::Abort E) {}
-  TestTransaction t10_2(5);
-  try {
-    // deletes should also force abort from invalid nodes
-    h.transDelete(3);
-    assert(0);
-  } catch (Transaction::Abort E) {}
-  assert(t9.try_commit());
-  assert(!t10.try_commit() && !t10_2.try_commit());
+  uncommittedInsertTests(h);
 
   {
       TransactionGuard t11;
@@ -578,14 +603,312 @@ void basicMapTests(MapType& h) {
   basicQueryTests(h);
 }
 
+void hashtableResizeTests() {
+  Hashtable<int, int> h;
+  size_t initial = h.nbuckets();
+  int v;
+
+  // an absent-key read made before a resize must conflict with an
+  // insert into the new table
+  TestTransaction t1(1);
+  assert(!h.transGet(-1, v));
+  h.transPut(-2, 0);
+  for (int i = 0; i < 10000; ++i)
+    assert(h.nontrans_insert(i, i));
+  assert(h.nbuckets() > initial);
+  TestTransaction t2(2);
+  assert(h.transInsert(-1, 1));
+  assert(t2.try_commit());
+  assert(!t1.try_commit());
+
+  // lookups and iteration see every element, mid-migration or not
+  for (int i = 0; i < 10000; i += 100) {
+    TransactionGuard t;
+    for (int j = i; j < i + 100; ++j) {
+      assert(h.transGet(j, v) && v == j);
+      h.transPut(j, j + 1);
+    }
+  }
+  int n = 0;
+  for (auto it = h.begin(); it != h.end(); ++it)
+    ++n;
+  assert(n == 10001);
+  size_t grown = h.nbuckets();
+
+  for (int i = 0; i < 10000; i += 100) {
+    TransactionGuard t;
+    for (int j = i; j < i + 100; ++j)
+      assert(h.transDelete(j));
+  }
+  // migration advances on writes, even ones that change nothing
+  for (int i = 0; i < 10000; ++i)
+    assert(!h.nontrans_remove(-3));
+  assert(h.nbuckets() < grown && h.nbuckets() >= initial);
+  {
+    TransactionGuard t;
+    assert(h.transGet(-1, v) && v == 1);
+    assert(!h.transGet(5000, v));
+  }
+}
+
+void hashtableNontransResizeTests() {
+  // non-transactional writers grow and shrink the table while
+  // transactions read it; retired tables must outlive their readers
+  Hashtable<int, int> h;
+  for (int i = 0; i < 1000; ++i)
+    h.nontrans_insert(i, i);
+  volatile bool done = false;
+  std::vector<std::thread> writers, readers;
+  for (int w = 0; w < 2; ++w)
+    writers.emplace_back([&h, w] {
+      TThread::register_thread();
+      int base = 1000 + w * 100000;
+      for (int round = 0; round < 20; ++round) {
+        for (int i = base; i < base + 20000; ++i)
+          assert(h.nontrans_insert(i, i));
+        for (int i = base; i < base + 20000; ++i)
+          assert(h.nontrans_remove(i));
+        Transaction::epoch_sync();
+      }
+      TThread::unregister_thread();
+    });
+  for (int r = 0; r < 2; ++r)
+    readers.emplace_back([&h, &done] {
+      unsigned seed = TThread::register_thread();
+      while (!done) {
+        TRANSACTION {
+          for (int j = 0; j < 100; ++j) {
+            int k = rand_r(&seed) % 1000, v;
+            assert(h.transGet(k, v) && v == k);
+          }
+        } RETRY(true);
+      }
+      TThread::unregister_thread();
+    });
+  for (auto& t : writers)
+    t.join();
+  done = true;
+  for (auto& t : readers)
+    t.join();
+
+  int v;
+  for (int i = 0; i < 1000; ++i)
+    assert(h.nontrans_find(i, v) && v == i);
+  assert(!h.nontrans_find(1000, v));
+}
+
+void hashtableAbsentKeyTests() {
+  // one bucket, so every key shares it
+  Hashtable<int, int> h(1);
+  int v;
+  h.nontrans_insert(0, 0);
+
+  // check-then-insert of different keys doesn't conflict
+  TestTransaction t1(1);
+  assert(!h.transGet(1, v));
+  assert(h.transInsert(1, 1));
+  TestTransaction t2(2);
+  assert(!h.transGet(2, v));
+  assert(!h.transDelete(3));
+  assert(!h.transUpdate(4, 0));
+  assert(h.transInsert(2, 2));
+  assert(t1.try_commit());
+  assert(t2.try_commit());
+
+  // but does for the same key
+  TestTransaction t3(1);
+  assert(!h.transGet(5, v));
+  h.transPut(0, 3);
+  TestTransaction t4(2);
+  assert(h.transInsert(5, 5));
+  assert(t4.try_commit());
+  assert(!t3.try_commit());
+
+  // an absent key read after a delete conflicts with a reinsert, even
+  // though the deleted element is unlinked
+  {
+    TransactionGuard t;
+    assert(h.transDelete(5));
+  }
+  TestTransaction t5(1);
+  assert(!h.transGet(5, v));
+  h.transPut(0, 5);
+  TestTransaction t6(2);
+  assert(h.transInsert(5, 6));
+  assert(t6.try_commit());
+  assert(!t5.try_commit());
+
+  // and with a non-transactional insert into the placeholder
+  TestTransaction t7(1);
+  assert(!h.transGet(6, v));
+  h.transPut(0, 7);
+  assert(h.nontrans_insert(6, 6));
+  assert(!t7.try_commit());
+
+  // placeholders are invisible outside transactions
+  assert(!h.nontrans_find(3, v) && !h.nontrans_find(4, v));
+  assert(!h.nontrans_remove(3));
+  int n = 0;
+  for (auto it = h.begin(); it != h.end(); ++it)
+    ++n;
+  assert(n == 5);
+  {
+    TransactionGuard t;
+    assert(h.transGet(1, v) && v == 1);
+    assert(h.transGet(2, v) && v == 2);
+    assert(h.transGet(5, v) && v == 6);
+    assert(h.transGet(6, v) && v == 6);
+    assert(!h.transGet(3, v));
+  }
+}
+
+void hashtableBulkLoadTests() {
+  Hashtable<int, int> h;
+  int v;
+  h.nontrans_insert(-1, -1);
+  {
+    // leaves a placeholder for key 5
+    TransactionGuard t;
+    assert(!h.transGet(5, v));
+  }
+  std::vector<std::pair<int, int>> kv;
+  for (int i = 0; i < 100000; ++i)
+    kv.push_back(std::make_pair(i, i + 1));
+  h.bulk_load(kv.begin(), kv.end(), 4);
+  assert(h.nbuckets() >= 100001);
+  {
+    TransactionGuard t;
+    assert(h.transGet(-1, v) && v == -1);
+    for (int i = 0; i < 100000; ++i)
+      assert(h.transGet(i, v) && v == i + 1);
+    assert(!h.transGet(100000, v));
+  }
+
+  // loaded elements conflict like committed ones
+  TestTransaction t1(1);
+  assert(h.transGet(7, v) && v == 8);
+  h.transPut(8, 0);
+  TestTransaction t2(2);
+  assert(h.transDelete(7));
+  assert(t2.try_commit());
+  assert(!t1.try_commit());
+}
+
+void massTransBulkLoadTests() {
+  MassTrans<int> m;
+  std::vector<std::pair<std::string, int>> kv;
+  char buf[16];
+  for (int i = 0; i < 10000; ++i) {
+    snprintf(buf, sizeof(buf), "%06d", i);
+    kv.push_back(std::make_pair(std::string(buf), i));
+  }
+  m.bulk_load(kv.begin(), kv.end(), 4);
+  int v;
+  {
+    TransactionGuard t;
+    for (auto& p : kv)
+      assert(m.transGet(p.first, v) && v == p.second);
+    assert(!m.transGet("010000", v));
+  }
+  {
+    TransactionGuard t;
+    assert(m.transUpdate(kv[5].first, 17));
+    assert(m.transDelete(kv[6].first));
+  }
+  {
+    TransactionGuard t;
+    assert(m.transGet(kv[5].first, v) && v == 17);
+    assert(!m.transGet(kv[6].first, v));
+  }
+}
+
+void hashtableMultiGetTests() {
+  Hashtable<int, int> h;
+  int v;
+  for (int i = 0; i < 100; ++i)
+    h.nontrans_insert(i, i);
+
+  int keys[40];
+  int values[40];
+  bool found[40];
+  for (int i = 0; i < 40; ++i)
+    keys[i] = i * 3;
+  {
+    // reads its own inserts, updates and deletes
+    TransactionGuard t;
+    assert(h.transInsert(300, 1));
+    assert(h.transDelete(6));
+    h.transPut(9, -9);
+    keys[39] = 300;
+    keys[38] = 9;
+    assert(h.transMultiGet(keys, 40, values, found) == 35);
+    for (int i = 0; i < 40; ++i) {
+      bool f = h.transGet(keys[i], v);
+      assert(found[i] == f && (!f || values[i] == v));
+    }
+    assert(!found[2] && found[38] && values[38] == -9 && found[39] && values[39] == 1);
+  }
+
+  // absent keys conflict with inserts, present ones with updates
+  TestTransaction t1(1);
+  assert(h.transMultiGet(keys, 40, values, found) == 35);
+  h.transPut(1000, 0);
+  TestTransaction t2(2);
+  assert(h.transInsert(102, 1));
+  assert(t2.try_commit());
+  assert(!t1.try_commit());
+  TestTransaction t3(1);
+  h.transMultiGet(keys, 40, values, found);
+  h.transPut(1000, 0);
+  TestTransaction t4(2);
+  h.transPut(keys[20], 0);
+  assert(t4.try_commit());
+  assert(!t3.try_commit());
+}
+
+void massTransMultiGetTests() {
+  MassTrans<int> m;
+  m.thread_init();
+  int v;
+  {
+    TransactionGuard t;
+    for (int i = 0; i < 50; ++i)
+      m.transPut(IntStr(i).str(), i);
+  }
+  std::vector<std::string> ks;
+  for (int i = 0; i < 40; ++i)
+    ks.push_back(std::to_string(i * 2));
+  std::vector<MassTrans<int>::Str> keys(ks.begin(), ks.end());
+  int values[40];
+  bool found[40];
+  {
+    TransactionGuard t;
+    assert(m.transDelete(IntStr(4).str()));
+    m.transPut(IntStr(6).str(), -6);
+    assert(m.transMultiGet(keys.data(), 40, values, found) == 24);
+    for (int i = 0; i < 40; ++i) {
+      bool f = m.transGet(keys[i], v);
+      assert(found[i] == f && (!f || values[i] == v));
+    }
+    assert(!found[2] && found[3] && values[3] == -6);
+  }
+}
+
 int main() {
 
   // run on both Hashtable and MassTrans
   Hashtable<int, int> h;
   basicMapTests(h);
+  hashtableResizeTests();
+  hashtableNontransResizeTests();
+  hashtableAbsentKeyTests();
+  hashtableBulkLoadTests();
+  hashtableMultiGetTests();
   IntMassTrans<int> m;
   m.thread_init();
   basicMapTests(m);
+  massTransBulkLoadTests();
+  massTransMultiGetTests();
 
   // insert-then-delete node test
   insertDeleteTest(false);
@@ -0,0 +1,205 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <vector>
+#include "Transaction.hh"
+#include "FlatHashtable.hh"
+
+typedef FlatHashtable<int, int> table_type;
+
+void testSimple() {
+    table_type h;
+    int v;
+
+    {
+        TransactionGuard t;
+        assert(!h.transGet(0, v));
+        assert(h.transInsert(0, 1));
+        assert(h.transGet(0, v) && v == 1);
+        h.transPut(1, 3);
+    }
+    {
+        TransactionGuard t;
+        assert(h.transUpdate(1, 2));
+        assert(!h.transInsert(0, 5));
+        assert(!h.transUpdate(2, 1));
+    }
+    {
+        TransactionGuard t;
+        assert(h.transGet(0, v) && v == 1);
+        assert(h.transGet(1, v) && v == 2);
+        assert(!h.transGet(2, v));
+    }
+    assert(h.nontrans_find(1, v) && v == 2);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testConflicts() {
+    table_type h;
+    int v;
+    h.nontrans_insert(3, 3);
+
+    // absent-key read vs. concurrent insert
+    TestTransaction t1(1);
+    assert(!h.transGet(2, v));
+    h.transPut(1000, 0);
+    TestTransaction t2(2);
+    assert(h.transInsert(2, 2));
+    assert(t2.try_commit());
+    assert(!t1.try_commit());
+
+    // an uncommitted insert forces readers to abort
+    TestTransaction t3(1);
+    assert(h.transInsert(4, 0));
+    TestTransaction t4(2);
+    try {
+        h.transUpdate(4, 1);
+        assert(0);
+    } catch (Transaction::Abort e) {
+    }
+    t3.use();
+    assert(t3.try_commit());
+
+    // update vs. delete
+    TestTransaction t5(1);
+    assert(h.transUpdate(3, 17));
+    TestTransaction t6(2);
+    assert(h.transDelete(3));
+    assert(t6.try_commit());
+    assert(!t5.try_commit());
+
+    {
+        TransactionGuard t;
+        assert(!h.transGet(3, v));
+        assert(h.transGet(4, v) && v == 0);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testDeleteInsert() {
+    table_type h;
+    int v;
+
+    // insert-then-delete
+    {
+        TransactionGuard t;
+        assert(h.transInsert(4, 14));
+        assert(h.transDelete(4));
+        assert(!h.transGet(4, v));
+        assert(!h.transDelete(4));
+    }
+    // delete-then-insert
+    h.nontrans_insert(5, 5);
+    {
+        TransactionGuard t;
+        assert(h.transDelete(5));
+        assert(!h.transGet(5, v));
+        assert(h.transInsert(5, 6));
+        assert(h.transGet(5, v) && v == 6);
+    }
+    {
+        TransactionGuard t;
+        assert(h.transGet(5, v) && v == 6);
+        assert(!h.transGet(4, v));
+    }
+
+    // insert-then-delete-then-insert reuses the released slot
+    {
+        TransactionGuard t;
+        assert(h.transInsert(1, 10));
+        assert(h.transDelete(1));
+        assert(h.transInsert(1, 20));
+        assert(h.transGet(1, v) && v == 20);
+        h.transPut(1, 21);
+    }
+    {
+        TransactionGuard t;
+        assert(h.transGet(1, v) && v == 21);
+    }
+
+    // the insert-then-delete still conflicts with a concurrent insert
+    TestTransaction t1(1);
+    assert(h.transInsert(7, 7));
+    assert(h.transDelete(7));
+    h.transPut(1000, 0);
+    TestTransaction t2(2);
+    assert(h.transInsert(7, 8));
+    assert(t2.try_commit());
+    assert(!t1.try_commit());
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testFull() {
+    // a small table, filled to capacity so most keys overflow their home
+    // group, then churned so deleted slots are reused
+    table_type h(64);
+    int n = h.capacity();
+    int v;
+    for (int i = 0; i < n; ++i) {
+        TransactionGuard t;
+        assert(h.transInsert(i, i));
+    }
+    for (int i = 0; i < n; ++i)
+        assert(h.nontrans_find(i, v) && v == i);
+    for (int round = 0; round < 4; ++round) {
+        for (int i = round; i < n; i += 2) {
+            TransactionGuard t;
+            assert(h.transDelete(i));
+        }
+        for (int i = round; i < n; i += 2) {
+            TransactionGuard t;
+            assert(!h.transGet(i, v));
+            assert(h.transInsert(i + n, i));
+        }
+        for (int i = round; i < n; i += 2) {
+            {
+                TransactionGuard t;
+                assert(h.transDelete(i + n));
+            }
+            TransactionGuard t;
+            assert(h.transInsert(i, i));
+        }
+    }
+    {
+        TransactionGuard t;
+        for (int i = 0; i < n; ++i)
+            assert(h.transGet(i, v) && v == i);
+        assert(!h.transGet(n, v));
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSlotReuse() {
+    // a reader of a slot whose key is deleted and replaced must fail
+    // validation even though the slot holds a valid entry again
+    table_type h(8);
+    int v;
+    h.nontrans_insert(1, 1);
+
+    TestTransaction t1(1);
+    assert(h.transGet(1, v) && v == 1);
+    h.transPut(1000, 0);
+    TestTransaction t2(2);
+    assert(h.transDelete(1));
+    assert(t2.try_commit());
+    TestTransaction t3(2);
+    for (int i = 2; i < 8; ++i)
+        h.transInsert(i, i);
+    assert(t3.try_commit());
+    assert(!t1.try_commit());
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testSimple();
+    testConflicts();
+    testDeleteInsert();
+    testFull();
+    testSlotReuse();
+    return 0;
+}
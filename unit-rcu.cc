@@ -32,6 +32,7 @@ void* tracker_run(void* argument) {
             usleep(useconds_t(this_delay * 0.3e6));
         } RETRY(false);
     }
+    Transaction::rcu_quiesce();
     return nullptr;
 }
 
@@ -85,6 +86,29 @@ int main(int argc, char* argv[]) {
     for (unsigned i = 0; i < nthreads; ++i)
         pthread_join(tids[i], NULL);
 
+    // every thread has quiesced, so epoch_sync can reclaim our own garbage
+    TRANSACTION {
+        Transaction::rcu_delete(new Tracker);
+    } RETRY(false);
+    assert(Transaction::rcu_pending() > 0);
+    auto nslot0 = Transaction::tinfo[0].rcu_set.pending();
+    auto nfreed_sync = nfreed;
+    Transaction::epoch_sync();
+    assert(Transaction::tinfo[0].rcu_set.pending() == 0);
+    assert(nfreed == nfreed_sync + nslot0);
+
+    // pooled objects are destroyed after the grace period, then reused
+    Tracker* t = Transaction::pool_new<Tracker>();
+    TRANSACTION {
+        Transaction::rcu_pool_delete(t);
+    } RETRY(false);
+    auto nfreed_pool = nfreed;
+    Transaction::epoch_sync();
+    assert(nfreed == nfreed_pool + 1);
+    auto pstats = Transaction::pool_stats_combined(TRcuPool::size_class(sizeof(Tracker)));
+    assert(pstats.cached == 1);
+    assert(Transaction::pool_allocate(sizeof(Tracker)) == t);
+
     auto nfreed_before = nfreed;
     for (unsigned i = 0; i < nthreads; ++i)
         Transaction::tinfo[i].rcu_set.~TRcuSet();
@@ -240,6 +240,47 @@ void testNoOpacity1() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testBatchValidation() {
+    TArray<int, 300, TNonopaqueWrapped> f;
+    for (int i = 0; i < 300; i++)
+        f.nontrans_put(i, i);
+
+    for (int batch = 0; batch < 2; ++batch) {
+        Transaction::batch_commit = batch;
+        // a conflict anywhere in the read set, including across the
+        // boundaries of a validation block, is caught
+        for (int k : {1, 63, 64, 150, 299}) {
+            TestTransaction t1(1);
+            int sum = 0;
+            for (int i = 0; i < 300; i++)
+                sum += f[i];
+            f[0] = sum;
+
+            TestTransaction t2(2);
+            f[k] = f[k] + 1;
+            assert(t2.try_commit());
+
+            t1.use();
+            assert(!t1.try_commit());
+        }
+        // items we read and then locked ourselves still validate
+        {
+            TestTransaction t1(1);
+            for (int i = 0; i < 300; i++)
+                f[i] = f[i] + 1;
+            assert(t1.try_commit());
+        }
+    }
+    Transaction::batch_commit = true;
+
+    {
+        TransactionGuard t;
+        assert(f[1] == 5 && f[2] == 4 && f[150] == 154 && f[299] == 303);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testSimpleString();
@@ -251,5 +292,6 @@ int main() {
     testConflictingModifyIter3();
     testOpacity1();
     testNoOpacity1();
+    testBatchValidation();
     return 0;
 }
@@ -6,6 +6,7 @@
 #include "Transaction.hh"
 #include "TBox.hh"
 #include "StringWrapper.hh"
+#include "Interleave.hh"
 
 #define GUARDED if (TransactionGuard tguard{})
 
@@ -245,6 +246,389 @@ void testStringWrapper() {
     printf("PASS: %s\n", __FUNCTION__);
 }
 
+void testReadOnly() {
+    TBox<int> f;
+    TBox<int, TNonopaqueWrapped<int> > nf;
+    f.nontrans_write(1);
+    nf.nontrans_write(1);
+
+    int x = 0;
+    TRANSACTION_RO {
+        x = f;
+    } RETRY(false);
+    assert(x == 1);
+
+    bool thrown = false;
+    try {
+        TRANSACTION_RO {
+            f = 2;
+        } RETRY(false);
+    } catch (Transaction::ReadOnlyViolation& e) {
+        thrown = true;
+    }
+    assert(thrown);
+    assert(f.nontrans_read() == 1);
+
+    // opaque reads need no commit-time validation: serialize before t2
+    Sto::start_read_only_transaction();
+    x = f;
+    {
+        TestTransaction t2(2);
+        f = 3;
+        assert(t2.try_commit());
+    }
+    assert(Sto::try_commit());
+    assert(x == 1);
+
+    // nonopaque reads are still validated
+    Sto::start_read_only_transaction();
+    x = nf;
+    {
+        TestTransaction t2(2);
+        nf = 3;
+        assert(t2.try_commit());
+    }
+    assert(!Sto::try_commit());
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testManyItems() {
+    // enough items to outgrow the fixed-size item hashtable
+    std::vector<TBox<int> > boxes(20000);
+
+    TRANSACTION {
+        for (unsigned i = 0; i != boxes.size(); ++i)
+            boxes[i] = i;
+        for (unsigned i = 0; i < boxes.size(); i += 7)
+            boxes[i] = boxes[i] + 1;
+        for (unsigned i = 0; i != boxes.size(); ++i) {
+            int x = boxes[i];
+            assert(x == int(i + (i % 7 == 0)));
+        }
+    } RETRY(false);
+
+    for (unsigned i = 0; i != boxes.size(); ++i)
+        assert(boxes[i].nontrans_read() == int(i + (i % 7 == 0)));
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testNoThrow() {
+    TBox<int> f, g;
+
+    Sto::start_nothrow_transaction();
+    int x = f;
+    assert(x == 0);
+    {
+        TestTransaction t2(2);
+        f = 1;
+        g = 1;
+        assert(t2.try_commit());
+    }
+    // opacity violation aborts without throwing
+    x = g;
+    assert(Sto::aborted());
+    // later operations are ignored
+    g = x + 10;
+    assert(!Sto::try_commit());
+    assert(g.nontrans_read() == 1);
+
+    int n = 0;
+    TRANSACTION_NOTHROW {
+        ++n;
+        f = f + 1;
+    } RETRY_NOTHROW(true);
+    assert(n == 1);
+    assert(!Sto::aborted());
+    assert(f.nontrans_read() == 2);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testAbortTelemetry() {
+    TBox<int> f, g;
+    AbortTelemetry::enabled = true;
+    AbortTelemetry::sample_period = 1;
+    AbortTelemetry::clear();
+
+    for (int i = 0; i < 3; ++i) {
+        TestTransaction t1(1);
+        f = f + 1;
+        int x = g;
+        (void) x;
+
+        TestTransaction t2(2);
+        g = i;
+        assert(t2.try_commit());
+
+        t1.use();
+        assert(!t1.try_commit());
+    }
+
+    auto keys = AbortTelemetry::top_keys(5);
+    assert(keys.size() == 1 && keys[0].owner == &g && keys[0].count == 3);
+    auto owners = AbortTelemetry::top_owners(5);
+    assert(owners.size() == 1 && owners[0].owner == &g);
+    auto reasons = AbortTelemetry::top_reasons(5);
+    assert(reasons.size() == 1 && strcmp(reasons[0].reason, "commit check") == 0
+           && reasons[0].phase == AbortTelemetry::ph_commit_check);
+
+    // a full ring's oldest record may be mid-overwrite, so it's dropped
+    AbortTelemetry::clear();
+    auto& ts = Transaction::tinfo[TThread::id()].aborts;
+    for (unsigned i = 0; i != AbortTelemetry::ring_size + 3; ++i)
+        AbortTelemetry::on_abort(ts, TThread::id(), &f, i, "test", AbortTelemetry::ph_in_progress);
+    auto recs = AbortTelemetry::snapshot();
+    assert(recs.size() == AbortTelemetry::ring_size - 1);
+    assert(recs.front().key == 4 && recs.back().key == AbortTelemetry::ring_size + 2);
+
+    AbortTelemetry::clear();
+    assert(AbortTelemetry::snapshot().empty());
+    AbortTelemetry::enabled = false;
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testSavepoints() {
+    TBox<int> f, g;
+    TBox<std::string> s;
+    f.nontrans_write(1);
+    s.nontrans_write("a");
+
+    {
+        TransactionGuard t;
+        f = 2;
+        s = "b";
+        auto sp = Sto::savepoint();
+        f = 3;
+        g = 4;
+        s = "c";
+        std::string sv = s;
+        assert(f == 3 && g == 4 && sv == "c");
+        Sto::rollback_to(sp);
+        sv = s;
+        assert(f == 2 && g == 0 && sv == "b");
+        // the savepoint can be reused
+        g = 5;
+        Sto::rollback_to(sp);
+        assert(g == 0);
+        g = 6;
+        Sto::release_savepoint(sp);
+    }
+
+    {
+        TransactionGuard t;
+        std::string sv = s;
+        assert(f == 2 && g == 6 && sv == "b");
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testNestedTransaction() {
+    TBox<int> a, b, c;
+    TBox<int> box;
+    int outer = 0, inner = 0;
+
+    TRANSACTION {
+        ++outer;
+        int x = a;
+        box = x + 1;
+        TRANSACTION {
+            ++inner;
+            int y = b;
+            if (inner == 1) {
+                // a concurrent commit invalidates the nested block's read
+                TestTransaction t(1);
+                b = 10;
+                c = 20;
+                assert(t.try_commit());
+            }
+            // fails the opacity check, rolling back just this block
+            int z = c;
+            box = x + y + z;
+        } RETRY(true);
+    } RETRY(true);
+
+    assert(outer == 1 && inner == 2);
+    {
+        TransactionGuard t;
+        assert(box == 30);
+    }
+
+    // an invalid read from the enclosing block retries everything
+    outer = inner = 0;
+    TRANSACTION {
+        ++outer;
+        int x = a;
+        TRANSACTION {
+            ++inner;
+            if (outer == 1) {
+                TestTransaction t(1);
+                a = 100;
+                c = 200;
+                assert(t.try_commit());
+            }
+            box = x + c;
+        } RETRY(true);
+    } RETRY(true);
+
+    assert(outer == 2 && inner == 2);
+    {
+        TransactionGuard t;
+        assert(box == 300);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+struct increment_task {
+    TBox<int>* box;
+    int v;
+    bool read;
+    void reset() {
+        read = false;
+    }
+    bool step() {
+        if (!read) {
+            v = *box;
+            read = true;
+            return false;
+        }
+        *box = v + 1;
+        return true;
+    }
+};
+
+void testInterleaved() {
+    TBox<int> f;
+    std::vector<increment_task> tasks(100);
+    for (auto& t : tasks)
+        t.box = &f;
+
+    Transaction* base = TThread::txn;
+    InterleavedExecutor<increment_task> exec(4);
+    uint64_t naborts = exec.run(tasks.begin(), tasks.end());
+    // every slot reads f before any commits, so most attempts conflict
+    assert(naborts > 0);
+    assert(TThread::txn == base);
+    {
+        TransactionGuard t;
+        assert(f == 100);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+#if STO_COROUTINES
+// a nested step: aborts the first time it runs
+Coroutine<int> co_read(TBox<int>& box, int& nreads) {
+    co_await interleave_yield(&box);
+    if (nreads++ == 0)
+        Sto::abort();
+    co_return box;
+}
+
+void testCoroutines() {
+    TBox<int> f;
+    int nreads = 0;
+    std::vector<CoroutineTask> tasks;
+    for (int i = 0; i < 100; ++i)
+        tasks.emplace_back([&]() -> Coroutine<void> {
+                int v = co_await co_read(f, nreads);
+                co_await interleave_yield(nullptr);
+                f = v + 1;
+            });
+
+    Transaction* base = TThread::txn;
+    InterleavedExecutor<CoroutineTask> exec(4);
+    uint64_t naborts = exec.run(tasks.begin(), tasks.end());
+    assert(naborts > 1);
+    assert(nreads == int(naborts) + 100);
+    assert(TThread::txn == base);
+    {
+        TransactionGuard t;
+        assert(f == 100);
+    }
+
+    // other exceptions leave run()
+    std::vector<CoroutineTask> throwers;
+    throwers.emplace_back([&]() -> Coroutine<void> {
+            co_await interleave_yield(nullptr);
+            throw std::runtime_error("x");
+        });
+    bool caught = false;
+    try {
+        exec.run(throwers.begin(), throwers.end());
+    } catch (std::runtime_error&) {
+        caught = true;
+    }
+    assert(caught && TThread::txn == base);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+#endif
+
+void testRunBatch() {
+    TBox<int> f, g;
+    std::vector<std::function<void()> > closures;
+    for (int i = 0; i < 40; ++i)
+        closures.push_back([&]() {
+                f = f + 1;
+            });
+    // always aborts, so it is rolled back and reported as failed
+    closures[7] = [&]() {
+        g = 1;
+        Sto::abort();
+    };
+
+    std::vector<bool> results;
+    unsigned n = Sto::run_batch(closures, &results);
+    assert(n == 39);
+    for (int i = 0; i < 40; ++i)
+        assert(results[i] == (i != 7));
+    {
+        TransactionGuard t;
+        assert(f == 39 && g == 0);
+    }
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+// counts the per-item hooks commit calls on it
+class CountingBox : public TBox<int> {
+public:
+    int nlock = 0, ncheck = 0, ninstall = 0;
+    bool lock(TransItem& item, Transaction& txn) override {
+        ++nlock;
+        return TBox<int>::lock(item, txn);
+    }
+    bool check(TransItem& item, Transaction& txn) override {
+        ++ncheck;
+        return TBox<int>::check(item, txn);
+    }
+    void install(TransItem& item, Transaction& txn) override {
+        ++ninstall;
+        TBox<int>::install(item, txn);
+    }
+};
+
+void testSubclassHooks() {
+    CountingBox a, b;
+    TBox<int> c;
+    {
+        TransactionGuard t;
+        a.write(a.read() + 1);
+        b.write(b.read() + 1);
+        c = c + 1;
+    }
+    assert(a.nlock == 1 && a.ncheck == 1 && a.ninstall == 1);
+    assert(b.nlock == 1 && b.ncheck == 1 && b.ninstall == 1);
+    assert(a.nontrans_read() == 1 && c.nontrans_read() == 1);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
 int main() {
     testSimpleInt();
     testSimpleString();
@@ -252,5 +636,17 @@ int main() {
     testOpacity1();
     testNoOpacity1();
     testStringWrapper();
+    testReadOnly();
+    testManyItems();
+    testNoThrow();
+    testAbortTelemetry();
+    testSavepoints();
+    testNestedTransaction();
+    testInterleaved();
+#if STO_COROUTINES
+    testCoroutines();
+#endif
+    testRunBatch();
+    testSubclassHooks();
     return 0;
 }
@@ -278,6 +278,62 @@ int main() {
         assert(v7 == &hello);
     }
 
+    // interning goes through the hash index, which survives clear()
+    {
+        TransactionBuffer buf;
+        for (int round = 0; round != 2; ++round) {
+            std::vector<void*> keys;
+            for (int i = 0; i != 1000; ++i)
+                keys.push_back(Packer<std::string>::pack_unique(buf, std::to_string(i)));
+            for (int i = 999; i >= 0; --i) {
+                assert(Packer<std::string>::pack_unique(buf, std::to_string(i)) == keys[i]);
+                assert(Packer<std::string>::unpack(keys[i]) == std::to_string(i));
+            }
+            buf.clear();
+        }
+
+        // keys without std::hash fall back to a linear search
+        struct wide_key {
+            uintptr_t a, b;
+            bool operator==(const wide_key& x) const {
+                return a == x.a && b == x.b;
+            }
+        };
+        void* w1 = Packer<wide_key>::pack_unique(buf, wide_key{1, 2});
+        void* w2 = Packer<wide_key>::pack_unique(buf, wide_key{2, 1});
+        assert(w1 != w2);
+        assert(Packer<wide_key>::pack_unique(buf, wide_key{1, 2}) == w1);
+    }
+
+    // destructors run on clear() only for nontrivial types, across chunks,
+    // including huge-page chunks
+    {
+        struct counted {
+            int* n;
+            counted(int* x)
+                : n(x) {
+            }
+            ~counted() {
+                ++*n;
+            }
+        };
+        int ndestroyed = 0;
+        TransactionBuffer::huge_pages = true;
+        TransactionBuffer buf;
+        std::vector<uintptr_t*> words;
+        for (uintptr_t i = 0; i != (4 << 20) / 16; ++i)
+            words.push_back(buf.allocate<uintptr_t>(i));
+        for (int i = 0; i != 100; ++i)
+            buf.allocate<counted>(&ndestroyed);
+        assert(*words[12345] == 12345 && *words.back() == words.size() - 1);
+        buf.clear();
+        assert(ndestroyed == 100);
+        buf.allocate<counted>(&ndestroyed);
+        buf.clear();
+        assert(ndestroyed == 101);
+        TransactionBuffer::huge_pages = false;
+    }
+
 
     testTrivial();
     testSimpleRangesOk();
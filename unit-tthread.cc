@@ -0,0 +1,126 @@
+#undef NDEBUG
+#include <iostream>
+#include <assert.h>
+#include <pthread.h>
+#include "Transaction.hh"
+
+static void* set_id_run(void* arg) {
+    TThread::set_id(reinterpret_cast<intptr_t>(arg));
+    return nullptr;
+}
+
+static void* register_run(void* arg) {
+    int* id = static_cast<int*>(arg);
+    *id = TThread::register_thread();
+    assert(TThread::id() == *id);
+    TThread::unregister_thread();
+    return nullptr;
+}
+
+static int register_in_thread() {
+    int id;
+    pthread_t t;
+    pthread_create(&t, NULL, register_run, &id);
+    pthread_join(t, NULL);
+    return id;
+}
+
+void testMixedIds() {
+    // the main thread implicitly owns id 0
+    assert(TThread::id() == 0);
+    assert(register_in_thread() == 1);
+
+    // ids picked with set_id() are never handed out
+    pthread_t t;
+    pthread_create(&t, NULL, set_id_run, reinterpret_cast<void*>(1));
+    pthread_join(t, NULL);
+    pthread_create(&t, NULL, set_id_run, reinterpret_cast<void*>(3));
+    pthread_join(t, NULL);
+    assert(register_in_thread() == 2);
+
+    // a released slot is reused
+    int id = TThread::register_thread();
+    assert(id == 2);
+    assert(register_in_thread() == 4);
+    TThread::unregister_thread();
+    assert(register_in_thread() == 2);
+    TThread::set_id(0);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+static int nhook_calls;
+
+static void count_hook(void*) {
+    ++nhook_calls;
+}
+
+static void* hook_run(void* arg) {
+    TThread::register_thread();
+    if (arg) {
+        assert(Transaction::add_start_hook(count_hook, nullptr));
+        assert(Transaction::add_end_hook(count_hook, nullptr));
+    }
+    TRANSACTION {
+    } RETRY(false);
+    TThread::unregister_thread();
+    return nullptr;
+}
+
+void testHooksDropped() {
+    // a slot's hooks go away with its owner
+    for (int i = 0; i < 20; ++i) {
+        pthread_t t;
+        pthread_create(&t, NULL, hook_run, reinterpret_cast<void*>(1));
+        pthread_join(t, NULL);
+    }
+    assert(nhook_calls == 40);
+    pthread_t t;
+    pthread_create(&t, NULL, hook_run, nullptr);
+    pthread_join(t, NULL);
+    assert(nhook_calls == 40);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+static void* garbage_run(void* arg) {
+    *static_cast<int*>(arg) = TThread::register_thread();
+    TRANSACTION {
+        Transaction::rcu_free(malloc(16));
+    } RETRY(false);
+    TThread::unregister_thread();
+    return nullptr;
+}
+
+void testGarbageDrained() {
+    // a released slot's garbage is freed even if nobody reuses the slot
+    int id;
+    pthread_t t;
+    pthread_create(&t, NULL, garbage_run, &id);
+    pthread_join(t, NULL);
+    assert(Transaction::tinfo[id].rcu_set.pending() > 0);
+    Transaction::epoch_sync();
+    assert(Transaction::tinfo[id].rcu_set.pending() == 0);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+void testBackoffSeeds() {
+    // threads colliding on a key must not back off in lockstep
+    auto& a = Transaction::tinfo[0].cm;
+    auto& b = Transaction::tinfo[1].cm;
+    bool differ = false;
+    for (int i = 0; i < 4; ++i)
+        differ |= a.random() != b.random();
+    assert(differ);
+
+    printf("PASS: %s\n", __FUNCTION__);
+}
+
+int main() {
+    testMixedIds();
+    testHooksDropped();
+    testGarbageDrained();
+    testBackoffSeeds();
+    return 0;
+}